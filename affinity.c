@@ -0,0 +1,289 @@
+/*
+ * File:   affinity.c
+ * Author: DoI
+ *
+ * CPU and NUMA placement. With --cpus every worker thread is pinned to one of
+ * the CPUs given, and radamsa, forked by the worker, inherits its CPU. With
+ * --target-cpus the target is pinned too: a supervised target from before it
+ * execs, so everything it forks inherits the mask, and a -c target (with its
+ * threads and child processes) once at start-up. "siblings" pairs the target
+ * with the workers: the SMT siblings of their CPUs, or failing that the other
+ * CPUs of their NUMA nodes. The trace map is bound to the node of the first
+ * worker's CPU, so the bitmap the target writes and fuzzotron reads stays
+ * node-local.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/limits.h>
+
+#include "affinity.h"
+#include "util.h"
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+struct affinity_args affinity;
+static int worker_cpus[CPU_SETSIZE]; // worker i runs on worker_cpus[i % worker_count]
+static int worker_count = 0;
+static cpu_set_t target_cpus;
+
+// Parse a CPU list such as "0-3,8,10-11" into set. Returns the number of CPUs, or -1 if it's malformed
+static int parse_list(char * list, cpu_set_t * set){
+    char * p = list, * end;
+    long lo, hi;
+
+    CPU_ZERO(set);
+    while(*p){
+        if(!isdigit((unsigned char)*p))
+            return -1;
+        lo = hi = strtol(p, &end, 10);
+        if(*end == '-'){
+            p = end + 1;
+            if(!isdigit((unsigned char)*p))
+                return -1;
+            hi = strtol(p, &end, 10);
+        }
+        if(lo > hi || hi >= CPU_SETSIZE)
+            return -1;
+        for(; lo <= hi; lo++)
+            CPU_SET(lo, set);
+
+        p = end;
+        if(*p == ',')
+            p++;
+        else if(*p && *p != '\n')
+            return -1;
+        else
+            break;
+    }
+
+    return CPU_COUNT(set);
+}
+
+// Read a CPU list out of a sysfs file into set. Returns the number of CPUs, or -1
+static int read_list(char * path, cpu_set_t * set){
+    char buf[4096];
+    FILE * fp;
+    int r = -1;
+
+    if((fp = fopen(path, "r")) == NULL)
+        return -1;
+    if(fgets(buf, sizeof(buf), fp) != NULL)
+        r = parse_list(buf, set);
+    fclose(fp);
+
+    return r;
+}
+
+// NUMA node a CPU belongs to, -1 if sysfs doesn't say
+static int cpu_node(int cpu){
+    char path[PATH_MAX];
+    struct dirent * ent;
+    int node = -1;
+    DIR * d;
+
+    snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%d", cpu);
+    if((d = opendir(path)) == NULL)
+        return -1;
+    while((ent = readdir(d)) != NULL){
+        if(!strncmp(ent->d_name, "node", 4) && isdigit((unsigned char)ent->d_name[4])){
+            node = atoi(ent->d_name + 4);
+            break;
+        }
+    }
+    closedir(d);
+
+    return node;
+}
+
+// Print a set the way it was given, as a CPU list
+static void format_list(cpu_set_t * set, char * buf, size_t size){
+    int cpu, start = -1, n = 0;
+
+    buf[0] = '\0';
+    for(cpu = 0; cpu <= CPU_SETSIZE; cpu++){
+        if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, set)){
+            if(start < 0)
+                start = cpu;
+            continue;
+        }
+        if(start < 0)
+            continue;
+        if(cpu - 1 == start)
+            n += snprintf(buf + n, size - n, "%s%d", n ? "," : "", start);
+        else
+            n += snprintf(buf + n, size - n, "%s%d-%d", n ? "," : "", start, cpu - 1);
+        if((size_t)n >= size)
+            return;
+        start = -1;
+    }
+}
+
+int affinity_parse_workers(char * list){
+    cpu_set_t set;
+    int cpu;
+
+    if(parse_list(list, &set) <= 0)
+        return -1;
+
+    worker_count = 0;
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if(CPU_ISSET(cpu, &set))
+            worker_cpus[worker_count++] = cpu;
+    affinity.workers_set = 1;
+
+    return 0;
+}
+
+int affinity_parse_target(char * spec){
+    affinity.target_set = 1;
+    if(!strcmp(spec, AFFINITY_SIBLINGS)){
+        affinity.target_siblings = 1;
+        return 0;
+    }
+
+    return parse_list(spec, &target_cpus) > 0 ? 0 : -1;
+}
+
+// Work out the target's CPUs if they're to be paired with the workers', and print the placement
+void affinity_setup(int workers_n){
+    cpu_set_t workers, pair;
+    char path[PATH_MAX], list[1024];
+    int i, node;
+
+    if(affinity.target_siblings){
+        if(!affinity.workers_set){
+            fatal("--target-cpus siblings needs the worker CPUs given with --cpus\n");
+        }
+
+        CPU_ZERO(&workers);
+        for(i = 0; i < worker_count; i++)
+            CPU_SET(worker_cpus[i], &workers);
+
+        // hyperthread siblings share a core's caches, the closest the target can get
+        CPU_ZERO(&target_cpus);
+        for(i = 0; i < worker_count; i++){
+            snprintf(path, PATH_MAX, "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", worker_cpus[i]);
+            if(read_list(path, &pair) > 0)
+                CPU_OR(&target_cpus, &target_cpus, &pair);
+        }
+        CPU_XOR(&pair, &target_cpus, &workers);
+        CPU_AND(&target_cpus, &pair, &target_cpus);
+
+        // no SMT, or the siblings are workers too: the rest of the workers' nodes
+        if(CPU_COUNT(&target_cpus) == 0){
+            for(i = 0; i < worker_count; i++){
+                if((node = cpu_node(worker_cpus[i])) < 0)
+                    continue;
+                snprintf(path, PATH_MAX, "/sys/devices/system/node/node%d/cpulist", node);
+                if(read_list(path, &pair) > 0)
+                    CPU_OR(&target_cpus, &target_cpus, &pair);
+            }
+            CPU_XOR(&pair, &target_cpus, &workers);
+            CPU_AND(&target_cpus, &pair, &target_cpus);
+        }
+
+        // nothing left over, share with the workers rather than float
+        if(CPU_COUNT(&target_cpus) == 0)
+            target_cpus = workers;
+    }
+
+    if(affinity.workers_set){
+        for(i = 0; i < workers_n; i++)
+            printf("[+] Worker %d on CPU %d (node %d)\n", i + 1, worker_cpus[i % worker_count],
+                cpu_node(worker_cpus[i % worker_count]));
+    }
+    if(affinity.target_set){
+        format_list(&target_cpus, list, sizeof(list));
+        for(i = 0; i < CPU_SETSIZE && !CPU_ISSET(i, &target_cpus); i++);
+        printf("[+] Target on CPUs %s (node %d)\n", list, i < CPU_SETSIZE ? cpu_node(i) : -1);
+    }
+}
+
+// Pin the calling worker thread, radamsa forked from it inherits the CPU
+void affinity_pin_worker(unsigned int index){
+    cpu_set_t set;
+    int cpu, r;
+
+    if(!affinity.workers_set)
+        return;
+
+    cpu = worker_cpus[index % worker_count];
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if((r = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+        printf("[!] Could not pin worker %u to CPU %d: %s\n", index + 1, cpu, strerror(r));
+}
+
+// In a freshly forked target, before it execs, so everything it starts inherits the mask
+void affinity_pin_self_target(){
+    if(affinity.target_set)
+        sched_setaffinity(0, sizeof(cpu_set_t), &target_cpus);
+}
+
+/*
+ * Pin every thread of pid and, through /proc/<pid>/task/<tid>/children, every process it has
+ * started since. Returns the number of threads pinned.
+ */
+int affinity_pin_pid(pid_t pid){
+    char path[PATH_MAX];
+    struct dirent * ent;
+    int n = 0, child;
+    FILE * fp;
+    DIR * d;
+
+    if(!affinity.target_set)
+        return 0;
+
+    snprintf(path, PATH_MAX, "/proc/%d/task", pid);
+    if((d = opendir(path)) == NULL)
+        return 0;
+    while((ent = readdir(d)) != NULL){
+        if(!isdigit((unsigned char)ent->d_name[0]))
+            continue;
+        if(sched_setaffinity(atoi(ent->d_name), sizeof(cpu_set_t), &target_cpus) == 0)
+            n++;
+
+        snprintf(path, PATH_MAX, "/proc/%d/task/%s/children", pid, ent->d_name);
+        if((fp = fopen(path, "r")) == NULL)
+            continue;
+        while(fscanf(fp, "%d", &child) == 1)
+            n += affinity_pin_pid(child);
+        fclose(fp);
+    }
+    closedir(d);
+
+    return n;
+}
+
+// Prefer the first worker's node for a map, moving any pages already touched
+void affinity_bind_map(void * addr, size_t len){
+    unsigned long mask;
+    int node;
+
+    if(!affinity.workers_set || (node = cpu_node(worker_cpus[0])) < 0)
+        return;
+    if(node >= (int)(sizeof(mask) * 8))
+        return;
+
+    mask = 1UL << node;
+    if(syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, MPOL_MF_MOVE) < 0)
+        printf("[!] Could not bind the trace map to node %d: %s\n", node, strerror(errno));
+    else
+        printf("[+] Trace map bound to node %d\n", node);
+}
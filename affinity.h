@@ -0,0 +1,31 @@
+/*
+ * File:   affinity.h
+ * Author: DoI
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define AFFINITY_SIBLINGS "siblings" // --target-cpus value pairing the target with the workers' CPUs
+
+// The CPU sets themselves are kept in affinity.c, cpu_set_t needs _GNU_SOURCE before any system header
+struct affinity_args {
+    int workers_set; // --cpus given
+    int target_set; // --target-cpus given
+    int target_siblings; // --target-cpus siblings, worked out from the worker CPUs
+};
+
+extern struct affinity_args affinity;
+
+int affinity_parse_workers(char * list);
+int affinity_parse_target(char * spec);
+void affinity_setup(int workers);
+void affinity_pin_worker(unsigned int index);
+void affinity_pin_self_target();
+int affinity_pin_pid(pid_t pid);
+void affinity_bind_map(void * addr, size_t len);
+
+#endif
@@ -0,0 +1,384 @@
+/*
+ * File:   archive.c
+ * Author: DoI
+ *
+ * Single file corpus archive. A corpus of 100k+ cases as one file per case
+ * makes directory operations the bottleneck, so corpora can instead be kept in
+ * an append-only archive: a file header followed by entries, each one a header
+ * (content hash, parent hash, trace hash, size, exec time) then the case name
+ * and payload, optionally zlib compressed. Several threads can add to the
+ * same archive; appends are serialised, a short write is carried on with and
+ * a failed one truncated away, so a torn entry is never left mid-file.
+ * Archives are mmap'd for reading and the index is built by walking the
+ * entry headers, rather than kept in the file, so appending never has to
+ * rewrite anything already written and an archive cut short by a crash is
+ * still readable up to the last whole entry.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <linux/limits.h>
+
+#include "archive.h"
+#include "util.h"
+
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_ALIGN(_l) (((_l) + 7) & ~(uint64_t)7)
+
+// Does path hold an archive, as opposed to being a directory or a plain case
+int archive_is(char * path){
+    struct archive_header hdr;
+    int fd, ret = 0;
+
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return 0;
+    if(read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && memcmp(hdr.magic, ARCHIVE_MAGIC, sizeof(hdr.magic)) == 0)
+        ret = 1;
+    close(fd);
+
+    return ret;
+}
+
+// Open path for appending, creating it if needed. Returns 0 on success, -1 on error
+int archive_open(struct archive * ar, char * path, int compress){
+    struct archive_header hdr;
+    struct stat s;
+
+    ar->compress = compress;
+    pthread_mutex_init(&ar->lock, NULL);
+    if((ar->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0){
+        printf("[!] Could not open archive %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if(fstat(ar->fd, &s) < 0){
+        printf("[!] fstat failed on %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    if(s.st_size == 0){
+        memset(&hdr, 0x00, sizeof(hdr));
+        memcpy(hdr.magic, ARCHIVE_MAGIC, sizeof(hdr.magic));
+        hdr.version = ARCHIVE_VERSION;
+        if(write(ar->fd, &hdr, sizeof(hdr)) != sizeof(hdr)){
+            printf("[!] Could not write archive header to %s: %s\n", path, strerror(errno));
+            goto fail;
+        }
+    }
+    else if(pread(ar->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+            memcmp(hdr.magic, ARCHIVE_MAGIC, sizeof(hdr.magic)) != 0){
+        printf("[!] %s exists and is not an archive\n", path);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    close(ar->fd);
+    ar->fd = -1;
+    return -1;
+}
+
+// writev() until everything is out, picking up after short writes. Returns 0 on success, -1 on error
+static int writev_all(int fd, struct iovec * iov, int n){
+    ssize_t w;
+
+    for(;;){
+        while(n > 0 && iov->iov_len == 0){
+            iov++;
+            n--;
+        }
+        if(n == 0)
+            return 0;
+
+        if((w = writev(fd, iov, n)) < 0){
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        if(w == 0){
+            errno = ENOSPC;
+            return -1;
+        }
+
+        while(n > 0 && (size_t)w >= iov->iov_len){
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if(n > 0){
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+}
+
+/*
+ * Append a case. hash, parent, exec_hash and exec_us are taken from meta, the rest is filled in.
+ * name may be NULL. Returns 0 on success, -1 on error.
+ */
+int archive_add(struct archive * ar, char * name, char * data, unsigned long len, struct archive_entry * meta){
+    static const char pad[8] = {0};
+    struct archive_entry e;
+    struct iovec iov[4];
+    char * packed = NULL;
+    uLongf packed_len;
+    struct stat s;
+    int ret = 0;
+
+    memset(&e, 0x00, sizeof(e));
+    e.hash = meta->hash;
+    e.parent = meta->parent;
+    e.exec_hash = meta->exec_hash;
+    e.exec_us = meta->exec_us;
+    e.len = len;
+    e.stored = len;
+    e.name_len = name ? strlen(name) : 0;
+
+    // only worth keeping compressed if it came out smaller
+    if(ar->compress && len > 0){
+        packed_len = compressBound(len);
+        ft_malloc(packed_len, packed);
+        if(compress2((Bytef *)packed, &packed_len, (const Bytef *)data, len, Z_BEST_SPEED) == Z_OK && packed_len < len){
+            e.flags |= ARCHIVE_COMPRESSED;
+            e.stored = packed_len;
+        }
+    }
+
+    iov[0].iov_base = &e;
+    iov[0].iov_len = sizeof(e);
+    iov[1].iov_base = name;
+    iov[1].iov_len = e.name_len;
+    iov[2].iov_base = (e.flags & ARCHIVE_COMPRESSED) ? packed : data;
+    iov[2].iov_len = e.stored;
+    iov[3].iov_base = (void *)pad;
+    iov[3].iov_len = ARCHIVE_ALIGN(e.name_len + e.stored) - (e.name_len + e.stored);
+
+    pthread_mutex_lock(&ar->lock);
+    if(fstat(ar->fd, &s) < 0){
+        printf("[!] fstat failed on the archive: %s\n", strerror(errno));
+        ret = -1;
+    }
+    else if(writev_all(ar->fd, iov, 4) < 0){
+        printf("[!] Archive write failed: %s\n", strerror(errno));
+        // whatever got written would be read back as the start of an entry
+        if(ftruncate(ar->fd, s.st_size) < 0)
+            printf("[!] Could not remove the partial archive entry: %s\n", strerror(errno));
+        ret = -1;
+    }
+    pthread_mutex_unlock(&ar->lock);
+
+    free(packed);
+    return ret;
+}
+
+void archive_close(struct archive * ar){
+    if(ar->fd >= 0){
+        close(ar->fd);
+        pthread_mutex_destroy(&ar->lock);
+    }
+    ar->fd = -1;
+}
+
+// Map path and index its entries. Returns the number of entries, or -1 if it is not an archive
+int archive_map(struct archive_map * m, char * path){
+    const struct archive_entry * e;
+    unsigned long size = 0;
+    struct stat s;
+    uint64_t off, rec;
+    int fd;
+
+    memset(m, 0x00, sizeof(*m));
+    if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0){
+        printf("[!] Could not open archive %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if(fstat(fd, &s) < 0 || (size_t)s.st_size < sizeof(struct archive_header)){
+        close(fd);
+        return -1;
+    }
+
+    // private and writable, so a send callback can edit a case in place without touching the file
+    m->size = s.st_size;
+    m->map = mmap(NULL, m->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(m->map == MAP_FAILED){
+        printf("[!] Could not map archive %s: %s\n", path, strerror(errno));
+        m->map = NULL;
+        return -1;
+    }
+    if(memcmp(m->map, ARCHIVE_MAGIC, strlen(ARCHIVE_MAGIC)) != 0){
+        archive_unmap(m);
+        return -1;
+    }
+    madvise(m->map, m->size, MADV_SEQUENTIAL);
+
+    for(off = sizeof(struct archive_header); off + sizeof(*e) <= m->size; off += rec){
+        e = (const struct archive_entry *)(m->map + off);
+        rec = sizeof(*e) + ARCHIVE_ALIGN((uint64_t)e->name_len + e->stored);
+        if(e->stored > m->size || rec > m->size - off){
+            printf("[!] %s is truncated, ignoring the last entry\n", path);
+            break;
+        }
+        if(!(e->flags & ARCHIVE_COMPRESSED) && e->stored != e->len){
+            // used in place by the corpus, the length has to match what's there
+            printf("[!] Skipping corrupt entry at offset %lu of %s\n", (unsigned long)off, path);
+            continue;
+        }
+
+        if(m->count == size){
+            size = size ? size * 2 : 1024;
+            if((m->index = realloc(m->index, size * sizeof(struct archive_index))) == NULL){
+                fatal("[!] realloc failed\n");
+            }
+        }
+        m->index[m->count].entry = e;
+        m->index[m->count].name = (const char *)(e + 1);
+        m->index[m->count].data = (const char *)(e + 1) + e->name_len;
+        m->count++;
+    }
+
+    return m->count;
+}
+
+/*
+ * Payload of entry i, NULL if it is corrupt. Stored entries are returned in place in the mapping,
+ * compressed ones are inflated into a malloc'd buffer. Hand it back with archive_release().
+ */
+char * archive_data(struct archive_map * m, unsigned long i){
+    const struct archive_entry * e = m->index[i].entry;
+    uint64_t off = m->index[i].data - m->map;
+    uLongf len = e->len;
+    char * data;
+
+    // the payload has to be in the file, and all of it for an uncompressed entry
+    if(off > m->size || e->stored > m->size - off || (!(e->flags & ARCHIVE_COMPRESSED) && e->stored != e->len)){
+        printf("[!] Archive entry %lu is corrupt\n", i);
+        return NULL;
+    }
+
+    if(!(e->flags & ARCHIVE_COMPRESSED))
+        return m->map + off;
+
+    // a length no deflate stream could inflate to is a corrupt header, not worth allocating for
+    if(e->len > ARCHIVE_MAX_LEN || e->len > e->stored * ARCHIVE_MAX_RATIO){
+        printf("[!] Archive entry %lu claims %lu bytes from %lu compressed, skipping\n", i,
+            (unsigned long)e->len, (unsigned long)e->stored);
+        return NULL;
+    }
+
+    if((data = malloc(e->len + 1)) == NULL){
+        printf("[!] Could not allocate %lu bytes for archive entry %lu\n", (unsigned long)e->len + 1, i);
+        return NULL;
+    }
+    if(uncompress((Bytef *)data, &len, (const Bytef *)m->index[i].data, e->stored) != Z_OK || len != e->len){
+        printf("[!] Archive entry %lu is corrupt\n", i);
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+// Done with what archive_data() returned for entry i
+void archive_release(struct archive_map * m, unsigned long i, char * data){
+    if(m->index[i].entry->flags & ARCHIVE_COMPRESSED)
+        free(data);
+}
+
+// Payload of entry i in a malloc'd buffer of its own, for cases that outlive the mapping
+char * archive_copy(struct archive_map * m, unsigned long i){
+    const struct archive_entry * e = m->index[i].entry;
+    char * data, * copy;
+
+    if((data = archive_data(m, i)) == NULL || (e->flags & ARCHIVE_COMPRESSED))
+        return data;
+
+    ft_malloc(e->len + 1, copy);
+    memcpy(copy, data, e->len);
+    return copy;
+}
+
+void archive_unmap(struct archive_map * m){
+    if(m->map)
+        munmap(m->map, m->size);
+    free(m->index);
+    memset(m, 0x00, sizeof(*m));
+}
+
+// Load every case in the archive at path into a linked list, the same as load_testcases()
+testcase_t * archive_load(char * path){
+    struct archive_map m;
+    testcase_t * head = NULL, ** tail = &head, * entry;
+    unsigned long i;
+    char * data;
+
+    if(archive_map(&m, path) < 0){
+        fatal("[!] Error: %s is not an archive\n", path);
+    }
+
+    for(i = 0; i < m.count; i++){
+        if(m.index[i].entry->len == 0 || (data = archive_copy(&m, i)) == NULL)
+            continue;
+
+        ft_malloc(sizeof(testcase_t), entry);
+        entry->len = m.index[i].entry->len;
+        entry->data = data;
+        entry->next = NULL;
+        *tail = entry;
+        tail = (testcase_t **)&entry->next;
+    }
+    archive_unmap(&m);
+
+    if(head == NULL){
+        fatal("no testcases loaded");
+    }
+
+    return head;
+}
+
+/*
+ * Write every case in the archive at path to dir, one file each, named after the entry or its
+ * trace hash (content hash without one) like save_case(). Returns the number written, -1 on error.
+ */
+int archive_export(char * path, char * dir){
+    struct archive_map m;
+    char name[PATH_MAX];
+    const struct archive_entry * e;
+    unsigned long i;
+    char * data;
+    int n = 0;
+
+    if(archive_map(&m, path) < 0)
+        return -1;
+
+    for(i = 0; i < m.count; i++){
+        e = m.index[i].entry;
+        if(e->name_len > 0 && e->name_len < NAME_MAX)
+            snprintf(name, sizeof(name), "%.*s", (int)e->name_len, m.index[i].name);
+        else
+            snprintf(name, sizeof(name), "%u", e->exec_hash ? e->exec_hash : e->hash);
+
+        // a name with a slash in it would escape dir
+        if(strchr(name, '/') != NULL || !strcmp(name, ".") || !strcmp(name, "..")){
+            printf("[!] Skipping archive entry with bad name %s\n", name);
+            continue;
+        }
+
+        if((data = archive_data(&m, i)) == NULL)
+            continue;
+        save_case_p(data, e->len, name, dir);
+        archive_release(&m, i, data);
+        n++;
+    }
+    archive_unmap(&m);
+
+    return n;
+}
@@ -0,0 +1,75 @@
+/*
+ * File:   archive.h
+ * Author: DoI
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "generator.h"
+
+#define ARCHIVE_MAGIC "FZARCH01"
+#define ARCHIVE_EXT ".fza" // output paths ending in this are written as archives by the corpus tools
+#define ARCHIVE_COMPRESSED 0x01 // entry payload is zlib compressed
+#define ARCHIVE_MAX_LEN (256UL << 20) // largest case an entry may claim to inflate to
+#define ARCHIVE_MAX_RATIO 1032 // deflate can't do better than about 1032:1
+
+// File header, followed by the entries
+struct archive_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+};
+
+// Entry header, followed by the name and the stored payload, padded together to 8 bytes
+struct archive_entry {
+    uint32_t hash; // case_hash() of the payload
+    uint32_t parent; // hash of the case this one was mutated from, 0 if unknown
+    uint32_t exec_hash; // trace hash the case produced, 0 without tracing
+    uint32_t flags;
+    uint64_t len; // payload length
+    uint64_t stored; // bytes stored, less than len when compressed
+    uint64_t exec_us; // time the target took to run the case, 0 if not measured
+    uint32_t name_len;
+    uint32_t pad;
+};
+
+// An archive opened for appending
+struct archive {
+    int fd;
+    int compress;
+    pthread_mutex_t lock; // one append at a time, so a failed one can be cut off the end
+};
+
+// One entry of a mapped archive, pointers are into the mapping
+struct archive_index {
+    const struct archive_entry * entry;
+    const char * name;
+    const char * data;
+};
+
+// A read-only mapping of an archive and the index built over it
+struct archive_map {
+    char * map;
+    size_t size;
+    struct archive_index * index;
+    unsigned long count;
+};
+
+int archive_is(char * path);
+int archive_open(struct archive * ar, char * path, int compress);
+int archive_add(struct archive * ar, char * name, char * data, unsigned long len, struct archive_entry * meta);
+void archive_close(struct archive * ar);
+int archive_map(struct archive_map * m, char * path);
+char * archive_data(struct archive_map * m, unsigned long i);
+void archive_release(struct archive_map * m, unsigned long i, char * data);
+char * archive_copy(struct archive_map * m, unsigned long i);
+void archive_unmap(struct archive_map * m);
+testcase_t * archive_load(char * path);
+int archive_export(char * path, char * dir);
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ * File:   bisect.c
+ * Author: DoI
+ *
+ * Post-crash triage. Each worker's crash ring (<dir>/<tid>.ring), or its
+ * spooled batch (<dir>/<tid>-<n>) without one, is replayed in order against a
+ * freshly restarted target, probing its health after every case, until the
+ * crash reproduces. If the last case on its own brings the
+ * target down it is written out as <dir>/crash-<tid>-<n>. Otherwise the crash
+ * needs state built up by the cases before it, and the shortest run of cases
+ * ending with it that still crashes is found by bisecting the start of the run
+ * and written to <dir>/crash-<tid>-<first>-<last>/. The ring or batch the
+ * reproducer came from is removed once it has been written; the other
+ * workers' are left for a look by hand.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "bisect.h"
+#include "fuzzotron.h"
+#include "generator.h"
+#include "health.h"
+#include "ring.h"
+#include "util.h"
+
+// Load the crash ring <dir>/<tid>.ring into an array, returns the number of cases
+static int load_ring(char * dir, int tid, testcase_t ** cases){
+    char path[PATH_MAX], * data;
+    struct stat s;
+    int n, fd;
+
+    snprintf(path, PATH_MAX, "%s/%d.ring", dir, tid);
+    if((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    if(fstat(fd, &s) < 0){
+        close(fd);
+        return 0;
+    }
+
+    ft_malloc(s.st_size, data);
+    if(read(fd, data, s.st_size) != s.st_size){
+        fatal("[!] Error: short read on %s\n", path);
+    }
+    close(fd);
+
+    if((n = ring_parse(data, s.st_size, cases, NULL)) < 0){
+        printf("[!] %s is not a crash ring\n", path);
+        n = 0;
+    }
+    free(data);
+
+    return n;
+}
+
+/*
+ * Load the cases a worker sent before the crash into an array, returns the number of cases. The
+ * crash ring goes further back than the batch, so it is used when there is one, otherwise
+ * <dir>/<tid>-1 .. <tid>-n. from_ring is set to say which it was.
+ */
+static int load_batch(char * dir, int tid, testcase_t ** cases, int * from_ring){
+    char path[PATH_MAX];
+    struct stat s;
+    int n = 0, size = 0, fd;
+
+    if((*from_ring = (n = load_ring(dir, tid, cases)) > 0))
+        return n;
+
+    *cases = NULL;
+    for(;;){
+        snprintf(path, PATH_MAX, "%s/%d-%d", dir, tid, n + 1);
+        if(stat(path, &s) < 0)
+            break;
+
+        if(n == size){
+            size = size ? size * 2 : 128;
+            if((*cases = realloc(*cases, size * sizeof(testcase_t))) == NULL){
+                fatal("[!] realloc failed\n");
+            }
+        }
+
+        testcase_t * tc = &(*cases)[n];
+        memset(tc, 0x00, sizeof(*tc));
+        tc->len = s.st_size;
+        ft_malloc(tc->len + 1, tc->data);
+
+        if((fd = open(path, O_RDONLY)) < 0){
+            fatal("[!] Error: Could not open file %s: %s\n", path, strerror(errno));
+        }
+        if(read(fd, tc->data, tc->len) != (ssize_t)tc->len){
+            fatal("[!] Error: short read on %s\n", path);
+        }
+        close(fd);
+        n++;
+    }
+
+    return n;
+}
+
+static void free_batch(testcase_t * cases, int n){
+    int i;
+    for(i = 0; i < n; i++)
+        free(cases[i].data);
+    free(cases);
+}
+
+/*
+ * Restart the target and replay cases[first..last]. Returns the 1-based index of the case after
+ * which the target stopped answering, 0 if it survived them all, or -1 if it could not be restarted.
+ */
+static int replay_run(testcase_t * cases, int first, int last, int (*restart)(void)){
+    int i;
+
+    if(restart() < 0)
+        return -1;
+
+    for(i = first; i <= last; i++){
+        if(cases[i - 1].len == 0)
+            continue;
+
+        // a refused send means the previous case took it down without the probe noticing yet
+        if(fuzz.send(fuzz.host, fuzz.port, &cases[i - 1]) < 0)
+            return i > first ? i - 1 : i;
+
+        usleep(BISECT_SETTLE_MS * 1000);
+        if(health_check() != 1)
+            return i;
+    }
+
+    return 0;
+}
+
+// Remove what load_batch() loaded, the ring or the n batch files
+static void remove_batch(char * dir, int tid, int from_ring, int n){
+    char path[PATH_MAX];
+    int i;
+
+    if(from_ring){
+        snprintf(path, PATH_MAX, "%s/%d.ring", dir, tid);
+        unlink(path);
+        return;
+    }
+
+    for(i = 1; i <= n; i++){
+        snprintf(path, PATH_MAX, "%s/%d-%d", dir, tid, i);
+        unlink(path);
+    }
+}
+
+/*
+ * Find the case or sequence behind the crash in the batches spooled by the given worker threads.
+ * restart must (re)start the target and only return 0 once it answers health checks. The target
+ * is left as the last replay left it, which may be down. Returns 0 if a reproducer was written,
+ * -1 otherwise.
+ */
+int bisect_crash(char * dir, int * tids, int count, int (*restart)(void)){
+    testcase_t * cases;
+    char name[PATH_MAX], seq_dir[PATH_MAX];
+    int t, n, k, lo, hi, mid, r, i, from_ring, found = -1;
+
+    printf("[+] Bisecting the crash\n");
+
+    for(t = 0; t < count && found < 0; t++){
+        n = load_batch(dir, tids[t], &cases, &from_ring);
+        if(n == 0)
+            continue;
+
+        printf("[.] Replaying %d cases from thread %d\n", n, tids[t]);
+        if((k = replay_run(cases, 1, n, restart)) <= 0){
+            free_batch(cases, n);
+            if(k < 0)
+                break;
+            continue;
+        }
+        printf("[.] Target went down after case %d-%d\n", tids[t], k);
+
+        // the common case, one testcase does it on its own
+        if((r = replay_run(cases, k, k, restart)) < 0){
+            free_batch(cases, n);
+            break;
+        }
+        if(r == k){
+            snprintf(name, PATH_MAX, "crash-%d-%d", tids[t], k);
+            save_case_p(cases[k - 1].data, cases[k - 1].len, name, dir);
+            printf("[!!] Case %d-%d crashes the target on its own, saved to %s/%s\n", tids[t], k, dir, name);
+            found = 0;
+        }
+        else{
+            // stateful, cases[lo..k] crashes and cases[hi..k] doesn't, narrow down the start
+            lo = 1;
+            hi = k;
+            while(hi - lo > 1){
+                mid = lo + (hi - lo) / 2;
+                if((r = replay_run(cases, mid, k, restart)) < 0)
+                    break;
+                if(r == k)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+
+            if(r >= 0){
+                snprintf(seq_dir, PATH_MAX, "%s/crash-%d-%d-%d", dir, tids[t], lo, k);
+                if(mkdir(seq_dir, 0755) < 0 && errno != EEXIST){
+                    fatal("[!] Could not mkdir %s: %s\n", seq_dir, strerror(errno));
+                }
+                for(i = lo; i <= k; i++){
+                    snprintf(name, PATH_MAX, "%d", i - lo + 1);
+                    save_case_p(cases[i - 1].data, cases[i - 1].len, name, seq_dir);
+                }
+                printf("[!!] Crash needs the %d case sequence %d-%d..%d, saved to %s\n", k - lo + 1, tids[t], lo, k, seq_dir);
+                found = 0;
+            }
+        }
+
+        free_batch(cases, n);
+        if(found == 0)
+            remove_batch(dir, tids[t], from_ring, n);
+    }
+
+    if(found < 0){
+        printf("[!] Could not reproduce the crash, the spooled cases are left in %s\n", dir);
+        return -1;
+    }
+
+    return 0;
+}
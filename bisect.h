@@ -0,0 +1,14 @@
+/*
+ * File:   bisect.h
+ * Author: DoI
+ */
+
+#ifndef BISECT_H
+#define BISECT_H
+
+#define BISECT_SETTLE_MS 100 // time a replayed case gets to take the target down before it is probed
+#define BISECT_BOOT_MS 30000 // give up waiting for a restarted target to come up after this long
+
+int bisect_crash(char * dir, int * tids, int count, int (*restart)(void));
+
+#endif
@@ -0,0 +1,615 @@
+/*
+ * File:   bpcov.c
+ * Author: DoI
+ *
+ * Breakpoint based coverage for targets that can't be built with AFL
+ * instrumentation. A tracer thread attaches to the running target with
+ * ptrace and places an int3 at the start of every function found in the
+ * ELF symbol table, or at every address listed in a block file. When a
+ * breakpoint is hit it is recorded in a trace_bits map laid out the same way
+ * as the AFL shared memory map, and removed. Breakpoints are one-shot, so the
+ * overhead drops towards zero as coverage saturates.
+ *
+ * One-shot breakpoints only ever fire once, which means a case can't be
+ * re-run to calibrate or trim it - the fuzzer skips both steps in this mode.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+#include "bpcov.h"
+#include "hash.h"
+#include "trace.h"
+#include "util.h"
+
+#ifndef __x86_64__
+#error "bpcov.c only supports x86_64 targets"
+#endif
+
+struct breakpoint {
+    uint64_t addr;
+    uint8_t orig; // original byte the int3 replaced
+    uint8_t armed; // still armed in the main target process
+};
+
+struct task {
+    pid_t tid;
+    pid_t tgid; // forked children get their own address space, and their own copy of the breakpoints
+};
+
+static struct {
+    pid_t pid;
+    struct breakpoint * bps;
+    size_t count;
+    struct task * tasks;
+    int ntasks;
+    int tasks_size;
+    uint8_t * trace_bits;
+    volatile unsigned long hits;
+    volatile int quit;
+    volatile int ready; // 1 once breakpoints are armed, -1 on failure
+    pthread_t thread;
+} bp;
+
+static int cmp_bp(const void * a, const void * b){
+    uint64_t x = ((const struct breakpoint *)a)->addr, y = ((const struct breakpoint *)b)->addr;
+    return (x > y) - (x < y);
+}
+
+static void add_bp(uint64_t addr){
+    static size_t size = 0;
+
+    if(bp.count == size){
+        size = size ? size * 2 : 4096;
+        bp.bps = realloc(bp.bps, size * sizeof(struct breakpoint));
+        if(bp.bps == NULL){
+            fatal("[!] realloc failed\n");
+        }
+    }
+
+    bp.bps[bp.count].addr = addr;
+    bp.bps[bp.count].orig = 0;
+    bp.bps[bp.count].armed = 0;
+    bp.count++;
+}
+
+static struct breakpoint * find_bp(uint64_t addr){
+    struct breakpoint key = { addr, 0, 0 };
+    return bsearch(&key, bp.bps, bp.count, sizeof(struct breakpoint), cmp_bp);
+}
+
+static void add_task(pid_t tid, pid_t tgid){
+    if(bp.ntasks == bp.tasks_size){
+        bp.tasks_size = bp.tasks_size ? bp.tasks_size * 2 : 64;
+        bp.tasks = realloc(bp.tasks, bp.tasks_size * sizeof(struct task));
+        if(bp.tasks == NULL){
+            fatal("[!] realloc failed\n");
+        }
+    }
+
+    bp.tasks[bp.ntasks].tid = tid;
+    bp.tasks[bp.ntasks].tgid = tgid;
+    bp.ntasks++;
+}
+
+static struct task * find_task(pid_t tid){
+    int i;
+
+    for(i = 0; i < bp.ntasks; i++){
+        if(bp.tasks[i].tid == tid)
+            return &bp.tasks[i];
+    }
+
+    return NULL;
+}
+
+static void remove_task(pid_t tid){
+    struct task * t = find_task(tid);
+
+    if(t)
+        *t = bp.tasks[--bp.ntasks];
+}
+
+/*
+ * Work out where the target binary has been loaded. Returns the value to add to ELF virtual
+ * addresses to get runtime addresses, which is 0 for non-PIE executables.
+ */
+static uint64_t load_bias(pid_t pid, char * exe, Elf64_Ehdr * ehdr){
+    Elf64_Phdr * phdr = (Elf64_Phdr *)((char *)ehdr + ehdr->e_phoff);
+    uint64_t first_vaddr = UINT64_MAX, start, lowest = UINT64_MAX;
+    char path[PATH_MAX], line[PATH_MAX + 128], file[PATH_MAX];
+    FILE * fp;
+    int i;
+
+    if(ehdr->e_type != ET_DYN)
+        return 0;
+
+    for(i = 0; i < ehdr->e_phnum; i++){
+        if(phdr[i].p_type == PT_LOAD && phdr[i].p_vaddr < first_vaddr)
+            first_vaddr = phdr[i].p_vaddr;
+    }
+
+    snprintf(path, PATH_MAX, "/proc/%d/maps", pid);
+    if((fp = fopen(path, "r")) == NULL){
+        fatal("[!] Could not open %s: %s\n", path, strerror(errno));
+    }
+
+    while(fgets(line, sizeof(line), fp)){
+        file[0] = 0;
+        if(sscanf(line, "%lx-%*x %*s %*x %*s %*d %4095s", &start, file) == 2 && strcmp(file, exe) == 0 && start < lowest)
+            lowest = start;
+    }
+    fclose(fp);
+
+    if(lowest == UINT64_MAX){
+        fatal("[!] Could not find %s in the memory map of %d\n", exe, pid);
+    }
+
+    return lowest - (first_vaddr & ~0xfffUL);
+}
+
+// Collect function entry points from .symtab, falling back to .dynsym for stripped binaries
+static void load_symbols(Elf64_Ehdr * ehdr, size_t size, uint64_t bias){
+    Elf64_Shdr * shdr = (Elf64_Shdr *)((char *)ehdr + ehdr->e_shoff);
+    int i, table = -1;
+    uint64_t j, nsyms;
+
+    if(ehdr->e_shoff == 0 || ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) > size)
+        return;
+
+    for(i = 0; i < ehdr->e_shnum; i++){
+        if(shdr[i].sh_type == SHT_SYMTAB)
+            table = i;
+        else if(shdr[i].sh_type == SHT_DYNSYM && table < 0)
+            table = i;
+    }
+
+    if(table < 0 || shdr[table].sh_offset + shdr[table].sh_size > size)
+        return;
+
+    Elf64_Sym * syms = (Elf64_Sym *)((char *)ehdr + shdr[table].sh_offset);
+    nsyms = shdr[table].sh_size / sizeof(Elf64_Sym);
+
+    for(j = 0; j < nsyms; j++){
+        if(ELF64_ST_TYPE(syms[j].st_info) == STT_FUNC && syms[j].st_shndx != SHN_UNDEF && syms[j].st_value)
+            add_bp(syms[j].st_value + bias);
+    }
+}
+
+// Read block start addresses, one hex ELF virtual address per line
+static void load_block_file(char * block_file, uint64_t bias){
+    char line[128];
+    FILE * fp;
+
+    if((fp = fopen(block_file, "r")) == NULL){
+        fatal("[!] Could not open block file %s: %s\n", block_file, strerror(errno));
+    }
+
+    while(fgets(line, sizeof(line), fp)){
+        char * end;
+        uint64_t addr = strtoull(line, &end, 16);
+        if(end != line && addr)
+            add_bp(addr + bias);
+    }
+    fclose(fp);
+}
+
+static void record_hit(uint64_t addr){
+    // spread block addresses over the map, block ids stand in for AFL's edge ids
+    uint32_t idx = (uint32_t)((addr * 0x9E3779B97F4A7C15ULL) >> (64 - MAP_SIZE_POW2));
+    bp.trace_bits[idx]++;
+    bp.hits++;
+}
+
+/*
+ * Handle a SIGTRAP stop. If it was one of our breakpoints, record the hit, put the original
+ * byte back in that task's address space and rewind the instruction pointer. Returns 1 if the
+ * trap was ours, 0 if the signal belongs to the target.
+ *
+ * Two threads of the target can hit the same int3 before the first stop is handled. The second
+ * then finds the byte already restored, and only needs rewinding to run the real instruction.
+ */
+static int handle_trap(pid_t tid){
+    struct user_regs_struct regs;
+    struct breakpoint * b;
+    struct task * t;
+    siginfo_t info;
+    long word;
+
+    // an int3 is reported as SI_KERNEL, anything else is a SIGTRAP sent to the target
+    if(ptrace(PTRACE_GETSIGINFO, tid, NULL, &info) < 0 || info.si_code != SI_KERNEL)
+        return 0;
+
+    if(ptrace(PTRACE_GETREGS, tid, NULL, &regs) < 0)
+        return 0;
+
+    if((b = find_bp(regs.rip - 1)) == NULL || b->orig == 0xcc)
+        return 0;
+
+    errno = 0;
+    word = ptrace(PTRACE_PEEKTEXT, tid, (void *)b->addr, NULL);
+    if(errno)
+        return 0;
+
+    if((word & 0xff) == 0xcc){
+        word = (word & ~0xffL) | b->orig;
+        ptrace(PTRACE_POKETEXT, tid, (void *)b->addr, (void *)word);
+
+        t = find_task(tid);
+        if(t == NULL || t->tgid == bp.pid)
+            b->armed = 0;
+        record_hit(b->addr);
+    }
+
+    regs.rip = b->addr;
+    ptrace(PTRACE_SETREGS, tid, NULL, &regs);
+
+    return 1;
+}
+
+// Remove any remaining breakpoints from the address space tid belongs to
+static void disarm_all(pid_t tid){
+    size_t i;
+    long word;
+
+    for(i = 0; i < bp.count; i++){
+        if(bp.bps[i].orig == 0xcc)
+            continue;
+
+        errno = 0;
+        word = ptrace(PTRACE_PEEKTEXT, tid, (void *)bp.bps[i].addr, NULL);
+        if(errno || (word & 0xff) != 0xcc)
+            continue;
+
+        word = (word & ~0xffL) | bp.bps[i].orig;
+        ptrace(PTRACE_POKETEXT, tid, (void *)bp.bps[i].addr, (void *)word);
+    }
+}
+
+static void wakeup(int sig __attribute__((unused))){
+    // only here so waitpid() in the tracer returns EINTR
+}
+
+// Stop every traced task, clean the breakpoints out of every address space and detach
+static void detach_all(){
+    int i, j, status;
+
+    for(i = 0; i < bp.ntasks; i++)
+        ptrace(PTRACE_INTERRUPT, bp.tasks[i].tid, NULL, NULL);
+
+    for(i = 0; i < bp.ntasks; i++){
+        if(waitpid(bp.tasks[i].tid, &status, __WALL) < 0)
+            continue;
+        if(WIFSTOPPED(status) && WSTOPSIG(status) == SIGTRAP && (status >> 16) == 0)
+            handle_trap(bp.tasks[i].tid);
+    }
+
+    for(i = 0; i < bp.ntasks; i++){
+        for(j = 0; j < i; j++){
+            if(bp.tasks[j].tgid == bp.tasks[i].tgid)
+                break;
+        }
+        if(j == i) // first task seen for this address space
+            disarm_all(bp.tasks[i].tid);
+    }
+
+    for(i = 0; i < bp.ntasks; i++)
+        ptrace(PTRACE_DETACH, bp.tasks[i].tid, NULL, NULL);
+}
+
+static int attach_all(){
+    char path[PATH_MAX];
+    struct dirent * ents;
+    DIR * dir;
+    int i, status;
+    long opts = PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK;
+
+    snprintf(path, PATH_MAX, "/proc/%d/task", bp.pid);
+    if((dir = opendir(path)) == NULL){
+        printf("[!] Could not open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while((ents = readdir(dir)) != NULL){
+        pid_t tid = atoi(ents->d_name);
+        if(tid <= 0)
+            continue;
+
+        if(ptrace(PTRACE_SEIZE, tid, NULL, (void *)opts) < 0){
+            printf("[!] ptrace attach to %d failed: %s\n", tid, strerror(errno));
+            closedir(dir);
+            return -1;
+        }
+        add_task(tid, bp.pid);
+    }
+    closedir(dir);
+
+    // everything has to be stopped while the breakpoints go in
+    for(i = 0; i < bp.ntasks; i++){
+        ptrace(PTRACE_INTERRUPT, bp.tasks[i].tid, NULL, NULL);
+        waitpid(bp.tasks[i].tid, &status, __WALL);
+    }
+
+    return 0;
+}
+
+static void arm_all(){
+    size_t i, armed = 0;
+    long word;
+
+    for(i = 0; i < bp.count; i++){
+        errno = 0;
+        word = ptrace(PTRACE_PEEKTEXT, bp.pid, (void *)bp.bps[i].addr, NULL);
+        if(errno)
+            continue;
+
+        bp.bps[i].orig = word & 0xff;
+        if(bp.bps[i].orig == 0xcc)
+            continue;
+
+        word = (word & ~0xffL) | 0xcc;
+        if(ptrace(PTRACE_POKETEXT, bp.pid, (void *)bp.bps[i].addr, (void *)word) == 0){
+            bp.bps[i].armed = 1;
+            armed++;
+        }
+    }
+
+    printf("[+] Armed %lu of %lu breakpoints in %d\n", armed, bp.count, bp.pid);
+}
+
+/*
+ * Tracer thread. ptrace requests have to come from the thread that attached, so everything
+ * that touches the target lives here. Its waits are __WNOTHREAD, limited to its own tracees, so
+ * it never reaps the children other threads fork (radamsa, the -z script, restart commands).
+ */
+static void * tracer(void * arg __attribute__((unused))){
+    struct sigaction sa;
+    int i, status, sig;
+    unsigned long msg;
+    pid_t tid;
+
+    memset(&sa, 0x00, sizeof(sa));
+    sa.sa_handler = wakeup; // no SA_RESTART, waitpid() has to be interruptible
+    sigaction(SIGUSR2, &sa, NULL);
+
+    if(attach_all() < 0){
+        bp.ready = -1;
+        return NULL;
+    }
+
+    arm_all();
+    for(i = 0; i < bp.ntasks; i++)
+        ptrace(PTRACE_CONT, bp.tasks[i].tid, NULL, NULL);
+    bp.ready = 1;
+
+    while(!bp.quit){
+        tid = waitpid(-1, &status, __WALL | __WNOTHREAD);
+        if(tid < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == ECHILD)
+                break;
+            continue;
+        }
+
+        if(find_task(tid) == NULL && !WIFSTOPPED(status))
+            continue; // not ours
+
+        if(WIFEXITED(status) || WIFSIGNALED(status)){
+            remove_task(tid);
+            continue;
+        }
+
+        if(!WIFSTOPPED(status))
+            continue;
+
+        if(find_task(tid) == NULL) // auto-attached child reporting in before its parent's event
+            add_task(tid, tid);
+
+        sig = WSTOPSIG(status);
+        switch(status >> 16){
+            case PTRACE_EVENT_CLONE:
+            case PTRACE_EVENT_FORK:
+            case PTRACE_EVENT_VFORK:
+                if(ptrace(PTRACE_GETEVENTMSG, tid, NULL, &msg) == 0){
+                    struct task * parent = find_task(tid);
+                    struct task * child = find_task((pid_t)msg);
+                    pid_t tgid = (status >> 16) == PTRACE_EVENT_CLONE ? parent->tgid : (pid_t)msg;
+
+                    if(child)
+                        child->tgid = tgid;
+                    else
+                        add_task((pid_t)msg, tgid);
+                }
+                sig = 0;
+                break;
+
+            case PTRACE_EVENT_STOP:
+                sig = 0; // group-stop or the initial stop of a new task
+                break;
+
+            default:
+                if(sig == SIGTRAP && handle_trap(tid))
+                    sig = 0;
+                break;
+        }
+
+        ptrace(PTRACE_CONT, tid, NULL, (void *)(long)sig);
+    }
+
+    if(bp.ntasks)
+        detach_all();
+
+    return NULL;
+}
+
+/*
+ * Attach to pid and arm breakpoints on the function entry points of its executable, or on
+ * the addresses in block_file if one is given. Returns the trace map hits are recorded in.
+ */
+uint8_t * bpcov_start(pid_t pid, char * block_file){
+    char path[PATH_MAX], exe[PATH_MAX];
+    struct stat s;
+    ssize_t len;
+    int fd;
+
+    memset(&bp, 0x00, sizeof(bp));
+    bp.pid = pid;
+
+    snprintf(path, PATH_MAX, "/proc/%d/exe", pid);
+    if((len = readlink(path, exe, PATH_MAX - 1)) < 0){
+        fatal("[!] Could not resolve %s: %s\n", path, strerror(errno));
+    }
+    exe[len] = 0;
+
+    if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &s) < 0){
+        fatal("[!] Could not open %s: %s\n", exe, strerror(errno));
+    }
+
+    Elf64_Ehdr * ehdr = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ehdr == MAP_FAILED){
+        fatal("[!] Could not mmap %s: %s\n", exe, strerror(errno));
+    }
+
+    if(s.st_size < (off_t)sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+            ehdr->e_ident[EI_CLASS] != ELFCLASS64){
+        fatal("[!] %s is not a 64-bit ELF binary\n", exe);
+    }
+
+    uint64_t bias = load_bias(pid, exe, ehdr);
+    if(block_file)
+        load_block_file(block_file, bias);
+    else
+        load_symbols(ehdr, s.st_size, bias);
+    munmap(ehdr, s.st_size);
+
+    if(bp.count == 0){
+        fatal("[!] No breakpoint addresses found for %s, try a block file\n", exe);
+    }
+
+    // drop duplicates, find_bp() relies on the list being sorted
+    size_t i, j;
+    qsort(bp.bps, bp.count, sizeof(struct breakpoint), cmp_bp);
+    for(i = 1, j = 1; i < bp.count; i++){
+        if(bp.bps[i].addr != bp.bps[j - 1].addr)
+            bp.bps[j++] = bp.bps[i];
+    }
+    bp.count = j;
+
+    ft_malloc(MAP_SIZE, bp.trace_bits);
+    memset(bp.trace_bits, 0x00, MAP_SIZE);
+
+    printf("[+] Breakpoint coverage on %s (pid %d), load bias 0x%lx\n", exe, pid, bias);
+    if(pthread_create(&bp.thread, NULL, tracer, NULL) > 0){
+        fatal("Creating pthread failed: %s\n", strerror(errno));
+    }
+
+    while(bp.ready == 0)
+        usleep(1000);
+
+    if(bp.ready < 0){
+        fatal("[!] Could not attach to %d, check /proc/sys/kernel/yama/ptrace_scope\n", pid);
+    }
+
+    return bp.trace_bits;
+}
+
+// true if no thread of the target is running or waiting on the tracer
+static int target_idle(){
+    char path[PATH_MAX], buf[512], * p;
+    struct dirent * ents;
+    DIR * dir;
+    int fd, idle = 1;
+    ssize_t r;
+
+    snprintf(path, PATH_MAX, "/proc/%d/task", bp.pid);
+    if((dir = opendir(path)) == NULL)
+        return 1; // target is gone, nothing more will be hit
+
+    while(idle && (ents = readdir(dir)) != NULL){
+        if(ents->d_name[0] == '.')
+            continue;
+
+        snprintf(path, PATH_MAX, "/proc/%d/task/%s/stat", bp.pid, ents->d_name);
+        if((fd = open(path, O_RDONLY)) < 0)
+            continue;
+        r = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if(r <= 0)
+            continue;
+        buf[r] = 0;
+
+        // state follows the ')' closing the command name
+        if((p = strrchr(buf, ')')) != NULL && p[1] && (p[2] == 'R' || p[2] == 't'))
+            idle = 0;
+    }
+    closedir(dir);
+
+    return idle;
+}
+
+static long now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Stand-in for wait_for_bitmap(). With one-shot breakpoints most cases hit nothing, so rather
+ * than waiting for a hash that never shows up, wait for the target to go idle with no new hits
+ * for BP_SETTLE_MS. Returns the bitmap hash, NULL_HASH if nothing was hit and 0 on timeout.
+ */
+uint32_t bpcov_wait(const void * trace_bits){
+    long start = now_ms(), last_change = start, now;
+    unsigned long hits = bp.hits;
+
+    while(1){
+        usleep(1000);
+        now = now_ms();
+
+        if(bp.hits != hits){
+            hits = bp.hits;
+            last_change = now;
+        }
+        else if(now - last_change >= BP_SETTLE_MS && target_idle()){
+            break;
+        }
+
+        if(now - start > BP_WAIT_MS)
+            return 0;
+    }
+
+    return hash32(trace_bits, MAP_SIZE, HASH_CONST);
+}
+
+// Take the breakpoints back out and detach, otherwise the target dies on the next int3
+void bpcov_stop(){
+    if(bp.ready != 1)
+        return;
+
+    // keep poking the tracer until it notices, the first signal may land outside waitpid()
+    bp.quit = 1;
+    do{
+        pthread_kill(bp.thread, SIGUSR2);
+        usleep(10000);
+    } while(pthread_tryjoin_np(bp.thread, NULL) == EBUSY);
+    bp.ready = 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * File:   bpcov.h
+ * Author: DoI
+ */
+
+#ifndef BPCOV_H
+#define BPCOV_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define BP_SETTLE_MS 5 // target must be idle with no new hits for this long before the bitmap is read
+#define BP_WAIT_MS 2000 // give up waiting for the target to go idle after this long
+
+uint8_t * bpcov_start(pid_t pid, char * block_file);
+uint32_t bpcov_wait(const void * trace_bits);
+void bpcov_stop();
+
+#endif
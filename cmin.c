@@ -0,0 +1,426 @@
+/*
+ * File:   cmin.c
+ * Author: DoI
+ *
+ * fuzzotron-cmin - corpus distillation. Every file in the input directory is
+ * replayed through the regular senders against one or more traced target
+ * instances, and the smallest subset of files that still covers every tuple
+ * seen is copied to the output directory. Modelled on afl-cmin. Either side
+ * can be a corpus archive (see archive.c), an output path ending in .fza is
+ * written as one.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <linux/limits.h>
+
+#include <openssl/ssl.h>
+
+#include "util.h"
+#include "archive.h"
+#include "sender.h"
+#include "fuzzotron.h"
+#include "generator.h"
+#include "state.h"
+#include "trace.h"
+
+#define MAX_INSTANCES 64
+#define TUPLE_COUNT (MAP_SIZE << 3) // each map byte is split into 8 hit-count buckets
+
+struct fuzzer_args fuzz;
+
+// A corpus entry and the tuples it covers
+struct cmin_entry {
+    char * name;
+    testcase_t testcase;
+    struct archive_entry meta; // hashes, parent and exec time, kept when written to an archive
+    uint32_t * tuples;
+    uint32_t tuple_count;
+};
+
+// A traced target instance, each one is driven by its own thread
+struct cmin_instance {
+    char * host;
+    int port;
+    int32_t shm_id;
+    uint8_t * trace_bits;
+    unsigned long done;
+};
+
+static struct cmin_entry * entries = NULL;
+static unsigned long entry_count = 0;
+static unsigned long next_entry = 0;
+
+// AFL's hit-count classes
+static inline uint8_t count_class(uint8_t count){
+    if(count <= 3) return count - 1;
+    if(count <= 7) return 3;
+    if(count <= 15) return 4;
+    if(count <= 31) return 5;
+    if(count <= 127) return 6;
+    return 7;
+}
+
+void help(){
+    // Print the help and exit
+    printf("fuzzotron-cmin - Reduce a corpus to the smallest set of files covering the same tuples\n\n");
+    printf("Usage: ./fuzzotron-cmin -i corpus/ -o distilled/ -h 127.0.0.1 -p 8080,8081 -P tcp --trace 118718481,118718482\n\n");
+    printf("\t-i\t\tInput corpus directory or archive REQUIRED\n");
+    printf("\t-o\t\tOutput directory for the distilled corpus, or archive if it ends in %s REQUIRED\n", ARCHIVE_EXT);
+    printf("\t-h\t\tIP of host to connect to or path to unix domain socket. Comma separated, one per instance\n");
+    printf("\t-p\t\tPort to connect to. Comma separated, one per instance\n");
+    printf("\t-P\t\tProtocol to use (tcp,udp,unix)\n");
+    printf("\t--trace\t\tShared memory ids of the target instances, comma separated REQUIRED\n");
+    printf("\t--ssl\t\tUse SSL for the connection\n");
+    printf("\t--destroy\tUse TCP_REPAIR mode to immediately destroy the connection, do not send FIN/RST.\n");
+    printf("\t--compress\tCompress the cases of an output archive\n");
+    exit(0);
+}
+
+// split a comma separated list in place, returns the number of items
+static int split_list(char * list, char ** items, int max){
+    int n = 0;
+    char * save = NULL, * tok;
+
+    for(tok = strtok_r(list, ",", &save); tok && n < max; tok = strtok_r(NULL, ",", &save))
+        items[n++] = tok;
+
+    return n;
+}
+
+// Make room for one more entry
+static struct cmin_entry * new_entry(){
+    static unsigned long size = 0;
+
+    if(entry_count == size){
+        size = size ? size * 2 : 1024;
+        entries = realloc(entries, size * sizeof(struct cmin_entry));
+        if(entries == NULL){
+            fatal("[!] realloc failed\n");
+        }
+    }
+
+    memset(&entries[entry_count], 0x00, sizeof(struct cmin_entry));
+    return &entries[entry_count];
+}
+
+static void load_archive(char * path){
+    struct archive_map m;
+    char name[NAME_MAX + 1];
+    unsigned long i;
+
+    if(archive_map(&m, path) < 0){
+        fatal("[!] Error: %s is not an archive\n", path);
+    }
+
+    for(i = 0; i < m.count; i++){
+        const struct archive_entry * ae = m.index[i].entry;
+        struct cmin_entry * e;
+        char * data;
+
+        if(ae->len == 0 || (data = archive_copy(&m, i)) == NULL)
+            continue;
+
+        e = new_entry();
+        if(ae->name_len > 0)
+            snprintf(name, sizeof(name), "%.*s", (int)MIN(ae->name_len, NAME_MAX), m.index[i].name);
+        else
+            snprintf(name, sizeof(name), "%u", ae->exec_hash ? ae->exec_hash : ae->hash);
+        e->name = strdup(name);
+        e->testcase.len = ae->len;
+        e->testcase.data = data;
+        e->meta = *ae;
+
+        entry_count++;
+    }
+    archive_unmap(&m);
+}
+
+static void load_corpus(char * path){
+    DIR * dir;
+    struct dirent * ents;
+
+    if(archive_is(path)){
+        load_archive(path);
+        return;
+    }
+
+    if((dir = opendir(path)) == NULL){
+        fatal("[!] Error: Could not open directory %s: %s\n", path, strerror(errno));
+    }
+
+    while((ents = readdir(dir)) != NULL){
+        char file_path[PATH_MAX];
+        struct stat s;
+        int fd;
+
+        snprintf(file_path, PATH_MAX, "%s/%s", path, ents->d_name);
+        if(stat(file_path, &s) < 0 || !S_ISREG(s.st_mode) || s.st_size == 0)
+            continue;
+
+        struct cmin_entry * e = new_entry();
+        e->name = strdup(ents->d_name);
+        e->testcase.len = s.st_size;
+        ft_malloc(e->testcase.len, e->testcase.data);
+
+        if((fd = open(file_path, O_RDONLY)) < 0){
+            fatal("[!] Error: Could not open file %s: %s\n", file_path, strerror(errno));
+        }
+        if(read(fd, e->testcase.data, e->testcase.len) != (ssize_t)e->testcase.len){
+            fatal("[!] Error: short read on %s\n", file_path);
+        }
+        close(fd);
+        e->meta.hash = case_hash(e->testcase.data, e->testcase.len);
+
+        entry_count++;
+    }
+    closedir(dir);
+}
+
+// Replay corpus entries against one target instance until the corpus is exhausted
+static void * cmin_worker(void * arg){
+    struct cmin_instance * inst = arg;
+    struct timespec start, end;
+    unsigned long idx;
+    uint32_t hash, i, n;
+
+    while((idx = __sync_fetch_and_add(&next_entry, 1)) < entry_count){
+        struct cmin_entry * e = &entries[idx];
+
+        memset(inst->trace_bits, 0x00, MAP_SIZE);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(fuzz.send(inst->host, inst->port, &e->testcase) < 0){
+            fatal("[!] Failed to send %s to %s:%d, is the target still up?\n", e->name, inst->host, inst->port);
+        }
+
+        hash = wait_for_bitmap(inst->trace_bits);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if(hash == 0 || hash == NULL_HASH){
+            printf("[!] %s produced no stable trace, skipping\n", e->name);
+            inst->done++;
+            continue;
+        }
+
+        e->meta.exec_hash = hash;
+        e->meta.exec_us = (end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000;
+
+        for(i = 0, n = 0; i < MAP_SIZE; i++)
+            if(inst->trace_bits[i]) n++;
+
+        ft_malloc(n * sizeof(uint32_t), e->tuples);
+        for(i = 0; i < MAP_SIZE; i++){
+            if(inst->trace_bits[i])
+                e->tuples[e->tuple_count++] = (i << 3) | count_class(inst->trace_bits[i]);
+        }
+
+        inst->done++;
+    }
+
+    return NULL;
+}
+
+static uint32_t * tuple_freq;
+
+static int cmp_tuple_freq(const void * a, const void * b){
+    uint32_t fa = tuple_freq[*(const uint32_t *)a], fb = tuple_freq[*(const uint32_t *)b];
+    return (fa > fb) - (fa < fb);
+}
+
+int main(int argc, char ** argv){
+    int c, i, instances = 0;
+    char * in_dir = NULL, * out_dir = NULL, * hosts = NULL, * ports = NULL, * shms = NULL;
+    char * host_list[MAX_INSTANCES], * port_list[MAX_INSTANCES], * shm_list[MAX_INSTANCES];
+    int host_count = 0, port_count = 0;
+    struct cmin_instance inst[MAX_INSTANCES];
+    pthread_t threads[MAX_INSTANCES];
+    unsigned long e, done, kept = 0;
+    static int compress = 0;
+    struct archive out;
+    size_t out_len;
+
+    memset(&fuzz, 0x00, sizeof(fuzz));
+
+    static struct option arg_options[] = {
+        {"alpn", required_argument, 0, 'l'},
+        {"ssl", no_argument, &fuzz.is_tls, 1},
+        {"protocol",  required_argument, 0, 'P'},
+        {"destroy", no_argument, &fuzz.destroy, 1},
+        {"trace", required_argument, 0, 's'},
+        {"compress", no_argument, &compress, 1},
+        {0, 0, 0, 0}
+    };
+
+    int arg_index;
+    while((c = getopt_long(argc, argv, "h:i:l:o:p:P:s:", arg_options, &arg_index)) != -1){
+        switch(c){
+            case 'h':
+                hosts = optarg;
+                break;
+
+            case 'i':
+                in_dir = optarg;
+                break;
+
+            case 'l':
+                fuzz.alpn = optarg;
+                break;
+
+            case 'o':
+                out_dir = optarg;
+                break;
+
+            case 'p':
+                ports = optarg;
+                break;
+
+            case 'P':
+                if(strcmp(optarg,"tcp") == 0){
+                    fuzz.protocol = 1;
+                    fuzz.send = send_tcp;
+                }
+                else if(strcmp(optarg,"udp") == 0){
+                    fuzz.protocol = 2;
+                    fuzz.send = send_udp;
+                }
+                else if(strcmp(optarg,"unix") == 0){
+                    fuzz.protocol = 3;
+                    fuzz.send = send_unix;
+                }
+                else{
+                    fatal("Please specify either 'tcp', 'udp' or 'unix' for -P\n");
+                }
+                break;
+
+            case 's':
+                shms = optarg;
+                break;
+        }
+    }
+
+    if(in_dir == NULL || out_dir == NULL || hosts == NULL || shms == NULL || fuzz.protocol == 0 ||
+            (ports == NULL && fuzz.protocol != 3)){
+        help();
+    }
+
+    // one instance per shm id, hosts and ports are either one per instance or a single shared value
+    instances = split_list(shms, shm_list, MAX_INSTANCES);
+    host_count = split_list(hosts, host_list, MAX_INSTANCES);
+    if(ports)
+        port_count = split_list(ports, port_list, MAX_INSTANCES);
+
+    if((host_count != 1 && host_count != instances) || (port_count > 1 && port_count != instances)){
+        fatal("[!] -h and -p must list either one value or one value per --trace id\n");
+    }
+
+    out_len = strlen(out_dir);
+    out.fd = -1;
+    if(out_len > strlen(ARCHIVE_EXT) && strcmp(out_dir + out_len - strlen(ARCHIVE_EXT), ARCHIVE_EXT) == 0){
+        if(archive_open(&out, out_dir, compress) < 0){
+            fatal("[!] Could not open %s for writing\n", out_dir);
+        }
+    }
+    else if(mkdir(out_dir, 0755) < 0 && errno != EEXIST){
+        fatal("[!] Could not mkdir %s: %s\n", out_dir, strerror(errno));
+    }
+
+    if(fuzz.is_tls){
+        SSL_library_init();
+        OpenSSL_add_all_algorithms();
+        SSL_load_error_strings();
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    load_corpus(in_dir);
+    if(entry_count == 0){
+        fatal("[!] No files found in %s\n", in_dir);
+    }
+    printf("[+] Loaded %lu files from %s, tracing with %d instance(s)\n", entry_count, in_dir, instances);
+
+    for(i = 0; i < instances; i++){
+        memset(&inst[i], 0x00, sizeof(inst[i]));
+        inst[i].host = host_list[host_count == 1 ? 0 : i];
+        inst[i].port = port_count ? atoi(port_list[port_count == 1 ? 0 : i]) : 0;
+        inst[i].shm_id = atoi(shm_list[i]);
+        inst[i].trace_bits = setup_shm(inst[i].shm_id);
+
+        if(pthread_create(&threads[i], NULL, cmin_worker, &inst[i]) > 0)
+            fatal("Creating pthread failed: %s\n", strerror(errno));
+    }
+
+    do{
+        usleep(200000);
+        for(i = 0, done = 0; i < instances; i++)
+            done += inst[i].done;
+        printf("[.] Traced %lu/%lu\r", done, entry_count);
+        fflush(stdout);
+    } while(done < entry_count);
+    printf("\n");
+
+    for(i = 0; i < instances; i++)
+        pthread_join(threads[i], NULL);
+
+    // for every tuple, find the smallest file that covers it
+    uint32_t * best, * order, t, tuples_seen = 0;
+    uint8_t * covered;
+
+    ft_malloc(TUPLE_COUNT * sizeof(uint32_t), best);
+    ft_malloc(TUPLE_COUNT * sizeof(uint32_t), tuple_freq);
+    ft_malloc(TUPLE_COUNT * sizeof(uint32_t), order);
+    ft_malloc(TUPLE_COUNT, covered);
+    memset(best, 0xff, TUPLE_COUNT * sizeof(uint32_t));
+    memset(tuple_freq, 0x00, TUPLE_COUNT * sizeof(uint32_t));
+    memset(covered, 0x00, TUPLE_COUNT);
+
+    for(e = 0; e < entry_count; e++){
+        for(t = 0; t < entries[e].tuple_count; t++){
+            uint32_t tuple = entries[e].tuples[t];
+            if(tuple_freq[tuple]++ == 0)
+                order[tuples_seen++] = tuple;
+            if(best[tuple] == 0xffffffff || entries[e].testcase.len < entries[best[tuple]].testcase.len)
+                best[tuple] = e;
+        }
+    }
+
+    // walk the tuples rarest first, keeping the best file for any tuple not yet covered
+    qsort(order, tuples_seen, sizeof(uint32_t), cmp_tuple_freq);
+    for(t = 0; t < tuples_seen; t++){
+        struct cmin_entry * keep;
+        uint32_t k;
+
+        if(covered[order[t]])
+            continue;
+
+        keep = &entries[best[order[t]]];
+        for(k = 0; k < keep->tuple_count; k++)
+            covered[keep->tuples[k]] = 1;
+
+        if(out.fd >= 0)
+            archive_add(&out, keep->name, keep->testcase.data, keep->testcase.len, &keep->meta);
+        else
+            save_case_p(keep->testcase.data, keep->testcase.len, keep->name, out_dir);
+        kept++;
+    }
+
+    printf("[.] Done. %u tuples covered by %lu of %lu files, written to %s\n", tuples_seen, kept, entry_count, out_dir);
+
+    archive_close(&out);
+    free(best); free(tuple_freq); free(order); free(covered);
+    for(e = 0; e < entry_count; e++){
+        free(entries[e].name);
+        free(entries[e].testcase.data);
+        free(entries[e].tuples);
+    }
+    free(entries);
+
+    return 0;
+}
@@ -0,0 +1,707 @@
+/*
+ * File:   coord.c
+ * Author: DoI
+ *
+ * Distributed fuzzing. One fuzzotron started with --coordinator listens for
+ * worker fuzzotrons (--worker host:port) on other machines, or the same one,
+ * and:
+ *  - hands out the seeds given to it with -d in units of COORD_UNIT for the
+ *    deterministic stages, handing a unit out again if its worker goes away
+ *  - collects the new paths workers find into <out>/corpus, and passes them
+ *    on to the other workers when they next pull
+ *  - ANDs the workers' virgin bitmaps into one, for the coverage of the whole
+ *    farm, written to <out>/coverage.bitmap on exit
+ *  - collects crashes into <out>/<worker>-crash-<n>/
+ *
+ * Messages are a struct coord_hdr followed by the payload, see coord.h. The
+ * worker side is synchronous: a request and its answer are exchanged under
+ * coord_lock, and if the coordinator goes away the worker carries on alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/limits.h>
+
+#include "fuzzotron.h"
+#include "coord.h"
+#include "corpus.h"
+#include "util.h"
+
+static int write_all(int fd, const void * buf, size_t len){
+    const char * p = buf;
+    ssize_t w;
+
+    while(len){
+        if((w = write(fd, p, len)) < 0){
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        len -= w;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void * buf, size_t len){
+    char * p = buf;
+    ssize_t r;
+
+    while(len){
+        if((r = read(fd, p, len)) <= 0){
+            if(r < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+// Send a header and a payload made of up to two parts, in one write so Nagle has nothing to hold back
+static int send_msg(int fd, uint32_t type, const void * a, size_t alen, const void * b, size_t blen){
+    struct coord_hdr hdr;
+    char * buf;
+    int r;
+
+    hdr.type = htonl(type);
+    hdr.len = htonl(alen + blen);
+
+    ft_malloc(sizeof(hdr) + alen + blen, buf);
+    memcpy(buf, &hdr, sizeof(hdr));
+    if(alen)
+        memcpy(buf + sizeof(hdr), a, alen);
+    if(blen)
+        memcpy(buf + sizeof(hdr) + alen, b, blen);
+    r = write_all(fd, buf, sizeof(hdr) + alen + blen);
+    free(buf);
+
+    return r;
+}
+
+// Receive a message, the payload is malloc'd and NUL terminated. Returns 0 on success
+static int recv_msg(int fd, uint32_t * type, char ** payload, uint32_t * len){
+    struct coord_hdr hdr;
+
+    if(read_all(fd, &hdr, sizeof(hdr)) < 0)
+        return -1;
+    *type = ntohl(hdr.type);
+    *len = ntohl(hdr.len);
+    if(*len > COORD_MAX_MSG)
+        return -1;
+
+    ft_malloc(*len + 1, *payload);
+    if(read_all(fd, *payload, *len) < 0){
+        free(*payload);
+        return -1;
+    }
+    (*payload)[*len] = '\0';
+
+    return 0;
+}
+
+static void no_delay(int fd){
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/*
+ * Coordinator
+ */
+
+// A connected worker
+struct peer {
+    int fd;
+    unsigned long id; // never reused, unlike the slot
+    char name[64];
+    unsigned long cursor; // paths already passed to this worker
+    long unit; // unit being worked on, -1 if none
+    uint32_t last_crash;
+};
+
+// A path collected from a worker
+struct path {
+    char * data;
+    unsigned long len;
+    uint32_t exec_hash;
+    unsigned long origin; // peer id of the worker that found it
+};
+
+static struct peer peers[COORD_MAX_WORKERS];
+static struct pollfd pfds[COORD_MAX_WORKERS + 1]; // the listening socket comes first
+static int peer_count = 0;
+static unsigned long next_id = 1;
+
+static struct path * paths = NULL;
+static unsigned long path_count = 0, path_size = 0;
+
+static unsigned long unit_count = 0, unit_next = 0, units_done = 0;
+static long requeued[COORD_MAX_WORKERS]; // units abandoned by workers that went away
+static int requeued_count = 0;
+
+static uint8_t farm_virgin[MAP_SIZE];
+static unsigned long tuples = 0, crashes = 0;
+static char corpus_dir[PATH_MAX];
+static char * coord_out;
+
+static void drop_peer(int i){
+    printf("\n[!] Worker %s disconnected\n", peers[i].name);
+    if(peers[i].unit >= 0 && requeued_count < COORD_MAX_WORKERS)
+        requeued[requeued_count++] = peers[i].unit;
+    close(peers[i].fd);
+
+    // keep the arrays packed
+    peer_count--;
+    peers[i] = peers[peer_count];
+    pfds[i + 1] = pfds[peer_count + 1];
+}
+
+static int serve_work(struct peer * p){
+    unsigned long first, n, i, size = sizeof(uint32_t);
+    const struct corpus_entry * e;
+    uint32_t count;
+    char * buf, * q;
+    int r;
+
+    if(p->unit >= 0)
+        units_done++;
+
+    if(requeued_count)
+        p->unit = requeued[--requeued_count];
+    else if(unit_next < unit_count)
+        p->unit = unit_next++;
+    else
+        p->unit = -1;
+
+    if(p->unit < 0){
+        count = 0;
+        return send_msg(p->fd, COORD_WORK, &count, sizeof(count), NULL, 0);
+    }
+
+    first = p->unit * COORD_UNIT;
+    n = MIN((unsigned long)COORD_UNIT, corpus_count() - first);
+    for(i = 0; i < n; i++)
+        size += sizeof(uint32_t) + corpus_get(first + i)->len;
+
+    ft_malloc(size, buf);
+    count = htonl(n);
+    memcpy(buf, &count, sizeof(count));
+    q = buf + sizeof(count);
+    for(i = 0; i < n; i++){
+        e = corpus_get(first + i);
+        count = htonl(e->len);
+        memcpy(q, &count, sizeof(count));
+        memcpy(q + sizeof(count), e->data, e->len);
+        q += sizeof(count) + e->len;
+    }
+    r = send_msg(p->fd, COORD_WORK, buf, size, NULL, 0);
+    free(buf);
+
+    return r;
+}
+
+static void take_case(struct peer * p, char * payload, uint32_t len){
+    uint32_t exec_hash;
+
+    if(len <= sizeof(exec_hash))
+        return;
+    memcpy(&exec_hash, payload, sizeof(exec_hash));
+    exec_hash = ntohl(exec_hash);
+
+    // the file name is the execution hash, so another worker may already have sent this path
+    if(save_case(payload + sizeof(exec_hash), len - sizeof(exec_hash), exec_hash, corpus_dir) < 0)
+        return;
+
+    if(path_count == path_size){
+        path_size = path_size ? path_size * 2 : 256;
+        if((paths = realloc(paths, path_size * sizeof(struct path))) == NULL){
+            fatal("[!] realloc failed\n");
+        }
+    }
+    paths[path_count].len = len - sizeof(exec_hash);
+    ft_malloc(paths[path_count].len, paths[path_count].data);
+    memcpy(paths[path_count].data, payload + sizeof(exec_hash), paths[path_count].len);
+    paths[path_count].exec_hash = exec_hash;
+    paths[path_count].origin = p->id;
+    path_count++;
+}
+
+static void take_crash(struct peer * p, char * payload, uint32_t len){
+    char dir[PATH_MAX], * name;
+    uint32_t no;
+    size_t name_len;
+
+    if(len <= sizeof(no))
+        return;
+    memcpy(&no, payload, sizeof(no));
+    no = ntohl(no);
+    name = payload + sizeof(no);
+    name_len = strnlen(name, len - sizeof(no));
+    if(name_len == len - sizeof(no) || name_len == 0 || strchr(name, '/') || name[0] == '.')
+        return;
+
+    snprintf(dir, PATH_MAX, "%s/%s-crash-%u", coord_out, p->name, no);
+    if(mkdir(dir, 0755) < 0 && errno != EEXIST){
+        printf("[!] Could not mkdir %s: %s\n", dir, strerror(errno));
+        return;
+    }
+    save_case_p(name + name_len + 1, len - sizeof(no) - name_len - 1, name, dir);
+
+    if(no != p->last_crash){
+        p->last_crash = no;
+        crashes++;
+        printf("\n[!!] Crash reported by %s, saved to %s\n", p->name, dir);
+    }
+}
+
+static void take_bitmap(char * payload, uint32_t len){
+    unsigned long i;
+
+    if(len != MAP_SIZE)
+        return;
+
+    tuples = 0;
+    for(i = 0; i < MAP_SIZE; i++){
+        farm_virgin[i] &= (uint8_t)payload[i];
+        if(farm_virgin[i] != 0xff)
+            tuples++;
+    }
+}
+
+// Pass on the paths this worker hasn't seen, then END
+static int serve_pull(struct peer * p){
+    uint32_t exec_hash;
+
+    for(; p->cursor < path_count; p->cursor++){
+        if(paths[p->cursor].origin == p->id)
+            continue;
+        exec_hash = htonl(paths[p->cursor].exec_hash);
+        if(send_msg(p->fd, COORD_CASE, &exec_hash, sizeof(exec_hash), paths[p->cursor].data, paths[p->cursor].len) < 0)
+            return -1;
+    }
+
+    return send_msg(p->fd, COORD_END, NULL, 0, NULL, 0);
+}
+
+// Handle one message from a worker. Returns -1 if the worker should be dropped
+static int serve_msg(struct peer * p){
+    uint32_t type, len, magic;
+    char * payload;
+    int r = 0;
+
+    if(recv_msg(p->fd, &type, &payload, &len) < 0)
+        return -1;
+
+    switch(type){
+        case COORD_HELLO:
+            memcpy(&magic, payload, MIN(len, sizeof(magic)));
+            if(len <= sizeof(magic) || ntohl(magic) != COORD_MAGIC){
+                r = -1;
+                break;
+            }
+            snprintf(p->name, sizeof(p->name), "%s", payload + sizeof(magic));
+            // used in directory names
+            for(magic = 0; p->name[magic]; magic++)
+                if(p->name[magic] == '/' || p->name[magic] == '.')
+                    p->name[magic] = '_';
+            printf("\n[+] Worker %s connected\n", p->name);
+            break;
+
+        case COORD_WORK:
+            r = serve_work(p);
+            break;
+
+        case COORD_CASE:
+            take_case(p, payload, len);
+            break;
+
+        case COORD_CRASH:
+            take_crash(p, payload, len);
+            break;
+
+        case COORD_BITMAP:
+            take_bitmap(payload, len);
+            break;
+
+        case COORD_PULL:
+            r = serve_pull(p);
+            break;
+
+        default:
+            printf("\n[!] Unknown message %u from %s\n", type, p->name);
+            r = -1;
+    }
+    free(payload);
+
+    return r;
+}
+
+/*
+ * Run the coordinator on port until SIGINT. seeds is a directory or corpus archive handed out for
+ * the deterministic stages, or NULL.
+ */
+int coord_serve(int port, char * out_dir, char * seeds){
+    struct sockaddr_in addr;
+    char path[PATH_MAX];
+    int lfd, fd, i, one = 1;
+    unsigned long n;
+
+    coord_out = out_dir;
+    if(mkdir(out_dir, 0755) < 0 && errno != EEXIST){
+        fatal("[!] Could not mkdir %s: %s\n", out_dir, strerror(errno));
+    }
+    snprintf(corpus_dir, PATH_MAX, "%s/corpus", out_dir);
+    if(mkdir(corpus_dir, 0755) < 0 && errno != EEXIST){
+        fatal("[!] Could not mkdir %s: %s\n", corpus_dir, strerror(errno));
+    }
+
+    if(seeds){
+        n = corpus_load(seeds);
+        unit_count = (n + COORD_UNIT - 1) / COORD_UNIT;
+        printf("[+] Loaded %lu seeds, %lu work units\n", n, unit_count);
+    }
+    memset(farm_virgin, 0xff, MAP_SIZE);
+
+    if((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0){
+        fatal("[!] socket: %s\n", strerror(errno));
+    }
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 16) < 0){
+        fatal("[!] Could not listen on port %d: %s\n", port, strerror(errno));
+    }
+    printf("[+] Coordinator listening on port %d\n", port);
+
+    pfds[0].fd = lfd;
+    pfds[0].events = POLLIN;
+    while(!shared->stop){
+        if(poll(pfds, peer_count + 1, 1000) < 0 && errno != EINTR)
+            fatal("[!] poll: %s\n", strerror(errno));
+
+        if(pfds[0].revents & POLLIN){
+            if((fd = accept(lfd, NULL, NULL)) >= 0){
+                if(peer_count == COORD_MAX_WORKERS){
+                    printf("\n[!] Too many workers, refusing another\n");
+                    close(fd);
+                }
+                else{
+                    no_delay(fd);
+                    memset(&peers[peer_count], 0x00, sizeof(struct peer));
+                    peers[peer_count].fd = fd;
+                    peers[peer_count].id = next_id++;
+                    peers[peer_count].unit = -1;
+                    snprintf(peers[peer_count].name, sizeof(peers[peer_count].name), "worker%lu", peers[peer_count].id);
+                    pfds[peer_count + 1].fd = fd;
+                    pfds[peer_count + 1].events = POLLIN;
+                    pfds[peer_count + 1].revents = 0;
+                    peer_count++;
+                }
+            }
+        }
+
+        // backwards, a dropped worker is replaced by the last one
+        for(i = peer_count - 1; i >= 0; i--){
+            if(pfds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)){
+                pfds[i + 1].revents = 0;
+                if(serve_msg(&peers[i]) < 0)
+                    drop_peer(i);
+            }
+        }
+
+        printf("[.] Workers: %d Units: %lu/%lu Paths: %lu Tuples: %lu Crashes: %lu\r", peer_count,
+            units_done, unit_count, path_count, tuples, crashes);
+        fflush(stdout);
+    }
+    printf("\n");
+
+    for(i = 0; i < peer_count; i++)
+        close(peers[i].fd);
+    close(lfd);
+
+    snprintf(path, PATH_MAX, "%s/coverage.bitmap", out_dir);
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0){
+        if(write_all(fd, farm_virgin, MAP_SIZE) == 0)
+            printf("[.] Coverage of the farm written to %s\n", path);
+        close(fd);
+    }
+    for(n = 0; n < path_count; n++)
+        free(paths[n].data);
+    free(paths);
+    if(seeds)
+        corpus_free();
+
+    printf("[.] Done. Paths collected: %lu Crashes: %lu\n", path_count, crashes);
+    return 0;
+}
+
+/*
+ * Worker
+ */
+
+static int coord_fd = -1;
+static pthread_mutex_t coord_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t last_pull = 0;
+
+// Called with coord_lock held
+static void lost_coordinator(){
+    if(coord_fd < 0)
+        return;
+    printf("\n[!] Lost the coordinator, carrying on alone\n");
+    close(coord_fd);
+    coord_fd = -1;
+}
+
+// Connect to the coordinator at host:port, fatal if it can't be reached
+void coord_connect(char * addr){
+    struct addrinfo hints, * res, * ai;
+    char host[256], name[128];
+    uint32_t magic = htonl(COORD_MAGIC);
+    char * port;
+    int fd = -1;
+
+    snprintf(host, sizeof(host), "%s", addr);
+    if((port = strrchr(host, ':')) == NULL){
+        fatal("[!] --worker takes host:port\n");
+    }
+    *port++ = '\0';
+
+    memset(&hints, 0x00, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, port, &hints, &res) != 0){
+        fatal("[!] Could not resolve coordinator %s\n", addr);
+    }
+    for(ai = res; ai; ai = ai->ai_next){
+        if((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+            continue;
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if(fd < 0){
+        fatal("[!] Could not connect to coordinator %s\n", addr);
+    }
+    no_delay(fd);
+
+    if(gethostname(name, sizeof(name) - 16) < 0)
+        strcpy(name, "worker");
+    name[sizeof(name) - 16] = '\0';
+    snprintf(name + strlen(name), 16, "-%d", getpid());
+
+    if(send_msg(fd, COORD_HELLO, &magic, sizeof(magic), name, strlen(name) + 1) < 0){
+        fatal("[!] Could not talk to coordinator %s\n", addr);
+    }
+    coord_fd = fd;
+    printf("[+] Connected to coordinator %s as %s\n", addr, name);
+}
+
+int coord_on(){
+    return coord_fd >= 0;
+}
+
+int coord_due(){
+    return time(NULL) - last_pull >= COORD_INTERVAL;
+}
+
+// Ask for the next unit of seeds for the deterministic stages. NULL once they have all been handed out
+testcase_t * coord_work(){
+    testcase_t * head = NULL, * tail = NULL, * entry;
+    uint32_t type, len, count, n, i;
+    char * payload, * p;
+
+    pthread_mutex_lock(&coord_lock);
+    if(coord_fd < 0 || send_msg(coord_fd, COORD_WORK, NULL, 0, NULL, 0) < 0 ||
+            recv_msg(coord_fd, &type, &payload, &len) < 0){
+        lost_coordinator();
+        pthread_mutex_unlock(&coord_lock);
+        return NULL;
+    }
+    pthread_mutex_unlock(&coord_lock);
+
+    if(type != COORD_WORK || len < sizeof(count)){
+        free(payload);
+        return NULL;
+    }
+    memcpy(&count, payload, sizeof(count));
+    count = ntohl(count);
+
+    p = payload + sizeof(count);
+    for(i = 0; i < count && p + sizeof(n) <= payload + len; i++){
+        memcpy(&n, p, sizeof(n));
+        n = ntohl(n);
+        p += sizeof(n);
+        if(n == 0 || n > (uint32_t)(payload + len - p))
+            break;
+
+        ft_malloc(sizeof(testcase_t), entry);
+        ft_malloc(n + 1, entry->data);
+        memcpy(entry->data, p, n);
+        entry->len = n;
+        entry->next = NULL;
+        if(tail)
+            tail->next = entry;
+        else
+            head = entry;
+        tail = entry;
+        p += n;
+    }
+    free(payload);
+
+    return head;
+}
+
+// Hand a new path to the coordinator
+void coord_publish(char * data, unsigned long len, uint32_t exec_hash){
+    uint32_t h = htonl(exec_hash);
+
+    pthread_mutex_lock(&coord_lock);
+    if(coord_fd >= 0 && send_msg(coord_fd, COORD_CASE, &h, sizeof(h), data, len) < 0)
+        lost_coordinator();
+    pthread_mutex_unlock(&coord_lock);
+}
+
+/*
+ * Upload the coverage so far (if virgin_bits isn't NULL) and run the paths the other workers found
+ * through import, which returns 1 if it kept the case, 0 if not and -1 if the target went down.
+ * Returns the number kept, or -1 if an import failed.
+ */
+int coord_sync(uint8_t * virgin_bits, int (*import)(testcase_t * testcase)){
+    testcase_t * head = NULL, * tail = NULL, * entry;
+    unsigned long kept = 0;
+    uint32_t type, len;
+    char * payload;
+    int r, ret = 0;
+
+    pthread_mutex_lock(&coord_lock);
+    last_pull = time(NULL);
+    if(coord_fd < 0){
+        pthread_mutex_unlock(&coord_lock);
+        return 0;
+    }
+    if((virgin_bits && send_msg(coord_fd, COORD_BITMAP, virgin_bits, MAP_SIZE, NULL, 0) < 0) ||
+            send_msg(coord_fd, COORD_PULL, NULL, 0, NULL, 0) < 0){
+        lost_coordinator();
+        pthread_mutex_unlock(&coord_lock);
+        return 0;
+    }
+
+    // collect them all first, the target is run without holding up the other threads
+    while(1){
+        if(recv_msg(coord_fd, &type, &payload, &len) < 0){
+            lost_coordinator();
+            break;
+        }
+        if(type != COORD_CASE || len <= sizeof(uint32_t)){
+            free(payload);
+            break;
+        }
+
+        ft_malloc(sizeof(testcase_t), entry);
+        entry->len = len - sizeof(uint32_t);
+        entry->data = payload;
+        memmove(payload, payload + sizeof(uint32_t), entry->len);
+        entry->next = NULL;
+        if(tail)
+            tail->next = entry;
+        else
+            head = entry;
+        tail = entry;
+    }
+    pthread_mutex_unlock(&coord_lock);
+
+    for(entry = head; entry; entry = entry->next){
+        if((r = import(entry)) < 0){
+            ret = -1;
+            break;
+        }
+        kept += r;
+    }
+    free_testcases(head);
+
+    if(kept)
+        printf("\n[+] Imported %lu new paths from the coordinator\n", kept);
+
+    return ret < 0 ? -1 : (int)kept;
+}
+
+static int send_file(char * path, char * name, uint32_t no){
+    char * data, * buf;
+    size_t name_len = strlen(name) + 1;
+    struct stat s;
+    int fd, r = -1;
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if(fstat(fd, &s) == 0){
+        ft_malloc(sizeof(no) + name_len + s.st_size, buf);
+        no = htonl(no);
+        memcpy(buf, &no, sizeof(no));
+        memcpy(buf + sizeof(no), name, name_len);
+        data = buf + sizeof(no) + name_len;
+        if(read_all(fd, data, s.st_size) == 0)
+            r = send_msg(coord_fd, COORD_CRASH, buf, sizeof(no) + name_len + s.st_size, NULL, 0);
+        free(buf);
+    }
+    close(fd);
+
+    return r;
+}
+
+// Send the cases the given threads spooled for a crash, and their rings, to the coordinator
+void coord_crash(char * dir, int * tids, int count){
+    static uint32_t crash_no = 0;
+    char path[PATH_MAX], prefix[32], ring[32];
+    struct dirent * ent;
+    int i, sent = 0;
+    DIR * d;
+
+    pthread_mutex_lock(&coord_lock);
+    if(coord_fd < 0 || (d = opendir(dir)) == NULL){
+        pthread_mutex_unlock(&coord_lock);
+        return;
+    }
+
+    crash_no++;
+    while((ent = readdir(d)) != NULL){
+        for(i = 0; i < count; i++){
+            snprintf(prefix, sizeof(prefix), "%d-", tids[i]);
+            snprintf(ring, sizeof(ring), "%d.ring", tids[i]);
+            if(!strncmp(ent->d_name, prefix, strlen(prefix)) || !strcmp(ent->d_name, ring))
+                break;
+        }
+        if(i == count)
+            continue;
+
+        snprintf(path, PATH_MAX, "%s/%s", dir, ent->d_name);
+        if(send_file(path, ent->d_name, crash_no) < 0){
+            lost_coordinator();
+            break;
+        }
+        sent++;
+    }
+    closedir(d);
+    pthread_mutex_unlock(&coord_lock);
+
+    if(sent)
+        printf("[.] Sent %d crash files to the coordinator\n", sent);
+}
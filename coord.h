@@ -0,0 +1,46 @@
+/*
+ * File:   coord.h
+ * Author: DoI
+ */
+
+#ifndef COORD_H
+#define COORD_H
+
+#include <stdint.h>
+
+#include "generator.h"
+
+#define COORD_MAGIC 0x465a4331 // "FZC1", first word of every HELLO
+#define COORD_UNIT 8 // seeds per deterministic work unit
+#define COORD_INTERVAL 10 // seconds between a worker's coverage uploads and corpus pulls
+#define COORD_MAX_WORKERS 64
+#define COORD_MAX_MSG (64 * 1024 * 1024) // anything longer is a broken peer
+
+// Message types. Only WORK and PULL are answered, the rest are one way
+enum coord_msg {
+    COORD_HELLO = 1, // worker -> coordinator: magic, then the worker's name
+    COORD_WORK, // worker asks for the next unit, coordinator answers with seed count then len/data pairs
+    COORD_CASE, // a new path: exec hash then data. Workers send them, and receive them in answer to PULL
+    COORD_CRASH, // worker -> coordinator: crash number, file name, NUL, file contents
+    COORD_BITMAP, // worker -> coordinator: the worker's virgin bitmap, MAP_SIZE bytes
+    COORD_PULL, // worker asks for paths found by others, answered by CASEs then END
+    COORD_END
+};
+
+// Every message starts with this, in network byte order
+struct coord_hdr {
+    uint32_t type;
+    uint32_t len; // of the payload that follows
+};
+
+int coord_serve(int port, char * out_dir, char * seeds);
+
+void coord_connect(char * addr);
+int coord_on();
+int coord_due();
+testcase_t * coord_work();
+void coord_publish(char * data, unsigned long len, uint32_t exec_hash);
+int coord_sync(uint8_t * virgin_bits, int (*import)(testcase_t * testcase));
+void coord_crash(char * dir, int * tids, int count);
+
+#endif
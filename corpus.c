@@ -0,0 +1,196 @@
+/*
+ * File:   corpus.c
+ * Author: DoI
+ *
+ * Shared seed corpus. The seeds are read once per process, into a single
+ * anonymous mapping made read-only afterwards (or straight out of a corpus
+ * archive's file mapping), and every worker reads them from there instead of
+ * loading its own copy. A seed directory is copied in with read() rather than
+ * each file being mapped: a mapping per file takes at least a page per seed
+ * and counts against vm.max_map_count, which a 100k file corpus would exceed.
+ * --fork-workers processes inherit the copy, and as nothing writes to it the
+ * pages stay shared between them. New paths found with tracing are appended RCU style: the entry is
+ * filled in first and then published by a release store of the count, so
+ * readers never take a lock and never see a partly written entry. Entries
+ * live in fixed chunks that are never moved or freed while fuzzing, so there
+ * is no old version to reclaim.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "corpus.h"
+#include "state.h"
+#include "util.h"
+
+static struct corpus corpus;
+static pthread_mutex_t corpus_lock = PTHREAD_MUTEX_INITIALIZER; // serialises writers, readers don't take it
+
+// Is data part of one of the shared mappings, as opposed to malloc'd by corpus_add()
+static int mapped(const char * data){
+    if(corpus.arena && data >= corpus.arena && data < corpus.arena + corpus.arena_size)
+        return 1;
+    if(corpus.archive.map && data >= corpus.archive.map && data < corpus.archive.map + corpus.archive.size)
+        return 1;
+    return 0;
+}
+
+// Fill in the next entry and make it visible to readers. Called with corpus_lock held
+static int publish(const char * data, unsigned long len, uint32_t hash){
+    unsigned long idx = corpus.count, chunk = idx / CORPUS_CHUNK;
+    struct corpus_entry * e;
+
+    if(chunk >= CORPUS_CHUNKS){
+        printf("[!] Seed corpus is full (%d entries), not adding any more\n", CORPUS_CHUNK * CORPUS_CHUNKS);
+        return -1;
+    }
+    if(corpus.chunks[chunk] == NULL)
+        ft_malloc(CORPUS_CHUNK * sizeof(struct corpus_entry), corpus.chunks[chunk]);
+
+    e = &corpus.chunks[chunk][idx % CORPUS_CHUNK];
+    e->data = data;
+    e->len = len;
+    e->hash = hash;
+    __atomic_store_n(&corpus.count, idx + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static int load_archive(char * path){
+    const struct archive_entry * ae;
+    const char * data;
+    unsigned long i;
+
+    if(archive_map(&corpus.archive, path) < 0)
+        return -1;
+
+    for(i = 0; i < corpus.archive.count; i++){
+        ae = corpus.archive.index[i].entry;
+        if(ae->len == 0)
+            continue;
+
+        // stored entries are used in place, compressed ones are inflated once and kept
+        if((data = archive_data(&corpus.archive, i)) == NULL)
+            continue;
+
+        publish(data, ae->len, ae->hash ? ae->hash : case_hash(data, ae->len));
+    }
+    mprotect(corpus.archive.map, corpus.archive.size, PROT_READ);
+
+    return 0;
+}
+
+static int load_dir(char * path){
+    struct dirent * ents;
+    char file_path[PATH_MAX];
+    struct stat s;
+    size_t off = 0;
+    ssize_t r;
+    DIR * dir;
+    int fd;
+
+    if((dir = opendir(path)) == NULL){
+        fatal("[!] Error: Could not open directory %s: %s\n", path, strerror(errno));
+    }
+
+    // size the arena, then read everything into it, one private anonymous copy of the directory
+    while((ents = readdir(dir)) != NULL){
+        snprintf(file_path, PATH_MAX, "%s/%s", path, ents->d_name);
+        if(stat(file_path, &s) == 0 && S_ISREG(s.st_mode))
+            corpus.arena_size += s.st_size;
+    }
+    if(corpus.arena_size == 0){
+        closedir(dir);
+        return 0;
+    }
+
+    corpus.arena = mmap(NULL, corpus.arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(corpus.arena == MAP_FAILED){
+        fatal("[!] Could not map %lu bytes for the seed corpus: %s\n", (unsigned long)corpus.arena_size, strerror(errno));
+    }
+
+    rewinddir(dir);
+    while((ents = readdir(dir)) != NULL && off < corpus.arena_size){
+        snprintf(file_path, PATH_MAX, "%s/%s", path, ents->d_name);
+        if(stat(file_path, &s) < 0 || !S_ISREG(s.st_mode) || s.st_size == 0)
+            continue;
+        if((fd = open(file_path, O_RDONLY)) < 0){
+            fatal("[!] Error: Could not open file %s: %s\n", file_path, strerror(errno));
+        }
+        // the directory may have changed since it was sized, take what fits
+        r = read(fd, corpus.arena + off, MIN((size_t)s.st_size, corpus.arena_size - off));
+        close(fd);
+        if(r <= 0)
+            continue;
+
+        publish(corpus.arena + off, r, case_hash(corpus.arena + off, r));
+        off += r;
+    }
+    closedir(dir);
+
+    mprotect(corpus.arena, corpus.arena_size, PROT_READ);
+    return 0;
+}
+
+// Load the seeds from a directory or corpus archive. Returns the number of seeds
+int corpus_load(char * path){
+    int r;
+
+    pthread_mutex_lock(&corpus_lock);
+    r = archive_is(path) ? load_archive(path) : load_dir(path);
+    pthread_mutex_unlock(&corpus_lock);
+
+    if(r < 0 || corpus.count == 0){
+        fatal("no testcases loaded");
+    }
+
+    return corpus.count;
+}
+
+// Number of seeds published so far. Entries below this can be read without locking
+unsigned long corpus_count(){
+    return __atomic_load_n(&corpus.count, __ATOMIC_ACQUIRE);
+}
+
+const struct corpus_entry * corpus_get(unsigned long i){
+    return &corpus.chunks[i / CORPUS_CHUNK][i % CORPUS_CHUNK];
+}
+
+// Add a new path, data is copied
+void corpus_add(const char * data, unsigned long len, uint32_t hash){
+    char * copy;
+
+    ft_malloc(len + 1, copy);
+    memcpy(copy, data, len);
+
+    pthread_mutex_lock(&corpus_lock);
+    if(publish(copy, len, hash) < 0)
+        free(copy);
+    pthread_mutex_unlock(&corpus_lock);
+}
+
+// Only once the workers are gone
+void corpus_free(){
+    unsigned long i;
+
+    for(i = 0; i < corpus.count; i++){
+        if(!mapped(corpus_get(i)->data))
+            free((char *)corpus_get(i)->data);
+    }
+    for(i = 0; i < CORPUS_CHUNKS; i++)
+        free(corpus.chunks[i]);
+
+    if(corpus.arena)
+        munmap(corpus.arena, corpus.arena_size);
+    archive_unmap(&corpus.archive);
+    memset(&corpus, 0x00, sizeof(corpus));
+}
@@ -0,0 +1,38 @@
+/*
+ * File:   corpus.h
+ * Author: DoI
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdint.h>
+
+#include "archive.h"
+
+#define CORPUS_CHUNK 4096 // entries per chunk, chunks never move once published
+#define CORPUS_CHUNKS 1024 // chunk table size, caps the corpus at 4M entries
+
+// A seed, data is read-only and shared by every worker
+struct corpus_entry {
+    const char * data;
+    unsigned long len;
+    uint32_t hash; // case_hash() of data
+};
+
+// The seed corpus, loaded once per process. Entries [0, count) are published and never change
+struct corpus {
+    struct corpus_entry * chunks[CORPUS_CHUNKS];
+    unsigned long count; // written with release by corpus_add(), read with acquire
+    char * arena; // anonymous mapping the seed files are read into, read-only once loaded
+    size_t arena_size;
+    struct archive_map archive; // or the corpus archive they came from
+};
+
+int corpus_load(char * path);
+unsigned long corpus_count();
+const struct corpus_entry * corpus_get(unsigned long i);
+void corpus_add(const char * data, unsigned long len, uint32_t hash);
+void corpus_free();
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ * File:   desock.c
+ * Author: DoI
+ *
+ * libdesock.so - LD_PRELOAD shim that takes the kernel network stack out of
+ * the loop for single connection protocol parsers. accept() no longer waits
+ * for a connection, it pops the next testcase from the shared memory ring
+ * fuzzotron fills with -P shm and hands back a local socket standing in for
+ * the client. read()/recv() on that socket are served from the testcase,
+ * followed by EOF, and anything the target writes back is discarded.
+ * Only TCP listeners are faked, those on FUZZOTRON_DESOCK_PORT if it is set,
+ * so other sockets the target accepts on still work.
+ *
+ * FUZZOTRON_DESOCK=/fuzzotron LD_PRELOAD=./libdesock.so ./targetd
+ *
+ * Without FUZZOTRON_DESOCK set, every call is passed straight through.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "desock.h"
+
+#define DESOCK_MAX_FD 65536
+#define DESOCK_SPIN 20000 // polls of the ring before sleeping in futex()
+
+// A fake client connection, the testcase and how much of it has been read
+struct desock_conn {
+    char * data;
+    size_t len;
+    size_t pos;
+    int peer; // other end of the socketpair, kept open so the fd polls readable
+};
+
+static struct desock_ring * ring = NULL;
+static struct desock_conn * conns[DESOCK_MAX_FD];
+static char listeners[DESOCK_MAX_FD]; // sockets whose accept()s are served from the ring
+static int listen_port = 0; // FUZZOTRON_DESOCK_PORT, or 0 for any TCP listener
+
+static int (*real_listen)(int, int);
+static int (*real_accept)(int, struct sockaddr *, socklen_t *);
+static int (*real_accept4)(int, struct sockaddr *, socklen_t *, int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_recv)(int, void *, size_t, int);
+static ssize_t (*real_recvfrom)(int, void *, size_t, int, struct sockaddr *, socklen_t *);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_send)(int, const void *, size_t, int);
+static int (*real_close)(int);
+
+__attribute__((constructor)) static void desock_init(){
+    char * name;
+
+    real_listen = dlsym(RTLD_NEXT, "listen");
+    real_accept = dlsym(RTLD_NEXT, "accept");
+    real_accept4 = dlsym(RTLD_NEXT, "accept4");
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_recv = dlsym(RTLD_NEXT, "recv");
+    real_recvfrom = dlsym(RTLD_NEXT, "recvfrom");
+    real_write = dlsym(RTLD_NEXT, "write");
+    real_send = dlsym(RTLD_NEXT, "send");
+    real_close = dlsym(RTLD_NEXT, "close");
+
+    if((name = getenv(DESOCK_ENV)) == NULL)
+        return;
+
+    if((ring = desock_open(name)) == NULL){
+        fprintf(stderr, "[!] libdesock: could not map ring %s: %s\n", name, strerror(errno));
+        exit(1);
+    }
+
+    if((name = getenv(DESOCK_PORT_ENV)) != NULL)
+        listen_port = atoi(name);
+}
+
+// Block until the fuzzer publishes a record, then copy it out and release the ring space
+static char * next_record(size_t * len){
+    uint64_t head, tail, off;
+    uint32_t rec_len;
+    uint32_t seq;
+    unsigned long spins = 0;
+    char * data;
+
+    while(1){
+        seq = __atomic_load_n(&ring->head_seq, __ATOMIC_ACQUIRE);
+        tail = ring->tail;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        if(head == tail){
+            if(++spins < DESOCK_SPIN){
+                desock_pause();
+                continue;
+            }
+
+            desock_wait(&ring->head_seq, &ring->waiting, seq);
+            spins = 0;
+            continue;
+        }
+
+        off = tail % ring->size;
+        memcpy(&rec_len, ring->data + off, sizeof(rec_len));
+        if(rec_len == DESOCK_PAD){
+            __atomic_store_n(&ring->tail, tail + (ring->size - off), __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if((data = malloc(rec_len ? rec_len : 1)) == NULL)
+            return NULL;
+        memcpy(data, ring->data + off + sizeof(uint32_t), rec_len);
+        __atomic_store_n(&ring->tail, tail + desock_record_size(rec_len), __ATOMIC_RELEASE);
+        desock_post(&ring->tail_seq, &ring->full_waiting); // a fuzzer thread may be waiting for the space
+
+        *len = rec_len;
+        return data;
+    }
+}
+
+static int fake_accept(struct sockaddr * addr, socklen_t * addrlen, int flags){
+    struct desock_conn * conn;
+    int sv[2];
+
+    if((conn = calloc(1, sizeof(*conn))) == NULL)
+        return -1;
+
+    if((conn->data = next_record(&conn->len)) == NULL){
+        free(conn);
+        return -1;
+    }
+
+    if(socketpair(AF_UNIX, SOCK_STREAM | flags, 0, sv) < 0 || sv[0] >= DESOCK_MAX_FD){
+        free(conn->data);
+        free(conn);
+        return -1;
+    }
+
+    // a byte in flight keeps poll()/select() reporting the fake client as readable
+    real_write(sv[1], "", 1);
+    conn->peer = sv[1];
+    conns[sv[0]] = conn;
+
+    if(addr && addrlen){
+        struct sockaddr_in peer;
+        memset(&peer, 0x00, sizeof(peer));
+        peer.sin_family = AF_INET;
+        peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        memcpy(addr, &peer, *addrlen < sizeof(peer) ? *addrlen : sizeof(peer));
+        *addrlen = sizeof(peer);
+    }
+
+    return sv[0];
+}
+
+static ssize_t fake_read(struct desock_conn * conn, void * buf, size_t count, int peek){
+    size_t n = conn->len - conn->pos;
+
+    if(n > count)
+        n = count;
+    memcpy(buf, conn->data + conn->pos, n);
+    if(!peek)
+        conn->pos += n;
+
+    return n; // 0 once the testcase is exhausted, which the target sees as the client closing
+}
+
+static struct desock_conn * lookup(int fd){
+    if(ring == NULL || fd < 0 || fd >= DESOCK_MAX_FD)
+        return NULL;
+    return conns[fd];
+}
+
+// Is fd a listening socket standing in for the target's service
+static int is_listener(int fd){
+    if(ring == NULL || fd < 0 || fd >= DESOCK_MAX_FD)
+        return 0;
+    return listeners[fd];
+}
+
+/*
+ * Note TCP sockets listening on FUZZOTRON_DESOCK_PORT, or on any port without it. Other
+ * listeners, unix sockets for a control interface say, keep accepting real connections.
+ */
+int listen(int fd, int backlog){
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int type, port;
+    socklen_t type_len = sizeof(type);
+
+    if(ring == NULL || fd < 0 || fd >= DESOCK_MAX_FD)
+        return real_listen(fd, backlog);
+
+    if(getsockname(fd, (struct sockaddr *)&addr, &len) == 0 &&
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) == 0 && type == SOCK_STREAM){
+        if(addr.ss_family == AF_INET)
+            port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+        else if(addr.ss_family == AF_INET6)
+            port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+        else
+            port = -1;
+
+        if(port >= 0 && (listen_port == 0 || port == listen_port))
+            listeners[fd] = 1;
+    }
+
+    return real_listen(fd, backlog);
+}
+
+int accept(int fd, struct sockaddr * addr, socklen_t * addrlen){
+    if(!is_listener(fd))
+        return real_accept(fd, addr, addrlen);
+    return fake_accept(addr, addrlen, 0);
+}
+
+int accept4(int fd, struct sockaddr * addr, socklen_t * addrlen, int flags){
+    if(!is_listener(fd))
+        return real_accept4(fd, addr, addrlen, flags);
+    return fake_accept(addr, addrlen, flags & (SOCK_NONBLOCK | SOCK_CLOEXEC));
+}
+
+ssize_t read(int fd, void * buf, size_t count){
+    struct desock_conn * conn = lookup(fd);
+    if(conn)
+        return fake_read(conn, buf, count, 0);
+    return real_read(fd, buf, count);
+}
+
+ssize_t recv(int fd, void * buf, size_t len, int flags){
+    struct desock_conn * conn = lookup(fd);
+    if(conn)
+        return fake_read(conn, buf, len, flags & MSG_PEEK);
+    return real_recv(fd, buf, len, flags);
+}
+
+ssize_t recvfrom(int fd, void * buf, size_t len, int flags, struct sockaddr * src_addr, socklen_t * addrlen){
+    struct desock_conn * conn = lookup(fd);
+    if(conn)
+        return fake_read(conn, buf, len, flags & MSG_PEEK);
+    return real_recvfrom(fd, buf, len, flags, src_addr, addrlen);
+}
+
+ssize_t write(int fd, const void * buf, size_t count){
+    if(lookup(fd))
+        return count; // responses go nowhere
+    return real_write(fd, buf, count);
+}
+
+ssize_t send(int fd, const void * buf, size_t len, int flags){
+    if(lookup(fd))
+        return len;
+    return real_send(fd, buf, len, flags);
+}
+
+int close(int fd){
+    struct desock_conn * conn = lookup(fd);
+
+    if(is_listener(fd))
+        listeners[fd] = 0;
+
+    if(conn){
+        conns[fd] = NULL;
+        real_close(conn->peer);
+        free(conn->data);
+        free(conn);
+    }
+
+    return real_close(fd);
+}
@@ -0,0 +1,128 @@
+/*
+ * File:   desock.h
+ * Author: DoI
+ *
+ * Shared memory ring used to hand testcases to a target running with the
+ * libdesock.so preload shim. The fuzzer appends length prefixed records,
+ * the shim pops one record per accept() and serves it to the target's
+ * read()/recv() calls. Shared between sender.c and desock.c.
+ */
+
+#ifndef DESOCK_H
+#define DESOCK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define DESOCK_ENV "FUZZOTRON_DESOCK" // environment variable holding the ring name for the shim
+#define DESOCK_PORT_ENV "FUZZOTRON_DESOCK_PORT" // optional, only accept()s on the socket listening on this port are faked
+#define DESOCK_MAGIC 0x4b534544 // "DESK"
+#define DESOCK_RING_SIZE (8 << 20) // bytes of record data
+#define DESOCK_PAD 0xffffffff // record length marking the unused tail of the ring before a wrap
+#define DESOCK_FULL_SPIN 1000 // polls of a full ring before the fuzzer sleeps in futex()
+
+struct desock_ring {
+    volatile uint32_t magic; // set last, once the ring is initialised
+    uint32_t size;
+    volatile uint64_t head; // total bytes published by the fuzzer
+    volatile uint64_t tail; // total bytes consumed by the target
+    volatile uint32_t lock; // serialises fuzzer threads
+    volatile uint32_t waiting; // the target is sleeping in futex() waiting on head_seq
+    volatile uint32_t head_seq; // bumped on every publish, the futex word the target sleeps on
+    volatile uint32_t tail_seq; // bumped on every consume, the futex word a fuzzer facing a full ring sleeps on
+    volatile uint32_t full_waiting; // a fuzzer thread is sleeping in futex() waiting on tail_seq
+    char data[];
+};
+
+// Records are a 4 byte length followed by the data, padded to 8 bytes
+static inline uint64_t desock_record_size(uint64_t len){
+    return (sizeof(uint32_t) + len + 7) & ~7ULL;
+}
+
+// Spin loop hint. A compiler barrier keeps the loop rereading the ring where there is no pause
+static inline void desock_pause(void){
+#ifdef __x86_64__
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/*
+ * Sleep until *word moves on from seen, the other side wakes us or 10ms pass, whichever is
+ * first. The timeout covers a wake that was missed. *waiting is raised for the duration so
+ * the other side knows to make the syscall.
+ */
+static inline void desock_wait(volatile uint32_t * word, volatile uint32_t * waiting, uint32_t seen){
+    struct timespec timeout = { 0, 10000000 };
+
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(word, __ATOMIC_SEQ_CST) == seen)
+        syscall(SYS_futex, word, FUTEX_WAIT, seen, &timeout, NULL, 0);
+    __atomic_store_n(waiting, 0, __ATOMIC_RELEASE);
+}
+
+// Bump *word and wake whoever is sleeping on it, if anyone is
+static inline void desock_post(volatile uint32_t * word, volatile uint32_t * waiting){
+    __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Map the ring called name, creating and initialising it if this side got there first.
+ * Returns NULL on failure with errno set.
+ */
+static inline struct desock_ring * desock_open(const char * name){
+    size_t map_len = sizeof(struct desock_ring) + DESOCK_RING_SIZE;
+    struct desock_ring * ring;
+    int fd, created = 1;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0 && errno == EEXIST){
+        created = 0;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if(fd < 0)
+        return NULL;
+
+    if(created && ftruncate(fd, map_len) < 0){
+        close(fd);
+        return NULL;
+    }
+
+    // the creating side may not have truncated the object yet
+    struct stat s;
+    while(!created && fstat(fd, &s) == 0 && (size_t)s.st_size < map_len)
+        usleep(1000);
+
+    ring = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ring == MAP_FAILED)
+        return NULL;
+
+    if(created){
+        ring->size = DESOCK_RING_SIZE;
+        ring->head = ring->tail = 0;
+        ring->lock = ring->waiting = 0;
+        ring->head_seq = ring->tail_seq = ring->full_waiting = 0;
+        __atomic_store_n(&ring->magic, DESOCK_MAGIC, __ATOMIC_RELEASE);
+    }
+    else{
+        while(__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != DESOCK_MAGIC)
+            usleep(1000);
+    }
+
+    return ring;
+}
+
+#endif
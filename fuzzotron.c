@@ -23,40 +23,264 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <poll.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+#include "affinity.h"
+#include "archive.h"
+#include "bisect.h"
+#include "bpcov.h"
+#include "coord.h"
+#include "corpus.h"
+#include "health.h"
+#include "kmsg.h"
+#include "metrics.h"
 #include "monitor.h"
+#include "rate.h"
 #include "fuzzotron.h"
+#include "san.h"
+#include "sched.h"
 #include "sender.h"
 #include "generator.h"
+#include "state.h"
+#include "supervisor.h"
+#include "sync.h"
+#include "timing.h"
 #include "trace.h"
+#include "hash.h"
 #include "util.h"
 
 // Struct to hold arguments passed to the monitor thread
 struct monitor_args mon_args;
 
-volatile int stop = 0;   // the global 'stop fuzzing' variable. When set to 1, all threads will spool
-                         // their cases to disk and exit.
-int timeout_stop = 0; // similar to stop, but needed to know if the test cases should be saved.
-pthread_mutex_t runlock;
+struct shared_state * shared = NULL; // stop flags and the like, mapped shared with --fork-workers processes
 int check_pid = 0; // server pid to check for crash.
 int timeout_secs = 0; // time in seconds until fuzzing stops.
 struct fuzzer_args fuzz; // Arguments for the fuzzer threads
 char * output_dir = NULL; // directory for potential crashes
 
-static unsigned long cases_sent = 0;
-static unsigned long cases_jettisoned = 0;
-static unsigned long paths = 0;
+static struct worker_args * worker_info = NULL; // all workers, for the pid watcher to inspect
+static int worker_count = 0;
+static __thread struct worker_args * self = NULL; // the calling worker's own entry
+static struct worker_stats * worker_stats = NULL; // one per worker, kept across target restarts
+static struct worker_stats orphan_stats; // for anything counted outside a worker
+static __thread struct worker_stats * stats = &orphan_stats; // the calling thread's counters
+static struct stage_timing * worker_timing = NULL; // one per worker, see timing.c
+static unsigned long stats_base[STAT_COUNT]; // counts carried over from a resumed campaign
+
+// --fork-workers: how far each seed's deterministic stage has got, by corpus index. Shared, so main
+// can checkpoint the worker processes' progress and a restarted one carries on where it stopped
+struct seed_progress {
+    uint32_t hash;
+    atomic_ulong offset; // bit offset below which every unit is done
+    atomic_int done;
+};
+static struct seed_progress * seed_progress = NULL;
+
+static char * target_cmd = NULL; // command the supervisor starts and restarts the target with
+static volatile unsigned int target_gen = 0; // bumped every time the target is restarted
+static unsigned long san_unique = 0, san_dupes = 0; // sanitizer crashes filed and thrown away
+static int bisect = 0; // replay the spooled batches after a crash to find the crashing case
+static char * restart_cmd = NULL; // command restarting the target for bisect
+static int resume = 0; // load the checkpoint from output_dir and continue the previous campaign
+static size_t ring_bytes = RING_BYTES; // payload memory for each worker's crash ring
+static unsigned long ring_cases = RING_CASES; // cases kept in each worker's crash ring, 0 disables it
+static char * corpus_path = NULL; // corpus archive given with --directory, new paths are appended to it
+static struct archive corpus; // corpus_path opened for appending
+static int corpus_compress = 0; // compress cases added to the corpus archive
+static int coord_port = 0; // --coordinator, listen for workers instead of fuzzing
+static char * coord_addr = NULL; // --worker, host:port of the coordinator
+static int run_determ = 1; // deterministic stages, left to the primary when syncing with other instances
+static atomic_int coord_units = 1; // the coordinator may still have seeds for the deterministic stages
+static __thread uint32_t parent_hash = 0; // seed the cases being sent were mutated from, 0 if unknown
+static __thread uint64_t last_exec_us = 0; // how long the last run_case() took
+static int fork_workers = 0; // --fork-workers, each worker a process of its own
+static int metrics_port = 0; // --metrics-port, serve the metrics to Prometheus on localhost
+
+// Bump one of the calling thread's counters. There is only ever one writer, so no locked add
+#define COUNT(stat) atomic_store_explicit(&stats->count[stat], \
+    atomic_load_explicit(&stats->count[stat], memory_order_relaxed) + 1, memory_order_relaxed)
+
+// Count a new path, and when it was found
+#define COUNT_PATH() do { \
+        COUNT(STAT_PATHS); \
+        atomic_store_explicit(&shared->last_path, time(NULL), memory_order_relaxed); \
+    } while(0)
+
+// SIGINT handler, stop cleanly so the checkpoint gets written
+static void handle_sigint(int sig __attribute__((unused))){
+    // timeout_stop first, anyone who sees the stop must know not to spool
+    atomic_store(&shared->timeout_stop, 1);
+    atomic_store(&shared->stop, 1);
+}
+
+// Bring the campaign totals up to date for the checkpoint and status line. Main thread only
+static void tally(void){
+    unsigned long k, offset;
+
+    campaign.cases_sent = stat_total(STAT_SENT);
+    campaign.paths = stat_total(STAT_PATHS);
+    campaign.cases_jettisoned = stat_total(STAT_JETTISONED);
+
+    // the worker processes' progress
+    for(k = 0; seed_progress && k < corpus_count(); k++){
+        offset = atomic_load(&seed_progress[k].offset);
+        pthread_mutex_lock(&campaign_lock);
+        if(atomic_load(&seed_progress[k].done))
+            determ_mark_done(seed_progress[k].hash);
+        else if(offset)
+            determ_set_offset(seed_progress[k].hash, offset);
+        pthread_mutex_unlock(&campaign_lock);
+    }
+}
+
+// --fork-workers: share how far a worker process has got with a seed's deterministic stage
+static void publish_progress(uint32_t hash){
+    unsigned long k, offset;
+
+    for(k = 0; k < corpus_count(); k++){
+        if(seed_progress[k].hash != hash)
+            continue;
+        if(sched_is_done(hash)){
+            atomic_store(&seed_progress[k].done, 1);
+            continue;
+        }
+        pthread_mutex_lock(&campaign_lock);
+        if((offset = determ_get_offset(hash)) != 0)
+            atomic_store(&seed_progress[k].offset, offset);
+        pthread_mutex_unlock(&campaign_lock);
+    }
+}
+
+// --fork-workers: where each seed's deterministic stage starts, from a resumed campaign
+static void share_progress(void){
+    const struct corpus_entry * seed;
+    unsigned long k;
+
+    if(fuzz.gen != RADAMSA || !run_determ || corpus_count() == 0)
+        return;
+
+    ft_shared(corpus_count() * sizeof(struct seed_progress), seed_progress);
+    for(k = 0; k < corpus_count(); k++){
+        seed = corpus_get(k);
+        seed_progress[k].hash = seed->hash;
+        atomic_init(&seed_progress[k].done, determ_is_done(seed->hash));
+        atomic_init(&seed_progress[k].offset, determ_get_offset(seed->hash));
+    }
+}
+
+// Queue the seeds' deterministic stages, dealt out between the workers and stolen by whichever goes
+// idle. With only >= 0, just that worker's share, for a worker process that can't steal
+static void queue_seeds(int workers, int only){
+    const struct corpus_entry * seed;
+    unsigned long k, from;
+
+    if(fuzz.gen != RADAMSA || !run_determ || coord_addr)
+        return;
+
+    for(k = 0; k < corpus_count(); k++){
+        seed = corpus_get(k);
+        if((only >= 0 && (int)(k % workers) != only) || seed->len == 0)
+            continue;
+        if(seed_progress){
+            if(atomic_load(&seed_progress[k].done))
+                continue;
+            from = atomic_load(&seed_progress[k].offset);
+        }
+        else{
+            if(determ_is_done(seed->hash))
+                continue;
+            from = determ_get_offset(seed->hash);
+        }
+        sched_add(k % workers, seed->data, seed->len, seed->hash, from, SCHED_INITIAL);
+    }
+}
+
+/*
+ * --fork-workers: a worker process runs one round of worker() per target lifetime. In between it
+ * parks until main has dealt with the crash and bumps the round, and it exits once the campaign
+ * is over. Its share of the deterministic stages is kept from one round to the next.
+ */
+static void worker_process(struct worker_args * args){
+    unsigned int round;
+
+    queue_seeds(args->threads, args->thread_id - 1);
+    for(;;){
+        round = atomic_load(&shared->round);
+        check_pid = atomic_load(&shared->check_pid); // the supervisor may have restarted the target
+        worker(args);
+
+        atomic_fetch_add(&shared->parked, 1);
+        while(atomic_load(&shared->round) == round && !atomic_load(&shared->campaign_over))
+            usleep(10000);
+        if(atomic_load(&shared->campaign_over))
+            exit(0);
+    }
+}
+
+static pid_t spawn_worker(struct worker_args * args){
+    pid_t pid;
+
+    fflush(stdout); // or the child writes out whatever is buffered a second time
+    if((pid = fork()) == 0){
+        worker_process(args);
+    }
+    else if(pid < 0){
+        fatal("[!] FORK FAILED!\n");
+    }
+
+    return pid;
+}
+
+/*
+ * --fork-workers: collect worker processes that have exited. One that died mid-round, a fatal()
+ * or a crash of its own, is restarted up to WORKER_RESTARTS_MAX times; the rest carry on
+ * regardless. Returns the number still running.
+ */
+static int reap_workers(pid_t * pids, int * restarts, struct worker_args * targs, int workers){
+    int i, status, running = 0;
+
+    for(i = 0; i < workers; i++){
+        if(pids[i] && waitpid(pids[i], &status, WNOHANG) == pids[i]){
+            if(WIFSIGNALED(status))
+                printf("\n[!] Worker %d (PID %d) killed by signal %d\n", i + 1, pids[i], WTERMSIG(status));
+            else
+                printf("\n[!] Worker %d (PID %d) exited with status %d\n", i + 1, pids[i], WEXITSTATUS(status));
+            pids[i] = 0;
+
+            if(!atomic_load(&shared->stop) && restarts[i] < WORKER_RESTARTS_MAX){
+                restarts[i]++;
+                printf("[+] Restarting worker process %d\n", i + 1);
+                memset(&targs[i], 0x00, sizeof(struct worker_args));
+                targs[i].thread_id = i + 1;
+                targs[i].threads = workers;
+                pids[i] = spawn_worker(&targs[i]);
+            }
+        }
+        if(pids[i])
+            running++;
+    }
+
+    if(running == 0 && !atomic_load(&shared->stop)){
+        // nothing left to fuzz with, but nothing says the target crashed either
+        printf("[!] No workers left, stopping\n");
+        atomic_store(&shared->timeout_stop, 1);
+        atomic_store(&shared->stop, 1);
+    }
+
+    return running;
+}
 
 int main(int argc, char** argv) {
 
     memset(&fuzz, 0x00, sizeof(fuzz));
+    ft_shared(sizeof(struct shared_state), shared);
+    health.interval = PROBE_INTERVAL_MS;
     // parse arguments
     int c, threads = 1;
     static int use_blab = 0, use_radamsa = 0;
-    char * logfile = NULL, * regex = NULL;
     fuzz.protocol = 0; fuzz.is_tls = 0; fuzz.destroy = 0;
 
     static struct option arg_options[] = {
@@ -71,11 +295,55 @@ int main(int argc, char** argv) {
         {"destroy", no_argument, &fuzz.destroy, 1},
         {"checkscript", required_argument, 0, 'z'},
         {"trace", required_argument, 0, 's'},
+        {"resume", no_argument, &resume, 1},
+        {"bp-cov", no_argument, &fuzz.bp_cov, 1},
+        {"bp-blocks", required_argument, 0, 'B'},
+        {"probe", required_argument, 0, 'e'},
+        {"probe-send", required_argument, 0, 'y'},
+        {"probe-expect", required_argument, 0, 'x'},
+        {"probe-interval", required_argument, 0, 'i'},
+        {"check-coproc", required_argument, 0, 'C'},
+        {"bisect", no_argument, &bisect, 1},
+        {"restart", required_argument, 0, 'R'},
+        {"target", required_argument, 0, 'T'},
+        {"sanitizer", no_argument, &san_enabled, 1},
+        {"kmsg", required_argument, 0, 'K'},
+        {"kmsg-cgroup", required_argument, 0, 'G'},
+        {"ring-bytes", required_argument, 0, 'b'},
+        {"ring-cases", required_argument, 0, 'n'},
+        {"compress", no_argument, &corpus_compress, 1},
+        {"sync", required_argument, 0, 'Y'},
+        {"coordinator", required_argument, 0, 'O'},
+        {"worker", required_argument, 0, 'W'},
+        {"cpus", required_argument, 0, 'U'},
+        {"target-cpus", required_argument, 0, 'V'},
+        {"rate-auto", no_argument, &rate.adaptive, 1},
+        {"max-rate", required_argument, 0, 'Q'},
+        {"rate-latency", required_argument, 0, 'L'},
+        {"rate-response", no_argument, &rate.response, 1},
+        {"fork-workers", no_argument, &fork_workers, 1},
+        {"metrics-port", required_argument, 0, 'E'},
         {0, 0, 0, 0}
     };
     int arg_index;
-    while((c = getopt_long(argc, argv, "d:c:h:p:g:t:m:c:P:r:w:s:z:o:k:", arg_options, &arg_index)) != -1){
+    while((c = getopt_long(argc, argv, "d:c:h:p:g:t:m:c:M:P:r:S:w:s:z:o:k:B:", arg_options, &arg_index)) != -1){
         switch(c){
+            case 'B':
+                // block addresses for breakpoint coverage
+                fuzz.bp_blocks = optarg;
+                fuzz.bp_cov = 1;
+                break;
+
+            case 'b':
+                // crash ring memory per worker
+                ring_bytes = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'C':
+                // long running check process
+                health.coproc = optarg;
+                break;
+
             case 'c':
                 // Define PID to check for crash
                 check_pid = atoi(optarg);
@@ -83,13 +351,34 @@ int main(int argc, char** argv) {
                 break;
 
             case 'd':
-                // define test case directory for blab
+                // define test case directory for blab, or a corpus archive unpacked for radamsa below
                 fuzz.in_dir = optarg;
+                if(archive_is(optarg)){
+                    corpus_path = optarg;
+                    break;
+                }
                 if(directory_exists(fuzz.in_dir) < 0){
                     fatal("Could not open %s\n", fuzz.in_dir);
                 }
                 break;
 
+            case 'e':
+                // built-in health probe
+                if(parse_probe(optarg) < 0){
+                    fatal("Please specify 'tcp[:host][:port]', 'udp[:host][:port]' or 'unix[:path]' for --probe\n");
+                }
+                break;
+
+            case 'E':
+                // serve Prometheus metrics on localhost
+                metrics_port = atoi(optarg);
+                break;
+
+            case 'G':
+                // cgroup for the kernel log watcher
+                kmsg.cgroup = optarg;
+                break;
+
             case 'g':
                 // define grammar
                 fuzz.grammar = optarg;
@@ -100,6 +389,16 @@ int main(int argc, char** argv) {
                 fuzz.host = optarg;
                 break;
 
+            case 'i':
+                // time between background health probes
+                health.interval = atoi(optarg);
+                break;
+
+            case 'K':
+                // process name for the kernel log watcher
+                kmsg.name = optarg;
+                break;
+
             case 'k':
                 // set time for fuzzing to run (in seconds)
                 timeout_secs = atoi(optarg);
@@ -110,9 +409,29 @@ int main(int argc, char** argv) {
                 fuzz.alpn = optarg;
                 break;
 
+            case 'M':
+            case 'S':
+                // name of this instance in the sync directory, -M runs the deterministic stages
+                sync_opts.name = optarg;
+                sync_opts.primary = (c == 'M');
+                break;
+
+            case 'L':
+                // mean send latency the rate controller takes as overload
+                rate.latency_ms = strtoul(optarg, NULL, 10);
+                break;
+
             case 'm':
-                // Log file to monitor
-                logfile = optarg;
+                // Log file to monitor, may be given more than once
+                if(mon_args.file_count == MAX_LOGS){
+                    fatal("At most %d log files can be monitored\n", MAX_LOGS);
+                }
+                mon_args.files[mon_args.file_count++] = optarg;
+                break;
+
+            case 'n':
+                // crash ring depth per worker, 0 to disable
+                ring_cases = strtoul(optarg, NULL, 10);
                 break;
 
             case 'o':
@@ -121,6 +440,16 @@ int main(int argc, char** argv) {
 
                 break;
 
+            case 'O':
+                // run as the coordinator of a farm of workers instead of fuzzing
+                coord_port = atoi(optarg);
+                break;
+
+            case 'Q':
+                // hard cap on cases per second, over all workers
+                rate.max = atof(optarg);
+                break;
+
             case 'p':
                 // define port
                 fuzz.port = atoi(optarg);
@@ -128,8 +457,9 @@ int main(int argc, char** argv) {
 
             case 'P':
                 // define protocol
-                if((strcmp(optarg,"udp") != 0) && (strcmp(optarg,"tcp") != 0) && (strcmp(optarg,"unix") != 0)){
-                        fatal("Please specify either 'tcp', 'udp' or 'unix' for -P\n");
+                if((strcmp(optarg,"udp") != 0) && (strcmp(optarg,"tcp") != 0) && (strcmp(optarg,"unix") != 0) &&
+                        (strcmp(optarg,"shm") != 0)){
+                        fatal("Please specify either 'tcp', 'udp', 'unix' or 'shm' for -P\n");
                 }
                 if(strcmp(optarg,"tcp") == 0){
                             fuzz.protocol = 1;
@@ -143,12 +473,19 @@ int main(int argc, char** argv) {
                     fuzz.protocol = 3;
                     fuzz.send = send_unix;
                 }
+                else if(strcmp(optarg,"shm") == 0){
+                    fuzz.protocol = 4;
+                    fuzz.send = send_shm;
+                }
 
                 break;
 
             case 'r':
-                // define regex for monitoring
-                regex = optarg;
+                // define regex for monitoring, one per -m or one for all of them
+                if(mon_args.regex_count == MAX_LOGS){
+                    fatal("At most %d log files can be monitored\n", MAX_LOGS);
+                }
+                mon_args.regexes[mon_args.regex_count++] = optarg;
                 break;
 
             case 't':
@@ -160,6 +497,50 @@ int main(int argc, char** argv) {
                 fuzz.shm_id = atoi(optarg);
                 break;
 
+            case 'x':
+                // string a health probe response must contain
+                health.expect = optarg;
+                break;
+
+            case 'U':
+                // CPUs to pin the workers to
+                if(affinity_parse_workers(optarg) < 0){
+                    fatal("Invalid CPU list for --cpus: %s\n", optarg);
+                }
+                break;
+
+            case 'V':
+                // CPUs to pin the target to
+                if(affinity_parse_target(optarg) < 0){
+                    fatal("Invalid CPU list for --target-cpus: %s\n", optarg);
+                }
+                break;
+
+            case 'W':
+                // coordinator to take work from and report to
+                coord_addr = optarg;
+                break;
+
+            case 'Y':
+                // directory shared with other instances
+                sync_opts.dir = optarg;
+                break;
+
+            case 'y':
+                // request sent by the health probe
+                health.send = optarg;
+                break;
+
+            case 'R':
+                // command restarting the target
+                restart_cmd = optarg;
+                break;
+
+            case 'T':
+                // command to start the target with
+                target_cmd = optarg;
+                break;
+
             case 'z':
                 fuzz.check_script = optarg;
                 break;
@@ -167,11 +548,23 @@ int main(int argc, char** argv) {
            }
     }
 
+    fuzz.tracing = fuzz.shm_id || fuzz.bp_cov;
+
+    if(coord_port){
+        // the coordinator doesn't talk to a target, it only needs somewhere to put what it collects
+        if(output_dir == NULL){
+            fatal("--coordinator requires -o\n");
+        }
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, handle_sigint);
+        return coord_serve(coord_port, output_dir, fuzz.in_dir);
+    }
+
     // check argument sanity
-    if((fuzz.host == NULL) || (fuzz.port == 0 && fuzz.protocol != 3) ||
+    if((fuzz.host == NULL) || (fuzz.port == 0 && fuzz.protocol != 3 && fuzz.protocol != 4) ||
             (use_blab == 1 && use_radamsa == 1) ||
             (use_blab == 0 && use_radamsa == 0) ||
-            (use_blab == 1 && fuzz.in_dir && !fuzz.shm_id) ||
+            (use_blab == 1 && fuzz.in_dir && !fuzz.tracing) ||
             (use_radamsa == 1 && fuzz.grammar != NULL) ||
             (fuzz.protocol == 0) || (output_dir == NULL)){
         help();
@@ -187,13 +580,48 @@ int main(int argc, char** argv) {
         fatal("If using radamsa, -d or --directory must be specified\n");
     }
 
-    if(fuzz.shm_id && threads > 1){
+    if(fuzz.tracing && threads > 1){
         fatal("Tracing only supported single threaded");
     }
-    if(fuzz.shm_id && fuzz.gen == BLAB && fuzz.in_dir == NULL){
+    if(fuzz.shm_id && fuzz.bp_cov){
+        fatal("--trace and --bp-cov are mutually exclusive");
+    }
+    if(fuzz.bp_cov && check_pid == 0){
+        fatal("--bp-cov requires the target PID to be specified with -c");
+    }
+    if(target_cmd && (check_pid || restart_cmd || fuzz.bp_cov)){
+        fatal("--target can't be combined with -c, --restart or --bp-cov");
+    }
+    if(target_cmd && !health.probe && !health.coproc && !fuzz.check_script &&
+            (fuzz.protocol == 1 || fuzz.protocol == 3)){
+        // readiness and liveness of a supervised target default to connecting to it
+        health.probe = fuzz.protocol == 1 ? PROBE_TCP : PROBE_UNIX;
+    }
+    if(sync_opts.dir && (sync_opts.name == NULL || !fuzz.tracing)){
+        fatal("--sync requires -M or -S and coverage (--trace or --bp-cov)");
+    }
+    if(sync_opts.name && sync_opts.dir == NULL){
+        fatal("-M and -S require --sync");
+    }
+    if(fork_workers && (fuzz.tracing || sync_opts.dir || coord_addr)){
+        fatal("--fork-workers can't be combined with coverage, --sync or --worker");
+    }
+    if(affinity.target_set && !target_cmd && check_pid == 0){
+        fatal("--target-cpus requires the target started with --target or its PID given with -c");
+    }
+    if(sync_opts.dir){
+        run_determ = sync_opts.primary;
+        sync_init();
+        printf("[+] Syncing with other instances in %s as %s %s\n", sync_opts.dir,
+            sync_opts.primary ? "primary" : "secondary", sync_opts.name);
+    }
+    if(bisect && ((restart_cmd == NULL && target_cmd == NULL) || (!health.probe && !health.coproc && !fuzz.check_script))){
+        fatal("--bisect requires --restart or --target and a health check (--probe, --check-coproc or -z)");
+    }
+    if(fuzz.tracing && fuzz.gen == BLAB && fuzz.in_dir == NULL){
         fatal("Blab and tracing requires --directory");
     }
-    if(fuzz.shm_id && use_blab == 1 && fuzz.in_dir){
+    if(fuzz.tracing && use_blab == 1 && fuzz.in_dir){
         // Note: hmmm, maybe using blab and instrumentation is a good idea... Save testcases that blab generates
         // that hit new paths and use this to seed a mutation-based fuzzer?
         puts(GRN "[+] Experimental discovery mode enabled\n" RESET);
@@ -205,19 +633,28 @@ int main(int argc, char** argv) {
         SSL_load_error_strings();
     }
     
-    if(logfile != NULL){
-        if(regex == NULL){
+    if(san_enabled && mon_args.file_count == 0){
+        fatal("--sanitizer reads reports from the target's log, give it with -m\n");
+    }
+    if(mon_args.file_count){
+        if(mon_args.regex_count == 0 && !san_enabled){
             printf("[!] No regex specified, falling back to Crash-Detect mode\n");
         }
         else {
-            printf("[+] Monitoring logfile %s\n", logfile);
+            if(mon_args.regex_count > 1 && mon_args.regex_count != mon_args.file_count){
+                fatal("Give either one -r for all log files or one -r per -m\n");
+            }
+            int l;
+            for(l = 0; l < mon_args.file_count; l++){
+                if(mon_args.regex_count == 1)
+                    mon_args.regexes[l] = mon_args.regexes[0];
+                printf("[+] Monitoring logfile %s for %s\n", mon_args.files[l],
+                    mon_args.regexes[l] ? mon_args.regexes[l] : "sanitizer reports");
+            }
             // Spawn the monitor
             int rc;
             pthread_t monitor;
 
-            mon_args.file = logfile;
-            mon_args.regex = regex;
-
             printf("[+] Spawning monitor\n");
             rc = pthread_create(&monitor, NULL, call_monitor, NULL);
             if(rc){
@@ -228,8 +665,8 @@ int main(int argc, char** argv) {
     }
 
     if(fuzz.check_script){
-        if(!file_exists(fuzz.check_script)){
-            printf("[!] File %s not found\n", fuzz.check_script);
+        if(access(fuzz.check_script, X_OK) < 0){
+            printf("[!] Error accessing check script %s: %s\n", fuzz.check_script, strerror(errno));
             help();
             return -1;
         }
@@ -250,6 +687,65 @@ int main(int argc, char** argv) {
         }
     }
 
+    if(corpus_path){
+        // radamsa and the seed loaders want a directory, give them a scratch copy of the archive
+        static char corpus_dir[PATH_MAX];
+        int n;
+
+        snprintf(corpus_dir, PATH_MAX, "%s/corpus-%d", fuzz.tmp_dir, getpid());
+        if(mkdir(corpus_dir, 0755) < 0 && errno != EEXIST){
+            fatal("[!] Could not mkdir %s: %s\n", corpus_dir, strerror(errno));
+        }
+        if((n = archive_export(corpus_path, corpus_dir)) <= 0){
+            fatal("[!] No cases in corpus archive %s\n", corpus_path);
+        }
+        if(archive_open(&corpus, corpus_path, corpus_compress) < 0){
+            fatal("[!] Could not open %s for appending\n", corpus_path);
+        }
+        fuzz.in_dir = corpus_dir;
+        printf("[+] Loaded %d cases from corpus archive %s\n", n, corpus_path);
+    }
+
+    if(rate.response && !rate.adaptive){
+        fatal("--rate-response requires --rate-auto");
+    }
+    rate_init(threads);
+
+    if(affinity.workers_set || affinity.target_set)
+        affinity_setup(threads);
+
+    if(fuzz.shm_id){
+        printf("[.] Trace enabled\n");
+        fuzz.trace_bits = setup_shm(fuzz.shm_id);
+        fuzz.wait = wait_for_bitmap;
+        affinity_bind_map(fuzz.trace_bits, MAP_SIZE);
+    }
+    else if(fuzz.bp_cov){
+        fuzz.trace_bits = bpcov_start(check_pid, fuzz.bp_blocks);
+        fuzz.wait = bpcov_wait;
+    }
+
+    if(fuzz.tracing){
+        memset(fuzz.virgin_bits, 255, MAP_SIZE);
+    }
+
+    if(coord_addr)
+        coord_connect(coord_addr);
+
+    if(resume){
+        if(state_load(output_dir, &fuzz) < 0){
+            printf("[!] No checkpoint to resume from, starting a new campaign\n");
+            resume = 0;
+        }
+        else{
+            printf("[+] Resuming campaign, sent: %lu paths: %lu seeds completed: %u\n",
+                campaign.cases_sent, campaign.paths, campaign.determ_done_count);
+            stats_base[STAT_SENT] = campaign.cases_sent;
+            stats_base[STAT_PATHS] = campaign.paths;
+            stats_base[STAT_JETTISONED] = campaign.cases_jettisoned;
+        }
+    }
+
     if(use_blab == 1){
         fuzz.gen = BLAB;
     }
@@ -257,24 +753,51 @@ int main(int argc, char** argv) {
         fuzz.gen = RADAMSA;
     }
 
-    if (pthread_mutex_init(&runlock, NULL) != 0){
-        fatal("[!] pthread_mutex_init failed");
+    if(fuzz.gen == RADAMSA){
+        // read once here and shared by every worker, the archive itself if there is one
+        printf("[+] Loaded %d seeds\n", corpus_load(corpus_path ? corpus_path : fuzz.in_dir));
     }
 
+    sched_init(threads);
+    if(fork_workers)
+        share_progress();
+    else
+        queue_seeds(threads, -1);
+
     signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handle_sigint);
     pthread_t workers[threads];
+    pid_t worker_pids[threads]; // --fork-workers, 0 for a worker process that isn't running
+    int worker_restarts[threads];
     int i;
-    struct worker_args targs[threads];
-    for(i = 1; i <= threads; i++){
-
-        targs[i-1].thread_id = i;
-        targs[i-1].threads = threads;
-
-        printf("[+] Spawning worker thread %d\n", i);
-        if(pthread_create(&workers[i-1], NULL, worker, &targs[i-1]) > 0)
+    struct worker_args * targs;
+    struct worker_stats * shards;
+    // shared, so main sees what worker processes count and have in flight
+    ft_shared(threads * sizeof(struct worker_args), targs);
+    ft_shared(threads * sizeof(struct worker_stats), shards);
+    ft_shared(threads * sizeof(struct stage_timing), worker_timing);
+    memset(worker_pids, 0x00, sizeof(worker_pids));
+    memset(worker_restarts, 0x00, sizeof(worker_restarts));
+    worker_stats = shards;
+    worker_info = targs;
+    worker_count = threads;
+    metrics_init(threads);
+    if(metrics_port)
+        metrics_serve(metrics_port);
+
+    health_start();
+    if(target_cmd)
+        check_pid = supervisor_start(target_cmd);
+    else if(check_pid > 0 && affinity.target_set)
+        printf("[+] Pinned %d target threads\n", affinity_pin_pid(check_pid));
+
+    pthread_t kmsg_monitor;
+    if(kmsg.name || kmsg.cgroup){
+        printf("[+] Watching the kernel log for crashes in %s%s%s\n", kmsg.name ? kmsg.name : "",
+            kmsg.name && kmsg.cgroup ? " in " : "", kmsg.cgroup ? kmsg.cgroup : "");
+        if(pthread_create(&kmsg_monitor, NULL, kmsg_watcher, NULL) > 0)
             fatal("Creating pthread failed: %s\n", strerror(errno));
-
-        usleep(2000);
+        pthread_detach(kmsg_monitor);
     }
 
     pthread_t timeout_monitor;
@@ -287,40 +810,187 @@ int main(int argc, char** argv) {
 
 
     char spinner[4] = "|/-\\";
+    char busiest[128]; // the stages taking the most time
     struct spint { unsigned i:2; } s;
     s.i=0;
-    while(1){
-        usleep(50000);
-        if(stop == 1){
-            printf("\n");
-            break;
+    time_t last_checkpoint = time(NULL);
+
+    // one round per target lifetime, only a supervised target gets more than one
+    for(;;){
+        unsigned long san_seen = san_reports();
+        pthread_t pid_monitor;
+        if(check_pid > 0){
+            if(pthread_create(&pid_monitor, NULL, pid_watcher, (void *)(unsigned long)target_gen) > 0)
+                fatal("Creating pthread failed: %s\n", strerror(errno));
+            pthread_detach(pid_monitor);
+        }
+
+        // worker processes from the last round are parked, nothing touches their entries
+        memset(targs, 0x00, threads * sizeof(struct worker_args));
+        for(i = 1; i <= threads; i++){
+            targs[i-1].thread_id = i;
+            targs[i-1].threads = threads;
+        }
+        if(fork_workers){
+            // wake the parked workers, then start any that aren't running
+            shared->check_pid = check_pid;
+            shared->parked = 0;
+            atomic_fetch_add(&shared->round, 1);
+            for(i = 1; i <= threads; i++){
+                if(worker_pids[i-1])
+                    continue;
+                printf("[+] Spawning worker process %d\n", i);
+                worker_pids[i-1] = spawn_worker(&targs[i-1]);
+            }
+        }
+        else{
+            for(i = 1; i <= threads; i++){
+                printf("[+] Spawning worker thread %d\n", i);
+                if(pthread_create(&workers[i-1], NULL, worker, &targs[i-1]) > 0)
+                    fatal("Creating pthread failed: %s\n", strerror(errno));
+
+                usleep(2000);
+            }
         }
 
-        printf("[%c] Sent cases: %lu", spinner[s.i],  cases_sent);
-        if(fuzz.shm_id)
-            printf(" Paths:%lu Jettisoned: %lu\r", paths, cases_jettisoned);
-        else
+        while(1){
+            usleep(50000);
+            if(fork_workers)
+                reap_workers(worker_pids, worker_restarts, targs, threads);
+            if(shared->stop == 1){
+                printf("\n");
+                break;
+            }
+
+            tally();
+            metrics_sample(output_dir);
+            if(difftime(time(NULL), last_checkpoint) >= STATE_INTERVAL){
+                state_save(output_dir, &fuzz);
+                time(&last_checkpoint);
+            }
+
+            printf("[%c] Sent cases: %lu", spinner[s.i],  campaign.cases_sent);
+            if(fuzz.tracing)
+                printf(" Paths:%lu Jettisoned: %lu Reruns: %lu Stability: %.02f%%", campaign.paths, campaign.cases_jettisoned,
+                    stat_total(STAT_RERUNS), stability());
+            if(san_enabled && (san_unique || san_dupes))
+                printf(" Unique crashes: %lu Duplicates: %lu", san_unique, san_dupes);
+            if(rate.adaptive || rate.max)
+                printf(" Rate: %.0f/s Window: %u Refused: %lu", rate_current(), rate_window(), rate_refused());
+            if(target_cmd && supervisor.restarts)
+                printf(" Crashes: %lu Restart: %lums (avg %lums)", supervisor.crashes, supervisor.last_restart_ms,
+                    supervisor.total_restart_ms / supervisor.restarts);
+            timing_status(worker_timing, threads, busiest, sizeof(busiest));
+            if(busiest[0])
+                printf(" Time: %s", busiest);
             printf("\r");
 
-        fflush(stdout);
-        s.i++;
+            fflush(stdout);
+            s.i++;
+        }
+
+        if(fork_workers){
+            // every worker process parks once it has spooled its cases, or dies trying
+            while(atomic_load(&shared->parked) < reap_workers(worker_pids, worker_restarts, targs, threads))
+                usleep(10000);
+        }
+        else{
+            for(i = 1; i <= threads; i++){
+                pthread_join(workers[i-1], NULL);
+            }
+        }
+
+        if(shared->timeout_stop)
+            break;
+
+        // the target is about to be restarted, any pid watcher still waiting on it is stale
+        target_gen++;
+        COUNT(STAT_CRASHES);
+        if(target_cmd)
+            supervisor.crashes++;
+
+        int tids[threads];
+        for(i = 0; i < threads; i++)
+            tids[i] = targs[i].tid;
+
+        // sort the crash by its sanitizer report, if the target left one in the log
+        struct san_report report;
+        int have_report = 0, known = 0;
+        if(san_enabled && (have_report = san_wait(san_seen, SAN_WAIT_MS, &report))){
+            if((known = san_known(output_dir, &report))){
+                printf("[.] Known crash %s (%s in %s), discarding\n", report.sig, report.type, report.frames[0]);
+                san_discard(output_dir, tids, threads);
+                san_dupes++;
+            }
+        }
+
+        // before bisection rewrites them
+        if(coord_on() && !known)
+            coord_crash(output_dir, tids, threads);
+
+        // the replays' restarts aren't crashes, they stay out of the supervisor's counts
+        if(bisect && !known)
+            bisect_crash(output_dir, tids, threads, target_cmd ? supervisor_replay : restart_target);
+
+        if(have_report && !known){
+            san_file(output_dir, &report, tids, threads);
+            san_unique++;
+            printf("[!!] New crash %s (%s in %s), filed under %s/%s\n", report.sig, report.type, report.frames[0],
+                output_dir, report.sig);
+        }
+
+        if(target_cmd){
+            if(!have_report)
+                printf("[!!] Target crashed, restarting\n");
+            if(supervisor_restart() < 0){
+                printf("[!] Could not restart the target, stopping\n");
+                break;
+            }
+        }
+        else if(bisect && !known && restart_target() < 0){
+            // leave it running for whoever looks next
+            printf("[!] Could not restart the target after bisecting\n");
+        }
+
+        if(!target_cmd || shared->timeout_stop)
+            break;
+
+        printf("[+] Target restarted in %lums, resuming\n", supervisor.last_restart_ms);
+        shared->target_dead = 0;
+        shared->pidfd_watch = 0;
+        shared->stop = 0;
     }
 
+    shared->campaign_over = 1;
+    for(i = 0; fork_workers && i < threads; i++){
+        if(worker_pids[i])
+            waitpid(worker_pids[i], NULL, 0);
+    }
     if(timeout_secs){
         pthread_join(timeout_monitor, NULL);
     }
-    for(i = 1; i <= threads; i++){
-        pthread_join(workers[i-1], NULL);
-    }
 
-    pthread_mutex_destroy(&runlock);
-    printf("[.] Done. Total testcases issued: %lu\n", cases_sent);
+    if(target_cmd)
+        supervisor_stop();
+    health_stop();
+    metrics_stop();
+    if(fuzz.bp_cov)
+        bpcov_stop();
+    if(corpus_path)
+        archive_close(&corpus);
+    sched_free();
+    corpus_free();
+    tally();
+    if(state_save(output_dir, &fuzz) == 0)
+        printf("[.] Checkpoint written to %s/%s\n", output_dir, STATE_FILE);
+    printf("[.] Done. Total testcases issued: %lu\n", campaign.cases_sent);
+    timing_report(worker_timing, threads);
 
     return 1;
 }
 
 void * call_monitor(void * arg){
-    monitor(mon_args.file, mon_args.regex);
+    monitor(mon_args.files, mon_args.regexes, mon_args.file_count);
     return NULL;
 }
 
@@ -329,26 +999,63 @@ void * timer_job(void * args __attribute__((unused))){
     time_t start_time;
 
     time(&start_time);
-    while(stop == 0 && difftime(time(NULL), start_time) < timeout_secs){
+    // a supervised target may crash and come back, so keep timing until main is done
+    while(!shared->campaign_over && (shared->stop == 0 || target_cmd) && difftime(time(NULL), start_time) < timeout_secs){
         sleep(1);
     }
 
-    if(stop == 0){
-        pthread_mutex_lock(&runlock);
+    if(!shared->campaign_over && (shared->stop == 0 || target_cmd)){
         printf("[!] Reached timeout\n");
-        stop = 1;
-        timeout_stop = 1;
-        pthread_mutex_unlock(&runlock);
+        atomic_store(&shared->timeout_stop, 1);
+        atomic_store(&shared->stop, 1);
     }
     return NULL;
 }
 
+static uint32_t jettisoned[JETTISON_SLOTS]; // open addressing, 0 is an empty slot. Tracing is single threaded
+static unsigned long jettisoned_count = 0;
+
+// Has a path with this hash already failed calibration?
+static int was_jettisoned(uint32_t hash){
+    uint32_t i;
+
+    for(i = hash & (JETTISON_SLOTS - 1); jettisoned[i]; i = (i + 1) & (JETTISON_SLOTS - 1)){
+        if(jettisoned[i] == hash)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Remember a path that failed calibration, so a noisy or hanging one isn't calibrated every time it comes up
+static void jettison(uint32_t hash){
+    uint32_t i;
+
+    if(hash == 0 || jettisoned_count >= JETTISON_SLOTS / 4 * 3 || was_jettisoned(hash))
+        return;
+
+    for(i = hash & (JETTISON_SLOTS - 1); jettisoned[i]; i = (i + 1) & (JETTISON_SLOTS - 1))
+        ;
+    jettisoned[i] = hash;
+    jettisoned_count++;
+}
+
+// Is the case just run worth calibrating: new tuples, on a path that hasn't failed calibration before
+static int new_path(uint32_t exec_hash){
+    return check_new_bits(fuzz.virgin_bits, fuzz.trace_bits) > 1 && !was_jettisoned(exec_hash);
+}
+
 // worker thread, generate cases and sends them
 void * worker(void * worker_args){
     struct worker_args *thread_info = (struct worker_args *)worker_args;
     printf("[.] Worker %u alive\n", thread_info->thread_id);
 
-    int deterministic = 1;
+    self = thread_info;
+    self->tid = (int)syscall(SYS_gettid);
+    affinity_pin_worker(thread_info->thread_id - 1);
+    stats = &worker_stats[thread_info->thread_id - 1];
+    timing_bind(&worker_timing[thread_info->thread_id - 1]);
+    ring_init(&self->ring, ring_bytes, ring_cases);
 
     // Use the PID as the prefix for generation
     char prefix[25];
@@ -356,85 +1063,99 @@ void * worker(void * worker_args){
 
     // Testcases
     testcase_t * cases = 0x00;
-    testcase_t * entry = 0x00;
+    testcase_t seed = {0, NULL, 0x00};
+    testcase_t * unit, * seed_p; // a unit of seeds from the coordinator
+    struct sched_unit work = {NULL, 0, 0}; // a unit of deterministic work
+    const struct corpus_entry * entry;
+    unsigned long i, n;
 
     uint32_t exec_hash;
     int r;
 
-    if(fuzz.shm_id > 0){
-        printf("[.] Trace enabled\n");
-        memset(fuzz.virgin_bits, 255, MAP_SIZE);
-        fuzz.trace_bits = setup_shm(fuzz.shm_id);
-    }
-
-    if(fuzz.shm_id > 0 && fuzz.gen == RADAMSA){
-        cases = load_testcases(fuzz.in_dir, ""); // load all cases from the provided dir
-        entry = cases;
-
+    // when resuming or after a restart, the virgin map already covers the seeds
+    if(fuzz.tracing && fuzz.gen == RADAMSA && !resume && target_gen == 0){
         if(fuzz.trace_bits == 0){
+            ring_free(&self->ring);
             return NULL;
         }
 
-        // A server crash in calibration is not handled gracefully, this needs to be tidied up
-        while(entry){
-            memset(fuzz.trace_bits, 0x00, MAP_SIZE);
-            if(fuzz.send(fuzz.host, fuzz.port, entry) < 0){
+        // A server crash in calibration is not handled gracefully, this needs to be tidied up.
+        // Seeds are calibrated but not trimmed, they are the user's and stay as given in the shared corpus
+        for(i = 0, n = corpus_count(); i < n; i++){
+            // the seeds are shared and read-only, send callbacks are allowed to tamper with the case
+            entry = corpus_get(i);
+            seed.len = entry->len;
+            ft_malloc(seed.len, seed.data);
+            memcpy(seed.data, entry->data, seed.len);
+
+            if(run_case(&seed, &exec_hash) < 0){
                 fatal("[!] Failure in calibration\n");
             }
 
-            exec_hash = wait_for_bitmap(fuzz.trace_bits);
             if(exec_hash > 0){
-                if(has_new_bits(fuzz.virgin_bits, fuzz.trace_bits) > 1){
-                    r = calibrate_case(entry, fuzz.trace_bits);
-                    if(r == 0)
-                        cases_jettisoned++;
+                if(new_path(exec_hash)){
+                    r = calibrate_case(&seed, fuzz.trace_bits, &exec_hash);
+                    if(r == -1){
+                        fatal("[!] Failure in calibration\n");
+                    }
+                    else if(r == 0)
+                        COUNT(STAT_JETTISONED);
                     else{
-                        paths++;
+                        COUNT_PATH();
                     }
                 }
             }
-            entry = entry->next;
-            cases_sent++;
+            free(seed.data);
+            COUNT(STAT_SENT);
         }
-        printf("\n[.] Loaded Paths: %lu Jettisoned: %lu\n", paths, cases_jettisoned);
-        free_testcases(cases);
+        printf("\n[.] Loaded Paths: %lu Jettisoned: %lu Stability: %.02f%%\n", stat_total(STAT_PATHS),
+            stat_total(STAT_JETTISONED), stability());
     }
 
     while(1){
+        if(pull_paths() < 0 && check_stop(NULL, -1) < 0)
+            goto cleanup;
+
         // generate the test cases
         if(fuzz.gen == BLAB){
             cases = generator_blab(CASE_COUNT, fuzz.grammar, fuzz.tmp_dir, prefix);
         }
 
         else if(fuzz.gen == RADAMSA){
-            // Perform some deterministic mutations before going off to radamsa.
-            // currently limited to the first thread.
-            if(deterministic == 1 && thread_info->thread_id == 1){
-                testcase_t * orig_cases = load_testcases(fuzz.in_dir, ""); // load all cases from the provided dir
-                testcase_t * orig_entry = orig_cases;
-
-                while(orig_entry){
-                    if(determ_fuzz(orig_entry->data, orig_entry->len) < 0){
-                        free_testcases(orig_cases);
-                        goto cleanup;
-                    }
-                    orig_entry = orig_entry->next;
-
-                    if(stop < 0){
-                        break;
-                    }
+            // deterministic work comes before radamsa, this worker's own or stolen from a busy one
+            if(!sched_next(thread_info->thread_id - 1, &work) && run_determ && coord_on() && coord_units){
+                // the coordinator shares its seeds out between the workers a unit at a time
+                if((unit = coord_work()) == NULL)
+                    coord_units = 0;
+                for(seed_p = unit; seed_p; seed_p = seed_p->next){
+                    adopt_case(seed_p);
+                    determ_queue(seed_p->data, seed_p->len);
                 }
-                free_testcases(orig_cases);
-
-                deterministic = 0;
-                if(fuzz.shm_id)
-                    printf("[.] Deterministic mutations completed, sent: %lu paths: %lu\n", cases_sent, paths);
-                else
-                    printf("[.] Deterministic mutations completed, sent: %lu\n", cases_sent);
-
-                if(stop < 0) // an error or crash occured during the deteministic steps
-                    break;
+                free_testcases(unit);
+                if(unit)
+                    continue;
+            }
+            else if(work.seed){
+                uint32_t hash = work.seed->hash; // the seed is gone once its last unit is done
+
+                // a unit cut short by a crash or a stop isn't done, what's left of it goes back to be rerun
+                if((r = determ_run(&work)) < 0)
+                    sched_retry(thread_info->thread_id - 1, &work);
+                else if(sched_done(&work)){
+                    if(fork_workers)
+                        printf("[.] Worker %u completed its deterministic mutations\n", thread_info->thread_id);
+                    else if(fuzz.tracing)
+                        printf("[.] Deterministic mutations completed, sent: %lu paths: %lu stability: %.02f%%\n",
+                            stat_total(STAT_SENT), stat_total(STAT_PATHS), stability());
+                    else
+                        printf("[.] Deterministic mutations completed, sent: %lu\n", stat_total(STAT_SENT));
+                }
+                if(seed_progress && r >= 0)
+                    publish_progress(hash);
+                work.seed = NULL;
 
+                if(r < 0) // an error or crash occured during the deteministic steps
+                    goto cleanup;
                 continue;
             }
 
@@ -448,88 +1169,221 @@ void * worker(void * worker_args){
 
 cleanup:
     printf("[!] Thread %d exiting\n", thread_info->thread_id);
+    ring_free(&self->ring);
     return NULL;
 }
 
-// Perform determisistic mutations, id and max paramters for splitting work load across threads
-int determ_fuzz(char * data, unsigned long len){ // }, unsigned int id){
-    unsigned long max = len << 3;
-    unsigned long offset = 0;
+// Queue the deterministic stage of a case on the calling worker, ahead of the rest of its work.
+// Cases that already completed theirs (in this or a resumed campaign) are skipped
+void determ_queue(const char * data, unsigned long len){
+    uint32_t hash = case_hash(data, len);
+
+    if(!sched_is_done(hash))
+        sched_add(self ? self->thread_id - 1 : 0, data, len, hash, 0, SCHED_COPY);
+}
+
+// Perform one unit of deterministic mutations, walking bit flips over part of a seed. If a batch
+// fails, work->start is left at that batch so the unit can be rerun from there
+int determ_run(struct sched_unit * work){
     unsigned long determ_batch_size = strtol(CASE_COUNT, NULL, 10);
+    unsigned long offset, count;
+    uint32_t parent = parent_hash;
+    testcase_t * cases;
+    int ret = 0;
 
     if(determ_batch_size == 0){
         fatal("[!] determ_batch_size strtol returned 0\n");
     }
 
-    testcase_t * cases;
-
-    if(max < determ_batch_size){
-        cases = generate_swbitflip(data, len, offset, max);
-        if(send_cases(cases)<0){
-            return -1;
+    parent_hash = work->seed->hash;
+    for(offset = work->start; offset < work->end; offset += count){
+        count = MIN(determ_batch_size, work->end - offset);
+        cases = generate_swbitflip(work->seed->data, work->seed->len, offset, count);
+        if(send_cases(cases) < 0){
+            work->start = offset;
+            ret = -1;
+            break;
         }
     }
-    else{
-        unsigned long i = 0;
+    parent_hash = parent;
 
-        while(i < (max/determ_batch_size)){
-            cases = generate_swbitflip(data, len, offset, determ_batch_size);
-            if(send_cases(cases) < 0){
-                return -1;
-            }
-            offset = offset+determ_batch_size;
-            i++;
-        }
-        // generate remainder
-        if(max % determ_batch_size > 0){
-            cases = generate_swbitflip(data, len, offset, max % determ_batch_size);
-            if(send_cases(cases) < 0){
-                return -1;
-            }
-        }
+    return ret;
+}
+
+// Append a new path to the corpus archive, along with where it came from and how long it took to run
+static void archive_case(testcase_t * entry, uint32_t exec_hash, uint64_t exec_us){
+    struct archive_entry meta;
+
+    memset(&meta, 0x00, sizeof(meta));
+    meta.hash = case_hash(entry->data, entry->len);
+    meta.parent = parent_hash;
+    meta.exec_hash = exec_hash;
+    meta.exec_us = exec_us;
+    archive_add(&corpus, NULL, entry->data, entry->len, &meta);
+}
+
+// Save a new path to the corpus, and publish it to the other instances if it was found here
+static void keep_path(testcase_t * entry, uint32_t exec_hash, uint64_t exec_us, int publish){
+    if(save_case(entry->data, entry->len, exec_hash, fuzz.in_dir) < 0)
+        return;
+
+    if(fuzz.gen == RADAMSA)
+        corpus_add(entry->data, entry->len, case_hash(entry->data, entry->len));
+    if(corpus_path)
+        archive_case(entry, exec_hash, exec_us);
+    if(sync_opts.dir && publish)
+        sync_publish(entry->data, entry->len, exec_hash);
+    if(coord_on() && publish)
+        coord_publish(entry->data, entry->len, exec_hash);
+}
+
+/*
+ * Run a case published by another instance and keep it if it finds something new here. Returns 1
+ * if it was kept, 0 if not and -1 if the target went down.
+ */
+int import_case(testcase_t * testcase){
+    uint32_t exec_hash, parent;
+    int r;
+
+    if(run_case(testcase, &exec_hash) < 0)
+        return -1;
+    COUNT(STAT_SENT);
+
+    if(exec_hash == 0 || !new_path(exec_hash))
+        return 0;
+
+    if((r = calibrate_case(testcase, fuzz.trace_bits, &exec_hash)) <= 0){
+        if(r == 0)
+            COUNT(STAT_JETTISONED);
+        return r;
     }
 
+    COUNT_PATH();
+    parent = parent_hash;
+    parent_hash = 0; // not mutated from anything here
+    keep_path(testcase, exec_hash, last_exec_us, 0);
+    parent_hash = parent;
+    return 1;
+}
+
+// Add a case from elsewhere to the seeds as it is, used when there is no coverage to judge it by
+int adopt_case(testcase_t * testcase){
+    uint32_t hash = case_hash(testcase->data, testcase->len);
+
+    if(fuzz.in_dir == NULL || save_case(testcase->data, testcase->len, hash, fuzz.in_dir) < 0)
+        return 0;
+    if(fuzz.gen == RADAMSA)
+        corpus_add(testcase->data, testcase->len, hash);
+    return 1;
+}
+
+// Pick up the paths other instances (--sync) and the rest of the farm (--worker) found, when due
+int pull_paths(void){
+    if(sync_opts.dir && sync_due() && sync_import(import_case) < 0)
+        return -1;
+    if(coord_on() && coord_due() && coord_sync(fuzz.tracing ? fuzz.virgin_bits : NULL,
+            fuzz.tracing ? import_case : adopt_case) < 0)
+        return -1;
     return 0;
 }
 
+// Set the global stop. Returns 1 if this call stopped fuzzing, 0 if something else already had
+int stop_fuzzing(void){
+    return atomic_exchange(&shared->stop, 1) == 0;
+}
+
+// Sum of one counter over every worker, plus whatever a resumed campaign started with
+unsigned long stat_total(int stat){
+    unsigned long total = stats_base[stat] + atomic_load_explicit(&orphan_stats.count[stat], memory_order_relaxed);
+    int i;
+
+    for(i = 0; worker_stats && i < worker_count; i++)
+        total += atomic_load_explicit(&worker_stats[i].count[stat], memory_order_relaxed);
+
+    return total;
+}
+
+// One worker's count of a counter
+unsigned long stat_worker(int worker, int stat){
+    return atomic_load_explicit(&worker_stats[worker].count[stat], memory_order_relaxed);
+}
+
+// Write the calling worker's ring of recent cases to <output dir>/<tid>.ring
+static void spool_ring(void){
+    char path[PATH_MAX];
+    int n;
+
+    if(self == NULL || self->ring.count == 0)
+        return;
+
+    snprintf(path, PATH_MAX, "%s/%d.ring", output_dir, self->tid);
+    if((n = ring_flush(&self->ring, path)) > 0)
+        printf("[.] Saved the last %d cases sent by worker %u to %s\n", n, self->thread_id, path);
+    self->ring.count = 0; // once is enough
+}
+
 // Send all cases in a struct. return -1 if any failure, otherwise 0. Frees the supplied cases struct
 // and updates global counters.
 int send_cases(void * cases){
     int ret = 0, r = 0;
     testcase_t * entry = cases;
     uint32_t exec_hash;
+    uint64_t exec_us = 0, start;
+    unsigned long index = 0;
 
     while(entry){
+        index++;
+        if(self)
+            self->inflight = index;
+
+        if(atomic_load_explicit(&shared->stop, memory_order_acquire)){
+            // don't keep sending into a dead target, check_stop() spools the batch
+            if(index == 1){
+                // nothing from this batch went out, but the ring may hold what did it
+                if(self)
+                    self->inflight = 0;
+                if(!atomic_load_explicit(&shared->timeout_stop, memory_order_acquire))
+                    spool_ring();
+                free_testcases(cases);
+                return -1;
+            }
+            break;
+        }
+
         if(entry->len == 0){
             // no data in test case, go to next one. Radamsa will generate null
             // testcases sometimes...
             entry = entry->next;
             continue;
         }
-        if(fuzz.shm_id){
-            memset(fuzz.trace_bits, 0x00, MAP_SIZE);
-            ret = fuzz.send(fuzz.host, fuzz.port, entry);
+        if(fuzz.tracing){
+            ret = run_case(entry, &exec_hash);
             if(ret < 0)
                 break;
+            exec_us = last_exec_us;
 
-            exec_hash = wait_for_bitmap(fuzz.trace_bits);
             if(exec_hash > 0){
-                if(has_new_bits(fuzz.virgin_bits, fuzz.trace_bits) > 1){
-                    r = calibrate_case(entry, fuzz.trace_bits);
+                if(new_path(exec_hash)){
+                    r = calibrate_case(entry, fuzz.trace_bits, &exec_hash);
+                    if(r == 1){
+                        // shrink the case before it becomes a seed for everything after it
+                        r = trim_case(entry, exec_hash);
+                    }
+
                     if(r == -1){
-                        // crash during calibration?
+                        // crash during calibration or trimming?
                         ret = r;
                         break;
                     }
                     else if(r == 0){
-                        cases_jettisoned++;
+                        COUNT(STAT_JETTISONED);
                     }
                     else{
-                        paths++; // new case! save and perform some deterministic fuzzing
-                        save_case(entry->data, entry->len, exec_hash, fuzz.in_dir);
+                        COUNT_PATH(); // new case! save and perform some deterministic fuzzing
+                        keep_path(entry, exec_hash, exec_us, 1);
 
-                        if(fuzz.gen != BLAB){
-                            determ_fuzz(entry->data, entry->len); // attention defecit fuzzing
+                        if(fuzz.gen != BLAB && run_determ){
+                            determ_queue(entry->data, entry->len); // attention defecit fuzzing, up next
                         }
                     }
                 }
@@ -537,22 +1391,32 @@ int send_cases(void * cases){
         }
         else {
             // no instrumentation
-            ret = fuzz.send(fuzz.host, fuzz.port, entry);
+            if(self)
+                ring_push(&self->ring, entry->data, entry->len);
+            ret = rate_send(entry);
 
-            if(ret < 0)
+            if(ret < 0){
+                COUNT(STAT_SEND_FAILS);
                 break;
+            }
         }
 
         entry = entry->next;
-        cases_sent++;
+        COUNT(STAT_SENT);
     }
 
+    start = timing_start();
     if(check_stop(cases, ret)<0){
         free_testcases(cases);
         return -1;
     }
+    timing_end(STAGE_CHECK, start);
 
+    if(self)
+        self->inflight = 0;
+    start = timing_start();
     free_testcases(cases);
+    timing_end(STAGE_FREE, start);
     return 0;
 }
 
@@ -561,21 +1425,21 @@ int send_cases(void * cases){
 int check_stop(void * cases, int result){
     int ret = result;
 
-    // if global stop, save cases
-    pthread_mutex_lock(&runlock);
-    if(stop == 1){
-        // save cases
-        if(!timeout_stop){
+    // if global stop, save cases. Every worker spools to files of its own, no lock needed
+    if(atomic_load_explicit(&shared->stop, memory_order_acquire)){
+        if(!atomic_load_explicit(&shared->timeout_stop, memory_order_acquire)){
             save_testcases(cases, output_dir);
+            spool_ring();
         }
-        pthread_mutex_unlock(&runlock);
         return -1;
     }
-    pthread_mutex_unlock(&runlock);
 
     // If process id is supplied, check it exists and set stop if it doesn't
     if(check_pid > 0){
-        if((pid_exists(check_pid)) == -1){
+        if(shared->pidfd_watch){
+            ret = shared->target_dead ? -1 : 0;
+        }
+        else if((pid_exists(check_pid)) == -1){
             ret = -1;
         }
         else{
@@ -583,11 +1447,11 @@ int check_stop(void * cases, int result){
         }
     }
 
-    if(fuzz.check_script){
-        int r;
-        r = run_check(fuzz.check_script);
-        if( r != 1){
-            printf("[!] Check script %s returned %d, stopping\n", fuzz.check_script, r);
+    // no point probing a target whose PID is already gone
+    if((health.probe || health.coproc || fuzz.check_script) && !(check_pid > 0 && ret == -1)){
+        // shared with any other worker checking at the same time, see health.c
+        if(health_check() != 1){
+            printf("[!] Target failed its health check, stopping\n");
             ret = -1;
         }
         else{
@@ -597,48 +1461,201 @@ int check_stop(void * cases, int result){
 
     if(ret == -1){
         // We have experienced a crash. set the global stop var
-        pthread_mutex_lock(&runlock);
-        stop = 1;
+        stop_fuzzing();
         save_testcases(cases, output_dir);
-        pthread_mutex_unlock(&runlock);
+        spool_ring();
     }
 
     return ret;
 }
 
-/* Calibrate a new testcase. Returns 1 if the testcase behaves deterministically, 0 if it does not
- * EG: has variable behaviour. Without this, non deterministic features would cause a bunch of
- * tiny, useless test cases. Return -1 on failure. Timeout on waiting for the bitmap to stop changing
- * is an immediate 0.
+/* Send a testcase with tracing enabled and wait for the bitmap to settle. The hash of the stable
+ * part of the bitmap (variable bytes masked out) is stored in exec_hash, or 0 if the bitmap never
+ * settled. Returns the result of the send.
  */
-int calibrate_case(testcase_t * testcase, uint8_t * trace_bits){
-    uint32_t hash, tmp_hash, i;
-
-    memset(trace_bits, 0x00, MAP_SIZE);
-    if(fuzz.send(fuzz.host, fuzz.port, testcase) < 0){
-        return -1;
+int run_case(testcase_t * testcase, uint32_t * exec_hash){
+    struct timespec start, end;
+    uint64_t wait_start;
+    int ret;
+
+    memset(fuzz.trace_bits, 0x00, MAP_SIZE);
+    if(self)
+        ring_push(&self->ring, testcase->data, testcase->len);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = rate_send(testcase);
+    if(ret < 0){
+        COUNT(STAT_SEND_FAILS);
+        return ret;
     }
 
-    hash = wait_for_bitmap(trace_bits); // check null
-    if(hash == 0 || hash == NULL_HASH) // unstable test case, bitmap still changing after 2 seconds, or no bitmap change
+    wait_start = timing_start();
+    *exec_hash = fuzz.wait(fuzz.trace_bits);
+    timing_end(STAGE_TRACE, wait_start);
+    if(*exec_hash == 0)
+        COUNT(STAT_HANGS); // the bitmap was still changing when wait gave up
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    last_exec_us = (end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000;
+    if(*exec_hash != 0 && *exec_hash != NULL_HASH)
+        *exec_hash = mask_bitmap(fuzz.trace_bits, fuzz.var_bytes);
+
+    return ret;
+}
+
+/* Calibrate a new testcase. trace_bits must hold the bitmap from the execution that flagged the case
+ * as interesting, which is used as the first calibration run. The case is re-sent until CAL_CONFIRM
+ * consecutive runs agree on the stable part of the bitmap. Bytes that differ between runs are flagged
+ * in fuzz.var_bytes and masked out of all future hashes, so a single noisy edge no longer throws the
+ * case away. Returns 1 if the case settled, storing the stable hash in exec_hash, 0 if it did not
+ * (or only hit variable edges) and -1 on failure. The path of a case that did not settle is
+ * remembered, and new_path() turns it down from then on.
+ */
+int calibrate_case(testcase_t * testcase, uint8_t * trace_bits, uint32_t * exec_hash){
+    static uint8_t first_trace[MAP_SIZE];
+    uint32_t hash, path, tmp_hash, i, j, agree = 0;
+
+    path = hash = mask_bitmap(trace_bits, fuzz.var_bytes);
+    if(hash == NULL_HASH)
         return 0;
 
-    for(i = 0; i < 4; i++){
-        memset(trace_bits, 0x00, MAP_SIZE);
-        if(fuzz.send(fuzz.host, fuzz.port, testcase) < 0){
+    // one-shot breakpoints never fire twice, the first run is all there is
+    if(fuzz.bp_cov){
+        has_new_bits(fuzz.virgin_bits, trace_bits);
+        *exec_hash = hash;
+        return 1;
+    }
+
+    memcpy(first_trace, trace_bits, MAP_SIZE);
+
+    for(i = 1; i < CAL_CYCLES_MAX && agree < CAL_CONFIRM; i++){
+        COUNT(STAT_RERUNS);
+        if(run_case(testcase, &tmp_hash) < 0){
             return -1;
         }
-        tmp_hash = wait_for_bitmap(trace_bits);
-        if(tmp_hash != hash){ // non-deterministic testcase
+
+        // bitmap still changing after 2 seconds, or empty (the connection dropped, the target restarting).
+        // Neither says anything about which bytes vary, so var_bytes is left alone
+        if(tmp_hash == 0 || tmp_hash == NULL_HASH){
+            jettison(path);
             return 0;
         }
+
+        if(tmp_hash == hash){
+            agree++;
+            continue;
+        }
+
+        // the runs disagree, flag the differing bytes as variable and start agreeing again
+        for(j = 0; j < MAP_SIZE; j++){
+            if(first_trace[j] != trace_bits[j]){
+                if(!fuzz.var_bytes[j]){
+                    fuzz.var_bytes[j] = 1;
+                    fuzz.var_byte_count++;
+                }
+                first_trace[j] = 0;
+            }
+        }
+
+        hash = hash32(first_trace, MAP_SIZE, HASH_CONST);
+        agree = 0;
+    }
+
+    if(agree < CAL_CONFIRM || hash == NULL_HASH){
+        jettison(path);
+        return 0;
+    }
+
+    // with the unstable bytes masked, does the case still hit anything new?
+    memcpy(trace_bits, first_trace, MAP_SIZE);
+    if(has_new_bits(fuzz.virgin_bits, trace_bits) < 2){
+        jettison(path);
+        return 0;
     }
 
-    // timing and case trimming should eventually go here
+    // timing should eventually go here, trimming is done by trim_case()
+    *exec_hash = hash;
 
     return 1;
 }
 
+// Percentage of the seen bitmap bytes that behave deterministically.
+double stability(void){
+    uint32_t i, seen = 0;
+
+    for(i = 0; i < MAP_SIZE; i++){
+        if(fuzz.virgin_bits[i] != 0xff || fuzz.var_bytes[i])
+            seen++;
+    }
+
+    if(seen == 0)
+        return 100.0;
+
+    return 100.0 - ((double)fuzz.var_byte_count * 100.0) / seen;
+}
+
+/* Trim a calibrated testcase, loosely based on AFL's trim_case(). Blocks of decreasing size are
+ * removed from the case and the removal is kept if the execution hash does not change. The testcase
+ * is shrunk in place. Returns 1 on success and -1 on failure (EG: the target went away mid-trim).
+ */
+int trim_case(testcase_t * testcase, uint32_t exec_hash){
+    unsigned long len_p2, remove_len, remove_pos, trim_avail, orig_len;
+    uint32_t hash;
+    char * trimmed;
+    testcase_t candidate;
+
+    if(testcase->len < TRIM_MIN_BYTES * 2 || fuzz.bp_cov) // one-shot breakpoints can't be re-run
+        return 1;
+
+    orig_len = testcase->len;
+    ft_malloc(testcase->len, trimmed);
+    candidate.data = trimmed;
+    candidate.next = 0;
+
+    len_p2 = next_p2(testcase->len);
+    remove_len = MAX(len_p2 / TRIM_START_STEPS, TRIM_MIN_BYTES);
+
+    while(remove_len >= MAX(len_p2 / TRIM_END_STEPS, TRIM_MIN_BYTES)){
+        remove_pos = remove_len;
+
+        while(remove_pos < testcase->len){
+            if(shared->stop == 1)
+                goto done;
+
+            trim_avail = MIN(remove_len, testcase->len - remove_pos);
+
+            // build the case without the [remove_pos, remove_pos + trim_avail) block
+            memcpy(trimmed, testcase->data, remove_pos);
+            memcpy(trimmed + remove_pos, testcase->data + remove_pos + trim_avail,
+                testcase->len - remove_pos - trim_avail);
+            candidate.len = testcase->len - trim_avail;
+
+            COUNT(STAT_RERUNS);
+            if(run_case(&candidate, &hash) < 0){
+                free(trimmed);
+                return -1;
+            }
+
+            if(hash == exec_hash){
+                // the block made no difference to the path, drop it for good
+                memmove(testcase->data + remove_pos, testcase->data + remove_pos + trim_avail,
+                    testcase->len - remove_pos - trim_avail);
+                testcase->len -= trim_avail;
+            }
+            else{
+                remove_pos += remove_len;
+            }
+        }
+
+        remove_len >>= 1;
+    }
+
+done:
+    if(testcase->len < orig_len)
+        printf("[.] Trimmed case from %lu to %lu bytes\n", orig_len, testcase->len);
+
+    free(trimmed);
+    return 1;
+}
+
 int pid_exists(int pid){
     struct stat s;
     char path[PATH_MAX];
@@ -654,11 +1671,84 @@ int pid_exists(int pid){
     return 0;
 }
 
-int run_check(char * script){
+/*
+ * Watch the target PID with a pidfd, so its death is noticed the moment it happens rather than
+ * at the end of the next batch. The index of the case each worker had in flight at that moment
+ * is reported and written to <output dir>/inflight. Falls back to polling /proc from check_stop()
+ * on kernels without pidfd_open().
+ */
+void * pid_watcher(void * args){
+    unsigned int gen = (unsigned int)(unsigned long)args;
+    struct pollfd pfd;
+    char path[PATH_MAX];
+    FILE * fp;
+    int i;
+
+    pfd.fd = syscall(SYS_pidfd_open, check_pid, 0);
+    if(pfd.fd < 0){
+        printf("[!] pidfd_open failed: %s, falling back to /proc polling\n", strerror(errno));
+        return NULL;
+    }
+    pfd.events = POLLIN;
+    shared->pidfd_watch = 1;
 
-    if(access(script, X_OK) < 0){
-        fatal("[!] Error accessing check script %s: %s\n", script, strerror(errno));
+    while(poll(&pfd, 1, -1) < 0 && errno == EINTR);
+    close(pfd.fd);
+
+    // the supervisor has already restarted the target this watcher was started for
+    if(gen != target_gen)
+        return NULL;
+
+    // snapshot what was in flight before the workers notice and start spooling
+    unsigned long inflight[worker_count];
+    for(i = 0; i < worker_count; i++)
+        inflight[i] = worker_info[i].inflight;
+    shared->target_dead = 1;
+
+    if(!stop_fuzzing()) // already stopping for some other reason
+        return NULL;
+
+    printf("\n[!!] PID %d exited. Check for server crash\n", check_pid);
+
+    snprintf(path, PATH_MAX, "%s/inflight", output_dir);
+    fp = fopen(path, "a");
+    for(i = 0; i < worker_count; i++){
+        if(inflight[i] == 0){
+            printf("[!!] Worker %d was between batches\n", i + 1);
+            continue;
+        }
+        printf("[!!] Worker %d had case %d-%lu in flight\n", i + 1, worker_info[i].tid, inflight[i]);
+        if(fp)
+            fprintf(fp, "%d-%lu\n", worker_info[i].tid, inflight[i]);
     }
+    if(fp)
+        fclose(fp);
+
+    return NULL;
+}
+
+/*
+ * Run the --restart command and wait for the target to pass its health check.
+ * Returns 0 once it is up, -1 if it never came up.
+ */
+int restart_target(){
+    int waited;
+
+    if(system(restart_cmd) != 0){
+        printf("[!] Restart command %s failed\n", restart_cmd);
+    }
+
+    for(waited = 0; waited < BISECT_BOOT_MS; waited += 100){
+        if(health_check() == 1)
+            return 0;
+        usleep(100000);
+    }
+
+    printf("[!] Target did not come back up within %dms of a restart\n", BISECT_BOOT_MS);
+    return -1;
+}
+
+int run_check(char * script){
 
     int out_pipe[2];
     int err_pipe[2];
@@ -732,22 +1822,52 @@ void help(){
     printf("\t-k\t\tNumber of seconds before fuzzing stops\n");
     printf("\t-o\t\tOutput directory for crashes REQUIRED\n");
     printf("\t-t\t\tNumber of worker threads\n");
-    printf("\t--trace\t\tUse AFL style tracing. Single threaded only, see README.md\n\n");
+    printf("\t--trace\t\tUse AFL style tracing. Single threaded only, see README.md\n");
+    printf("\t--resume\tResume the campaign checkpointed in the output directory\n");
+    printf("\t--bp-cov\tBreakpoint coverage of the uninstrumented target given with -c, see README.md\n");
+    printf("\t--bp-blocks\tFile of block addresses for --bp-cov, instead of function symbols\n");
+    printf("\t--ring-cases\tRecently sent cases each thread keeps for the crash ring, 0 to disable (default %d)\n", RING_CASES);
+    printf("\t--ring-bytes\tMemory each thread's crash ring may use (default %d)\n", RING_BYTES);
+    printf("\t--sync\t\tDirectory shared with other instances for corpus synchronisation, see README.md\n");
+    printf("\t-M\t\tName of this instance in the sync directory, runs the deterministic stages\n");
+    printf("\t-S\t\tAs -M, leaves the deterministic stages to the -M instance\n");
+    printf("\t--coordinator\tRun as the coordinator of a fuzzing farm on this port, see README.md\n");
+    printf("\t--worker\thost:port of the coordinator to take work from and report to\n\n");
+    printf("\t--cpus\t\tCPU list to pin the worker threads to, eg 0-3,8\n");
+    printf("\t--target-cpus\tCPU list to pin the target to, or 'siblings' of the worker CPUs\n");
+    printf("\t--rate-auto\tAdapt the send rate and concurrency to the target, see README.md\n");
+    printf("\t--max-rate\tMost cases to send per second, over all threads\n");
+    printf("\t--rate-latency\tMean send latency in ms --rate-auto takes as overload (default 100)\n");
+    printf("\t--rate-response\tInclude the wait for the first response byte in the latency\n");
+    printf("\t--fork-workers\tRun each worker as a process of its own instead of a thread\n");
+    printf("\t--metrics-port\tServe Prometheus metrics on this port of 127.0.0.1\n\n");
     printf("Generation Options:\n");
     printf("\t--blab\t\tUse Blab for testcase generation\n");
     printf("\t-g\t\tBlab grammar to use - eg /usr/share/blab/html.blab\n");
     printf("\t--radamsa\tUse Radamsa for testcase generation\n");
-    printf("\t--directory\tDirectory with original test cases\n\n");
+    printf("\t--directory\tDirectory with original test cases, or a corpus archive\n");
+    printf("\t--compress\tCompress new paths added to a corpus archive\n\n");
     printf("Connection Options:\n");
-    printf("\t-h\t\tIP of host to connect to or path to unix domain socket REQUIRED\n");
+    printf("\t-h\t\tIP of host to connect to, path to unix domain socket or desock ring name REQUIRED\n");
     printf("\t-p\t\tPort to connect to REQUIRED for TCP and UDP\n");
-    printf("\t-P\t\tProtocol to use (tcp,udp,unix) REQUIRED\n");
+    printf("\t-P\t\tProtocol to use (tcp,udp,unix,shm) REQUIRED\n");
     printf("\t--ssl\t\tUse SSL for the connection\n");
     printf("\t--destroy\tUse TCP_REPAIR mode to immediately destroy the connection, do not send FIN/RST.\n\n");
     printf("Monitoring Options:\n");
     printf("\t-c\t\tPID to check - Fuzzotron will halt if this PID dissapears\n");
-    printf("\t-m\t\tLogfile to monitor\n");
-    printf("\t-r\t\tRegex to use with above logfile\n");
+    printf("\t-m\t\tLogfile to monitor, can be given more than once\n");
+    printf("\t-r\t\tRegex to use with above logfile, one per -m or one for all of them\n");
+    printf("\t--kmsg\t\tStop when the kernel logs a segfault or general protection fault in a process with this name\n");
+    printf("\t--kmsg-cgroup\tAs --kmsg, for any process in this cgroup\n");
+    printf("\t--sanitizer\tRead ASan/UBSan reports from the -m logs and file crashes by stack signature\n");
     printf("\t-z\t\tCheck script to execute. Should return 1 on server being okay and anything else otherwise.\n");
+    printf("\t--probe\t\tBuilt-in health probe: tcp[:host][:port], udp[:host][:port] or unix[:path]\n");
+    printf("\t--probe-send\tRequest the probe sends, C escapes allowed. Required for udp\n");
+    printf("\t--probe-expect\tString the probe response must contain\n");
+    printf("\t--probe-interval\tMilliseconds between background probes, 0 to probe only after each batch (default %d)\n", PROBE_INTERVAL_MS);
+    printf("\t--bisect\tAfter a crash, replay the spooled cases to find the crashing case or sequence\n");
+    printf("\t--restart\tCommand that (re)starts the target, used by --bisect\n");
+    printf("\t--target\tCommand to start the target with. Fuzzotron supervises it and restarts it after a crash\n");
+    printf("\t--check-coproc\tLong running check command, answers each 'check' line with a line starting with 1 when the target is up\n");
     exit(0);
 }
@@ -7,17 +7,46 @@
 #define FUZZOTRON_H
 
 #include <stdint.h>
+#include <stdatomic.h>
 #include "trace.h"
 #include "generator.h"
+#include "ring.h"
+#include "sched.h"
 
 // Tunables
 #define CASE_COUNT "100"
 #define CASE_DIR "/dev/shm/fuzzotron"
+#define CAL_CONFIRM 2 // calibration runs that must agree with the first before a case is accepted
+#define CAL_CYCLES_MAX 8 // give up calibrating a case after this many runs
+#define JETTISON_SLOTS 65536 // hashes of paths that failed calibration remembered, a power of 2
+#define TRIM_MIN_BYTES 4 // smallest block trim_case() will attempt to remove
+#define TRIM_START_STEPS 16 // initial block size is len / TRIM_START_STEPS
+#define TRIM_END_STEPS 1024 // final block size is len / TRIM_END_STEPS
+#define WORKER_RESTARTS_MAX 10 // times a --fork-workers process that died is restarted
 
 #define RADAMSA 0x01
 #define BLAB 0x02
 
-extern volatile int stop; // set to 1 to stop fuzzing
+/*
+ * State main, its threads and the workers act on. It's mapped shared before any worker starts, so
+ * with --fork-workers the worker processes see the same flags as main and the monitor threads.
+ */
+struct shared_state {
+    atomic_int stop; // set to 1 to stop fuzzing, see stop_fuzzing(). Workers spool their cases and exit
+    atomic_int timeout_stop; // set along with stop when the cases needn't be saved, the timeout or SIGINT
+    atomic_int target_dead; // set by pid_watcher() the moment the target exits
+    atomic_int pidfd_watch; // pid_watcher() is running, no need to poll /proc per batch
+    atomic_int campaign_over; // main has stopped for good, the timeout monitor and worker processes can go
+    atomic_int check_pid; // check_pid for worker processes, which don't see the supervisor restart the target
+    atomic_uint round; // --fork-workers, bumped by main to start the workers on each target lifetime
+    atomic_int parked; // --fork-workers, worker processes done with the current round
+    atomic_long last_path; // time the last new path was found, 0 for none yet
+    atomic_int booting; // the supervisor is waiting for the target to come up, failed probes aren't a crash
+};
+
+extern struct shared_state * shared;
+extern int check_pid; // PID of the target, 0 if not monitored
+extern char * output_dir; // directory for potential crashes
 
 struct fuzzer_args {
     int gen; // generator for the test cases. Blab, radamsa, custom etcetera.
@@ -26,30 +55,47 @@ struct fuzzer_args {
     char * tmp_dir; // temporary directory to store test cases
     char * host;
     char * check_script; // script to check server status. Must return 1 on server-up or anything else on server-down (crashed)
-    int protocol; // 1 == TCP, 2 == UDP, 3 == UNIX
+    int protocol; // 1 == TCP, 2 == UDP, 3 == UNIX, 4 == SHM (libdesock.so ring)
     int destroy; // Use TCP_REPAIR to destroy the connection, do not send a RST after the testcase
     int port;
     int is_tls;
     char * alpn;
 
     int32_t shm_id; // Shared memory address for AFL style tracing
+    int bp_cov; // Breakpoint based coverage of an uninstrumented target, see bpcov.c
+    char * bp_blocks; // optional file listing block addresses for bp_cov
+    int tracing; // set if either form of coverage is enabled
     uint8_t * trace_bits;
     uint8_t virgin_bits[MAP_SIZE];
+    uint8_t var_bytes[MAP_SIZE]; // bitmap bytes that have been seen to vary between runs of the same case
+    uint32_t var_byte_count;
+
+    int retry_busy; // SEND_BUSY is retried by the rate controller, don't report every refusal
+    int response_ms; // after sending, wait this long for the target to start responding, 0 not to wait
 
     int (*send)(char * host, int port, testcase_t * testcase); // pointer to method to send a packet.
+    uint32_t (*wait)(const void * trace_bits); // pointer to method waiting for the trace of a sent case
 };
 
 extern struct fuzzer_args fuzz;
 
-struct monitor_args {
-    char * file;
-    char * regex;
-};
+// Counters kept per worker, see COUNT(). STAT_RERUNS is calibration and trimming sending a case again,
+// which STAT_SENT leaves out so it stays a count of distinct cases
+enum { STAT_SENT, STAT_PATHS, STAT_JETTISONED, STAT_HANGS, STAT_SEND_FAILS, STAT_CRASHES, STAT_RERUNS, STAT_COUNT };
+
+// A worker's counters, on a cache line of their own so workers counting don't fight over it. Only
+// the owning thread writes them, the status loop adds them all up
+struct worker_stats {
+    atomic_ulong count[STAT_COUNT];
+} __attribute__((aligned(64)));
 
 // Worker args struct containing some thread information. Used for divvying up deterministic mutations amongst multiple threads.
 struct worker_args {
     unsigned int thread_id; // specific thread identifier
     unsigned int threads; // total number of threads
+    int tid; // kernel thread id, used as the file prefix by save_testcases()
+    volatile unsigned long inflight; // 1-based index of the case being sent in the current batch, 0 if none
+    struct crash_ring ring; // most recently sent cases, flushed to <output dir>/<tid>.ring on a crash
 };
 
 int main(int argc, char** argv);
@@ -57,13 +103,25 @@ void * call_monitor(void * arg);
 void * timer_job(void * args);
 void * worker(void * worker_args);
 int pid_exists(int pid);
+void * pid_watcher(void * args);
 void help();
 int run_check(char * script);
+int restart_target();
 int directory_exists(char * dir);
 int file_exists(char * file);
-int calibrate_case(testcase_t * testcase, uint8_t * trace_bits);
-int determ_fuzz(char * data, unsigned long len);
+int run_case(testcase_t * testcase, uint32_t * exec_hash);
+int calibrate_case(testcase_t * testcase, uint8_t * trace_bits, uint32_t * exec_hash);
+int trim_case(testcase_t * testcase, uint32_t exec_hash);
+double stability(void);
+void determ_queue(const char * data, unsigned long len);
+int determ_run(struct sched_unit * work);
 int send_cases(void * cases);
 int check_stop(void * cases, int result);
+int import_case(testcase_t * testcase);
+int adopt_case(testcase_t * testcase);
+int pull_paths(void);
+int stop_fuzzing(void);
+unsigned long stat_total(int stat);
+unsigned long stat_worker(int worker, int stat);
 
 #endif
@@ -18,6 +18,7 @@
 #include <fcntl.h>
 
 #include "generator.h"
+#include "timing.h"
 #include "util.h"
 
 // Executes radamsa and returns a linked list of test cases
@@ -28,10 +29,12 @@ testcase_t * generator_radamsa(char * count, char * testcase_dir, char * path, c
     int s;
     char output[PATH_MAX];
     testcase_t * testcase;
+    uint64_t start;
 
     snprintf(output, PATH_MAX, "%s/%s-%%n", path, prefix);
     char * argv[] = { "radamsa", "-n", count, "-r", "-o", output, testcase_dir, 0 };
 
+    start = timing_start();
     if((pid = fork()) == 0){
         execvp(argv[0], argv);
         exit(0);
@@ -41,8 +44,11 @@ testcase_t * generator_radamsa(char * count, char * testcase_dir, char * path, c
     }
     else
         waitpid(pid, &s, 0x00);
+    timing_end(STAGE_GENERATE, start);
     
+    start = timing_start();
     testcase = load_testcases(path, prefix);
+    timing_end(STAGE_LOAD, start);
     return testcase;
 }
 
@@ -52,11 +58,13 @@ testcase_t * generator_blab(char * count, char * grammar, char * path, char * pr
     int s;
     char output[PATH_MAX];
     testcase_t * testcase;
+    uint64_t start;
 
     snprintf(output, PATH_MAX, "%s/%s-%%n", path, prefix);      
 
     char * argv[] = { "blab", grammar, "-n", count , "-o", output, 0 };
 
+    start = timing_start();
     if((pid = fork()) == 0){
         execvp(argv[0], argv);
         exit(0);
@@ -67,17 +75,21 @@ testcase_t * generator_blab(char * count, char * grammar, char * path, char * pr
     }
     else
         waitpid(pid, &s, 0x00);
+    timing_end(STAGE_GENERATE, start);
     
+    start = timing_start();
     testcase = load_testcases(path, prefix);
+    timing_end(STAGE_LOAD, start);
 
     return testcase;
 }
 
 // single walking bit, returns a linked struct of testcases
-testcase_t * generate_swbitflip(char * data, unsigned long in_len, unsigned long offset, unsigned long count){
+testcase_t * generate_swbitflip(const char * data, unsigned long in_len, unsigned long offset, unsigned long count){
     unsigned long i = 0;
     char * output, * input;
     testcase_t * testcase, * entry;
+    uint64_t start = timing_start();
     ft_malloc(sizeof(testcase_t),testcase);
     entry = testcase;
 
@@ -111,6 +123,7 @@ testcase_t * generate_swbitflip(char * data, unsigned long in_len, unsigned long
     entry->next = 0;
 
     free(input);
+    timing_end(STAGE_GENERATE, start);
     return testcase;
 }
 
@@ -220,7 +233,8 @@ int save_testcases(testcase_t * cases, char * path){
     return i;
 }
 
-void save_case(char * data, unsigned long len, uint32_t hash, char * directory){
+// Save a new path as <directory>/<hash>. Returns 0 if it was written, -1 if it was already there
+int save_case(char * data, unsigned long len, uint32_t hash, char * directory){
     int fd;
     ssize_t w;
     char path[PATH_MAX];
@@ -231,8 +245,7 @@ void save_case(char * data, unsigned long len, uint32_t hash, char * directory){
         if(errno == EEXIST){
             // the filename is a hash of the execution hash, so if it exists we already have it!
             printf("[!] File %s already exists, ignoring\n", path);
-            close(fd);
-            return;
+            return -1;
         }
         else{
             fatal("[!] Could not open file %s: %s", path, strerror(errno));
@@ -245,6 +258,8 @@ void save_case(char * data, unsigned long len, uint32_t hash, char * directory){
         fatal("[!] write failed: %s", strerror(errno));
     }
     close(fd);
+
+    return 0;
 }
 
 int save_case_p(char * data, unsigned long len, char * prefix, char * directory){
@@ -253,7 +268,7 @@ int save_case_p(char * data, unsigned long len, char * prefix, char * directory)
     char path[PATH_MAX];
 
     snprintf(path, PATH_MAX, "%s/%s", directory, prefix);
-    fd = open(path, O_WRONLY | O_CREAT, 0644);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if(fd < 0){
         fatal("[!] Could not open file %s: %s", path, strerror(errno));
     }
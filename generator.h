@@ -24,10 +24,10 @@ typedef struct {
 
 testcase_t * generator_blab(char * count, char * grammar, char * path, char * prefix);
 testcase_t * generator_radamsa(char * count, char * testcase_dir, char * path, char * prefix);
-testcase_t * generate_swbitflip(char * input, unsigned long in_len, unsigned long offset, unsigned long count);
+testcase_t * generate_swbitflip(const char * input, unsigned long in_len, unsigned long offset, unsigned long count);
 testcase_t * load_testcases(char * path, char * prefix);
 int save_testcases(testcase_t * cases, char * path);
-void save_case(char * data, unsigned long len, uint32_t hash, char * directory);
+int save_case(char * data, unsigned long len, uint32_t hash, char * directory);
 int save_case_p(char * data, unsigned long len, char * prefix, char * directory);
 void free_testcases(testcase_t * cases);
 
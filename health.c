@@ -0,0 +1,459 @@
+/*
+ * File:   health.c
+ * Author: DoI
+ *
+ * Target health checks. A single probe thread is shared by all workers; it
+ * probes the target in the background every health.interval ms and on behalf
+ * of workers finishing a batch. Workers asking at the same time share one
+ * probe, so the number of checks no longer scales with the thread count.
+ *
+ * Checks are, in order of preference:
+ *  - a built-in TCP, UDP or unix socket probe, optionally sending a request
+ *    and looking for a string in the response
+ *  - a co-process started once, which is sent "check\n" and answers with a
+ *    line starting with '1' when the target is up
+ *  - the -z check script, forked per probe as before
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "fuzzotron.h"
+#include "health.h"
+#include "rate.h"
+#include "util.h"
+
+struct health_args health;
+
+static pthread_t probe_thread;
+// Between the probe thread and the workers, in shared memory so --fork-workers processes can ask too
+static struct probe_sync {
+    pthread_mutex_t lock;
+    pthread_cond_t wanted_cond; // wakes the probe thread
+    pthread_cond_t done_cond; // wakes workers waiting on a result
+    unsigned long started;
+    unsigned long done;
+    unsigned long wanted;
+    int healthy; // result of the last completed probe
+    int shutdown;
+} * ps = NULL;
+
+static char * probe_req = NULL; // unescaped health.send
+static size_t probe_req_len = 0;
+
+static pid_t coproc_pid = 0;
+static int coproc_in = -1; // write end, the co-process's stdin
+static int coproc_out = -1; // read end, the co-process's stdout
+
+/*
+ * Parse a --probe spec of the form type[:host][:port] or unix[:path]. The host
+ * and port default to the fuzzing target. Returns 0 on success, -1 otherwise.
+ */
+int parse_probe(char * spec){
+    char * type = strtok(spec, ":");
+    char * a = strtok(NULL, ":");
+    char * b = strtok(NULL, ":");
+
+    if(type == NULL)
+        return -1;
+
+    if(strcmp(type, "tcp") == 0)
+        health.probe = PROBE_TCP;
+    else if(strcmp(type, "udp") == 0)
+        health.probe = PROBE_UDP;
+    else if(strcmp(type, "unix") == 0)
+        health.probe = PROBE_UNIX;
+    else
+        return -1;
+
+    if(health.probe == PROBE_UNIX){
+        health.host = a;
+        return b ? -1 : 0;
+    }
+
+    if(b){
+        health.host = a;
+        health.port = atoi(b);
+    }
+    else if(a){
+        health.port = atoi(a);
+    }
+
+    return 0;
+}
+
+// Decode \n, \r, \t, \\ and \xHH in the probe request
+static char * unescape(char * in, size_t * out_len){
+    char * out;
+    size_t i = 0;
+
+    ft_malloc(strlen(in) + 1, out);
+    while(*in){
+        if(*in == '\\' && in[1]){
+            in++;
+            switch(*in){
+                case 'n': out[i++] = '\n'; break;
+                case 'r': out[i++] = '\r'; break;
+                case 't': out[i++] = '\t'; break;
+                case '0': out[i++] = '\0'; break;
+                case 'x':
+                    if(in[1] && in[2]){
+                        char hex[3] = {in[1], in[2], 0};
+                        out[i++] = (char)strtol(hex, NULL, 16);
+                        in += 2;
+                        break;
+                    }
+                    // fall through
+                default: out[i++] = *in; break;
+            }
+            in++;
+        }
+        else{
+            out[i++] = *in++;
+        }
+    }
+
+    *out_len = i;
+    return out;
+}
+
+// Refusals and timeouts a busy target gives, as in sender.c. A unix socket refuses only when nothing listens
+static int probe_busy_errno(int domain, int err){
+    if(domain == AF_UNIX)
+        return err == EAGAIN;
+    return err == ECONNREFUSED || err == ETIMEDOUT || err == EAGAIN;
+}
+
+// connect() with a timeout, returns the connected socket, PROBE_BUSY or -1
+static int probe_connect(int domain, int type, struct sockaddr * addr, socklen_t addr_len){
+    struct pollfd pfd;
+    int sock, r, err = 0;
+    socklen_t err_len = sizeof(err);
+
+    if((sock = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0){
+        fatal("[!] Error: Could not create socket: %s\n", strerror(errno));
+    }
+
+    if(connect(sock, addr, addr_len) < 0){
+        if(errno != EINPROGRESS){
+            err = errno;
+            close(sock);
+            return probe_busy_errno(domain, err) ? PROBE_BUSY : -1;
+        }
+
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        if((r = poll(&pfd, 1, PROBE_TIMEOUT_MS)) <= 0 ||
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0){
+            close(sock);
+            return r == 0 || probe_busy_errno(domain, err) ? PROBE_BUSY : -1;
+        }
+    }
+
+    return sock;
+}
+
+/*
+ * Send the probe request, if any, and check the response. A datagram probe with no
+ * expected string passes unless the target actively refuses it (ICMP port unreachable).
+ * Returns PROBE_BUSY if the expected response didn't start within the timeout.
+ */
+static int probe_exchange(int sock, int dgram){
+    char buf[PROBE_BUF_MAX + 1];
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    size_t got = 0;
+    ssize_t r;
+
+    if(probe_req_len && send(sock, probe_req, probe_req_len, MSG_NOSIGNAL) < 0)
+        return 0;
+
+    if(health.expect == NULL && !dgram)
+        return 1;
+
+    while(got < PROBE_BUF_MAX){
+        if(poll(&pfd, 1, PROBE_TIMEOUT_MS) <= 0){
+            if(got == 0 && health.expect)
+                return PROBE_BUSY;
+            break;
+        }
+
+        r = recv(sock, buf + got, PROBE_BUF_MAX - got, 0);
+        if(r < 0 && errno == ECONNREFUSED)
+            return 0;
+        if(r <= 0)
+            break;
+        got += r;
+
+        if(health.expect == NULL || dgram)
+            break;
+        buf[got] = 0;
+        if(memmem(buf, got, health.expect, strlen(health.expect)))
+            return 1;
+    }
+
+    if(health.expect == NULL)
+        return 1;
+
+    return memmem(buf, got, health.expect, strlen(health.expect)) != NULL;
+}
+
+// Run one of the built-in probes, returns 1 if the target is up, 0 if not and PROBE_BUSY if it's unclear
+static int run_probe(){
+    struct sockaddr_in in_addr;
+    struct sockaddr_un un_addr;
+    int sock, ret;
+
+    if(health.probe == PROBE_UNIX){
+        memset(&un_addr, 0x00, sizeof(un_addr));
+        un_addr.sun_family = AF_UNIX;
+        strncpy(un_addr.sun_path, health.host, sizeof(un_addr.sun_path) - 1);
+        sock = probe_connect(AF_UNIX, SOCK_STREAM, (struct sockaddr *)&un_addr, sizeof(un_addr));
+    }
+    else{
+        memset(&in_addr, 0x00, sizeof(in_addr));
+        in_addr.sin_family = AF_INET;
+        in_addr.sin_port = htons(health.port);
+        inet_pton(AF_INET, health.host, &in_addr.sin_addr);
+        sock = probe_connect(AF_INET, health.probe == PROBE_UDP ? SOCK_DGRAM : SOCK_STREAM,
+            (struct sockaddr *)&in_addr, sizeof(in_addr));
+    }
+
+    if(sock < 0)
+        return sock == PROBE_BUSY ? PROBE_BUSY : 0;
+
+    ret = probe_exchange(sock, health.probe == PROBE_UDP);
+    close(sock);
+    return ret;
+}
+
+static void coproc_start(){
+    int to_child[2], from_child[2];
+
+    if(pipe2(to_child, O_CLOEXEC) < 0 || pipe2(from_child, O_CLOEXEC) < 0){
+        fatal("[!] Error with pipe: %s\n", strerror(errno));
+    }
+
+    if((coproc_pid = fork()) == 0){
+        dup2(to_child[0], 0);
+        dup2(from_child[1], 1);
+        execl("/bin/sh", "sh", "-c", health.coproc, (char *)NULL);
+        exit(1);
+    }
+    else if(coproc_pid < 0){
+        fatal("[!] FORK FAILED!\n");
+    }
+
+    close(to_child[0]);
+    close(from_child[1]);
+    coproc_in = to_child[1];
+    coproc_out = from_child[0];
+}
+
+// Ask the co-process for a verdict, returns 1 if it answered with a line starting with '1'
+static int run_coproc(){
+    struct pollfd pfd = { .fd = coproc_out, .events = POLLIN };
+    char line[256];
+    size_t got = 0;
+    ssize_t r;
+
+    if(coproc_in < 0)
+        return 0;
+
+    if(write(coproc_in, "check\n", 6) != 6){
+        printf("[!] Check co-process is gone: %s\n", strerror(errno));
+        return 0;
+    }
+
+    while(got < sizeof(line)){
+        if(poll(&pfd, 1, COPROC_TIMEOUT_MS) <= 0){
+            printf("[!] Check co-process did not answer within %dms\n", COPROC_TIMEOUT_MS);
+            return 0;
+        }
+        if((r = read(coproc_out, line + got, 1)) <= 0){
+            printf("[!] Check co-process closed its output\n");
+            return 0;
+        }
+        if(line[got++] == '\n')
+            break;
+    }
+
+    return line[0] == '1';
+}
+
+/*
+ * With --rate-auto a target that refuses or times out a probe may only be overloaded. As with a
+ * refused case, the rate controller is told and the probe retried, backing off, before the target
+ * is taken as down.
+ */
+static int probe_busy_retry(){
+    unsigned long backoff = RATE_BACKOFF_MS;
+    int ret, tries = 0;
+
+    while((ret = run_probe()) == PROBE_BUSY && rate.adaptive && !shared->booting && !shared->stop){
+        rate_busy();
+        if(++tries > RATE_RETRIES){
+            printf("[!] Target still refusing health probes after backing off\n");
+            break;
+        }
+        usleep(backoff * 1000);
+        backoff = MIN(backoff * 2, RATE_BACKOFF_MAX_MS);
+    }
+
+    return ret == 1;
+}
+
+static int probe_once(){
+    if(health.probe != PROBE_NONE)
+        return probe_busy_retry();
+    if(health.coproc)
+        return run_coproc();
+
+    return run_check(fuzz.check_script) == 1;
+}
+
+static void * probe_loop(void * arg __attribute__((unused))){
+    struct timespec deadline;
+    int ret, timed_out;
+
+    pthread_mutex_lock(&ps->lock);
+    while(!ps->shutdown){
+        timed_out = 0;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += health.interval / 1000;
+        deadline.tv_nsec += (health.interval % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while(!ps->shutdown && ps->wanted <= ps->done && !timed_out){
+            if(health.interval)
+                timed_out = pthread_cond_timedwait(&ps->wanted_cond, &ps->lock, &deadline) == ETIMEDOUT;
+            else
+                pthread_cond_wait(&ps->wanted_cond, &ps->lock);
+        }
+        if(ps->shutdown)
+            break;
+
+        // a background probe after a stop, or while the target is starting, tells nobody anything
+        if(ps->wanted <= ps->done && (shared->stop || shared->booting))
+            continue;
+
+        ps->started++;
+        pthread_mutex_unlock(&ps->lock);
+
+        ret = probe_once();
+
+        pthread_mutex_lock(&ps->lock);
+        ps->healthy = ret;
+        ps->done = ps->started;
+        pthread_cond_broadcast(&ps->done_cond);
+
+        if(!ret && !shared->booting && stop_fuzzing())
+            printf("[!] Health check failed, target appears to be down\n");
+    }
+    pthread_mutex_unlock(&ps->lock);
+
+    return NULL;
+}
+
+void health_start(){
+    if(health.probe == PROBE_NONE && health.coproc == NULL && fuzz.check_script == NULL)
+        return;
+
+    if(health.probe != PROBE_NONE){
+        if(health.host == NULL)
+            health.host = fuzz.host;
+        if(health.port == 0)
+            health.port = fuzz.port;
+        if(health.send)
+            probe_req = unescape(health.send, &probe_req_len);
+        if(health.probe == PROBE_UDP && probe_req == NULL)
+            fatal("[!] A udp probe needs a request, set one with --probe-send\n");
+        printf("[+] Probing target health via %s\n", health.probe == PROBE_TCP ? "tcp" :
+            health.probe == PROBE_UDP ? "udp" : "unix");
+    }
+    else if(health.coproc){
+        coproc_start();
+        printf("[+] Using check co-process: %s\n", health.coproc);
+    }
+    else{
+        // forking the script in the background would cost a process per interval
+        health.interval = 0;
+    }
+
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    ft_shared(sizeof(struct probe_sync), ps);
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&ps->lock, &mattr);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&ps->wanted_cond, &cattr);
+    pthread_cond_init(&ps->done_cond, &cattr);
+    ps->healthy = 1;
+
+    if(pthread_create(&probe_thread, NULL, probe_loop, NULL) > 0)
+        fatal("Creating pthread failed: %s\n", strerror(errno));
+}
+
+/*
+ * Probe the target from a worker. The result comes from a probe started after the call,
+ * concurrent callers share it. Returns 1 if the target is up, 0 if not, and 1 if no health
+ * checks are configured.
+ */
+int health_check(){
+    unsigned long want;
+    int ret;
+
+    if(health.probe == PROBE_NONE && health.coproc == NULL && fuzz.check_script == NULL)
+        return 1;
+
+    pthread_mutex_lock(&ps->lock);
+    want = ps->started + 1;
+    if(ps->wanted < want){
+        ps->wanted = want;
+        pthread_cond_signal(&ps->wanted_cond);
+    }
+    while(ps->done < want)
+        pthread_cond_wait(&ps->done_cond, &ps->lock);
+    ret = ps->healthy;
+    pthread_mutex_unlock(&ps->lock);
+
+    return ret;
+}
+
+void health_stop(){
+    if(health.probe == PROBE_NONE && health.coproc == NULL && fuzz.check_script == NULL)
+        return;
+
+    pthread_mutex_lock(&ps->lock);
+    ps->shutdown = 1;
+    pthread_cond_signal(&ps->wanted_cond);
+    pthread_mutex_unlock(&ps->lock);
+    pthread_join(probe_thread, NULL);
+
+    if(coproc_pid > 0){
+        close(coproc_in);
+        close(coproc_out);
+        kill(coproc_pid, SIGTERM);
+        waitpid(coproc_pid, NULL, 0);
+    }
+    free(probe_req);
+}
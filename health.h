@@ -0,0 +1,37 @@
+/*
+ * File:   health.h
+ * Author: DoI
+ */
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+#define PROBE_NONE 0
+#define PROBE_TCP 1
+#define PROBE_UDP 2
+#define PROBE_UNIX 3
+
+#define PROBE_INTERVAL_MS 250 // default time between background probes
+#define PROBE_TIMEOUT_MS 1000 // connect/response timeout for the built-in probes
+#define COPROC_TIMEOUT_MS 5000 // time the check co-process gets to answer a request
+#define PROBE_BUF_MAX 4096 // most of a probe response searched for the expected string
+#define PROBE_BUSY -2 // refused or timed out, maybe only overloaded. Retried under --rate-auto
+
+struct health_args {
+    int probe; // PROBE_* type of built-in probe
+    char * host; // probe target, defaults to the fuzzing target
+    int port;
+    char * send; // request sent by the probe, C escapes allowed
+    char * expect; // string the response must contain
+    int interval; // ms between background probes, 0 to only probe on request
+    char * coproc; // long running check command speaking the line protocol
+};
+
+extern struct health_args health;
+
+int parse_probe(char * spec);
+void health_start();
+int health_check();
+void health_stop();
+
+#endif
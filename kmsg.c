@@ -0,0 +1,280 @@
+/*
+ * File:   kmsg.c
+ * Author: DoI
+ *
+ * Kernel log crash watcher. Streams /dev/kmsg, which blocks until the kernel
+ * logs something, and looks for the messages printed when a process dies on a
+ * fault:
+ *
+ *   nginx[1234]: segfault at 0 ip 000055d... sp 00007ff... error 4 in nginx[...]
+ *   traps: nginx[1234] general protection fault ip:55d... sp:7ff... error:0 in nginx[...]
+ *
+ * A fault in a process with the configured name, or in the configured cgroup,
+ * stops fuzzing the same way the target PID going away does. This catches
+ * crashes in forked workers of a pre-forking server, which -c on the master
+ * PID can't see.
+ *
+ * The cgroup is looked up in /proc/<pid>/cgroup while the faulting task is
+ * still there. It is usually gone by the time the message is read, so the
+ * watcher also keeps a list of the cgroup's tasks, refreshed every second,
+ * and a task that has vanished is matched against that.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/limits.h>
+
+#include "fuzzotron.h"
+#include "kmsg.h"
+#include "util.h"
+
+#define TASK_COMM_LEN 16 // kernel limit on process names, including the terminator
+#define KMSG_REFRESH_MS 1000 // between snapshots of the cgroup's tasks
+
+struct kmsg_args kmsg;
+
+static char cgroup[PATH_MAX]; // kmsg.cgroup without leading or trailing slashes
+static char cgroup_dir[PATH_MAX]; // the cgroup's directory under /sys/fs/cgroup, empty if there isn't one
+static const char * tasks_file; // file in it and each child listing their task IDs
+static int * members = NULL; // task IDs in the cgroup when last looked
+static unsigned long member_count = 0, member_size = 0;
+
+
+/*
+ * Pull comm and pid out of a fault message. Returns 1 if the message is a segfault or general
+ * protection fault, 0 for anything else.
+ */
+static int parse_fault(char * msg, char * comm, int * pid){
+    char * start, * open, * close;
+
+    if(strstr(msg, ": segfault at ") != NULL)
+        start = msg;
+    else if(strncmp(msg, "traps: ", 7) == 0 && strstr(msg, " general protection") != NULL)
+        start = msg + 7;
+    else
+        return 0;
+
+    // comm may contain spaces and brackets, the pid is the last [digits] before the fault text
+    if((close = strstr(start, "]: segfault at ")) == NULL && (close = strstr(start, "] general protection")) == NULL)
+        return 0;
+    for(open = close; open > start && *open != '['; open--);
+    if(*open != '[' || open - start >= TASK_COMM_LEN)
+        return 0;
+
+    memcpy(comm, start, open - start);
+    comm[open - start] = '\0';
+    *pid = atoi(open + 1);
+
+    return 1;
+}
+
+// Is path, as given in /proc/<pid>/cgroup, the configured cgroup or one below it
+static int cgroup_match(char * path){
+    size_t len = strlen(cgroup);
+
+    while(*path == '/')
+        path++;
+    if(len == 0)
+        return 1;
+
+    return strncmp(path, cgroup, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+// Is pid in the configured cgroup. Returns 1 if it is, 0 if not, -1 if pid no longer exists
+static int in_cgroup(int pid){
+    char path[PATH_MAX], line[PATH_MAX];
+    FILE * fp;
+    int ret = 0;
+
+    snprintf(path, PATH_MAX, "/proc/%d/cgroup", pid);
+    if((fp = fopen(path, "r")) == NULL)
+        return -1;
+
+    // hierarchy-ID:controllers:path, one line per hierarchy (a single 0:: line on cgroup v2)
+    while(!ret && fgets(line, sizeof(line), fp)){
+        char * cg = strchr(line, ':');
+        line[strcspn(line, "\n")] = '\0';
+        if(cg && (cg = strchr(cg + 1, ':')) != NULL && cgroup_match(cg + 1))
+            ret = 1;
+    }
+    fclose(fp);
+
+    return ret;
+}
+
+// Look for the cgroup's directory under root. Returns 1 and fills in cgroup_dir if it's there
+static int try_root(const char * root){
+    static const char * files[] = { "cgroup.threads", "tasks", "cgroup.procs", NULL };
+    char path[PATH_MAX];
+    int f;
+
+    if(snprintf(cgroup_dir, PATH_MAX, "%s/%s", root, cgroup) >= PATH_MAX)
+        return 0;
+    for(f = 0; files[f]; f++){
+        if(snprintf(path, PATH_MAX, "%s/%s", cgroup_dir, files[f]) < PATH_MAX && access(path, R_OK) == 0){
+            tasks_file = files[f];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Find the cgroup's directory, on the unified hierarchy or any of the v1 ones
+static void find_cgroup_dir(){
+    char root[PATH_MAX];
+    struct dirent * ent;
+    DIR * dir;
+
+    if(try_root("/sys/fs/cgroup"))
+        return;
+
+    if((dir = opendir("/sys/fs/cgroup")) != NULL){
+        while((ent = readdir(dir)) != NULL){
+            if(ent->d_name[0] == '.')
+                continue;
+            snprintf(root, PATH_MAX, "/sys/fs/cgroup/%s", ent->d_name);
+            if(try_root(root)){
+                closedir(dir);
+                return;
+            }
+        }
+        closedir(dir);
+    }
+
+    printf("[!] Could not find the task list of cgroup %s, crashes of tasks that have already exited "
+        "will be missed\n", kmsg.cgroup);
+    cgroup_dir[0] = '\0';
+}
+
+// Add the tasks of the cgroup at dir and of every cgroup below it to members
+static void add_members(const char * dir){
+    char path[PATH_MAX];
+    struct dirent * ent;
+    DIR * d;
+    FILE * fp;
+    int pid;
+
+    snprintf(path, PATH_MAX, "%s/%s", dir, tasks_file);
+    if((fp = fopen(path, "r")) != NULL){
+        while(fscanf(fp, "%d", &pid) == 1){
+            if(member_count == member_size){
+                member_size = member_size ? member_size * 2 : 256;
+                if((members = realloc(members, member_size * sizeof(int))) == NULL){
+                    fatal("[!] realloc failed\n");
+                }
+            }
+            members[member_count++] = pid;
+        }
+        fclose(fp);
+    }
+
+    if((d = opendir(dir)) == NULL)
+        return;
+    while((ent = readdir(d)) != NULL){
+        if(ent->d_type != DT_DIR || ent->d_name[0] == '.')
+            continue;
+        if(snprintf(path, PATH_MAX, "%s/%s", dir, ent->d_name) < PATH_MAX)
+            add_members(path);
+    }
+    closedir(d);
+}
+
+// Take a fresh list of the tasks in the cgroup, the last one is kept if the cgroup has gone
+static void snapshot_members(){
+    if(!cgroup_dir[0] || access(cgroup_dir, R_OK) != 0)
+        return;
+
+    member_count = 0;
+    add_members(cgroup_dir);
+}
+
+// Was pid in the cgroup at the last snapshot
+static int was_member(int pid){
+    unsigned long i;
+
+    for(i = 0; i < member_count; i++){
+        if(members[i] == pid)
+            return 1;
+    }
+
+    return 0;
+}
+
+static unsigned long now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+void * kmsg_watcher(void * args __attribute__((unused))){
+    char record[KMSG_RECORD_MAX + 1], comm[TASK_COMM_LEN], * msg, * end;
+    unsigned long last_snapshot = 0;
+    struct pollfd pfd;
+    ssize_t r;
+    int fd, pid, member;
+
+    if((fd = open("/dev/kmsg", O_RDONLY | O_CLOEXEC)) < 0){
+        printf("[!] Could not open /dev/kmsg: %s, kernel crash watching disabled\n", strerror(errno));
+        return NULL;
+    }
+    // only faults from now on
+    lseek(fd, 0, SEEK_END);
+
+    if(kmsg.cgroup){
+        snprintf(cgroup, PATH_MAX, "%s", kmsg.cgroup + strspn(kmsg.cgroup, "/"));
+        while(strlen(cgroup) && cgroup[strlen(cgroup) - 1] == '/')
+            cgroup[strlen(cgroup) - 1] = '\0';
+        find_cgroup_dir();
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for(;;){
+        if(cgroup_dir[0] && now_ms() - last_snapshot >= KMSG_REFRESH_MS){
+            snapshot_members();
+            last_snapshot = now_ms();
+        }
+        if(poll(&pfd, 1, cgroup_dir[0] ? KMSG_REFRESH_MS : -1) <= 0)
+            continue;
+
+        if((r = read(fd, record, KMSG_RECORD_MAX)) < 0){
+            if(errno == EPIPE || errno == EINTR)
+                continue; // overwritten before we got to it, carry on with the next one
+            printf("[!] Reading /dev/kmsg failed: %s, kernel crash watching disabled\n", strerror(errno));
+            break;
+        }
+        record[r] = '\0';
+
+        // priority,sequence,timestamp,flags;message\n followed by continuation lines
+        if((msg = strchr(record, ';')) == NULL)
+            continue;
+        msg++;
+        if((end = strchr(msg, '\n')) != NULL)
+            *end = '\0';
+
+        if(!parse_fault(msg, comm, &pid))
+            continue;
+        if(kmsg.name && strncmp(comm, kmsg.name, TASK_COMM_LEN - 1) != 0)
+            continue;
+        if(kmsg.cgroup && (member = in_cgroup(pid)) != 1 && !(member < 0 && was_member(pid)))
+            continue;
+
+        if(!stop_fuzzing()) // already stopping, most likely for this same crash
+            continue;
+
+        printf("\n[!!] Kernel reported a crash in %s (PID %d): %s\n", comm, pid, msg);
+    }
+
+    close(fd);
+    free(members);
+    return NULL;
+}
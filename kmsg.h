@@ -0,0 +1,20 @@
+/*
+ * File:   kmsg.h
+ * Author: DoI
+ */
+
+#ifndef KMSG_H
+#define KMSG_H
+
+#define KMSG_RECORD_MAX 8192 // /dev/kmsg hands out one record per read(), this is its upper bound
+
+struct kmsg_args {
+    char * name; // process name (comm) to match, truncated to 15 characters by the kernel
+    char * cgroup; // cgroup path the faulting process must be in
+};
+
+extern struct kmsg_args kmsg;
+
+void * kmsg_watcher(void * args);
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * File:   metrics.c
+ * Author: DoI
+ *
+ * Machine readable statistics. Once a second main samples the counters and
+ * rewrites <output dir>/fuzzer_stats, "name : value" per line. With
+ * --metrics-port the same figures are served to Prometheus in its text format
+ * from 127.0.0.1, by a thread of their own answering one scrape at a time.
+ *
+ * Nothing here takes a lock. The counters are the workers' own (see COUNT()),
+ * summed with relaxed loads, and the rates computed by the sampler are
+ * published as atomics for the endpoint to read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/limits.h>
+
+#include "fuzzotron.h"
+#include "metrics.h"
+#include "rate.h"
+#include "util.h"
+
+// One figure, in both renderings
+struct metric {
+    const char * name;
+    const char * type; // prometheus type, counter or gauge
+    const char * help;
+    double value;
+};
+
+#define ROUND2(x) ((long)((x) * 100 + 0.5) / 100.0) // rates to two decimal places
+#define TOTAL(m) (strcmp((m).type, "counter") ? "" : "_total")
+
+static time_t started = 0;
+static int worker_n = 0;
+static _Atomic double exec_rate = 0; // cases per second over the last sample
+static _Atomic double * worker_rates = NULL;
+static unsigned long * last_sent = NULL; // per worker at the last sample, sampler only
+static unsigned long last_total = 0;
+static struct timespec last_sample;
+
+static pthread_t server_thread;
+static int server_fd = -1;
+static atomic_int server_stop = 0;
+
+void metrics_init(int workers){
+    int i;
+
+    worker_n = workers;
+    time(&started);
+    clock_gettime(CLOCK_MONOTONIC, &last_sample);
+    ft_malloc(workers * sizeof(_Atomic double), worker_rates);
+    ft_malloc(workers * sizeof(unsigned long), last_sent);
+    for(i = 0; i < workers; i++){
+        atomic_init(&worker_rates[i], 0);
+        last_sent[i] = 0;
+    }
+    last_total = stat_total(STAT_SENT);
+}
+
+// Fill in the campaign wide figures, returns how many
+static int collect(struct metric * m){
+    time_t now = time(NULL), last_path = atomic_load_explicit(&shared->last_path, memory_order_relaxed);
+    int n = 0;
+
+    m[n++] = (struct metric){"cases_sent", "counter", "Test cases sent to the target", stat_total(STAT_SENT)};
+    m[n++] = (struct metric){"execs_per_sec", "gauge", "Cases sent per second over the last second",
+        atomic_load_explicit(&exec_rate, memory_order_relaxed)};
+    m[n++] = (struct metric){"paths", "counter", "Cases that found new coverage", stat_total(STAT_PATHS)};
+    m[n++] = (struct metric){"jettisoned", "counter", "New coverage that didn't calibrate", stat_total(STAT_JETTISONED)};
+    m[n++] = (struct metric){"reruns", "counter", "Cases sent again to calibrate or trim them, not in cases_sent",
+        stat_total(STAT_RERUNS)};
+    m[n++] = (struct metric){"crashes", "counter", "Target crashes", stat_total(STAT_CRASHES)};
+    m[n++] = (struct metric){"hangs", "counter", "Traced cases whose coverage never settled, the target still busy",
+        stat_total(STAT_HANGS)};
+    m[n++] = (struct metric){"connect_failures", "counter", "Sends that failed, after any --rate-auto retries",
+        stat_total(STAT_SEND_FAILS)};
+    m[n++] = (struct metric){"refused", "counter", "Connects refused or timed out, retried by --rate-auto", rate_refused()};
+    m[n++] = (struct metric){"uptime_seconds", "gauge", "Seconds since fuzzing started", now - started};
+    m[n++] = (struct metric){"last_path_seconds", "gauge", "Seconds since the last new path, -1 for none yet",
+        last_path ? now - last_path : -1};
+
+    return n;
+}
+
+/*
+ * Render every figure into buf, as Prometheus text or as name : value lines for the stats file.
+ * Returns the length written.
+ */
+static size_t render(char * buf, size_t size, int prometheus){
+    struct metric m[16];
+    char name[64];
+    size_t len = 0;
+    int i, n = collect(m);
+
+    for(i = 0; i < n && len < size; i++){
+        if(prometheus)
+            // counters end in _total, by Prometheus convention
+            len += snprintf(buf + len, size - len, "# HELP fuzzotron_%s%s %s\n# TYPE fuzzotron_%s%s %s\nfuzzotron_%s%s %.15g\n",
+                m[i].name, TOTAL(m[i]), m[i].help, m[i].name, TOTAL(m[i]), m[i].type, m[i].name, TOTAL(m[i]), m[i].value);
+        else
+            len += snprintf(buf + len, size - len, "%-22s: %.15g\n", m[i].name, m[i].value);
+    }
+
+    if(prometheus && len < size)
+        len += snprintf(buf + len, size - len, "# HELP fuzzotron_worker_execs_per_sec Cases a worker sent per second over the last second\n"
+            "# TYPE fuzzotron_worker_execs_per_sec gauge\n");
+    for(i = 0; i < worker_n && len < size; i++){
+        if(prometheus)
+            len += snprintf(buf + len, size - len, "fuzzotron_worker_execs_per_sec{worker=\"%d\"} %.15g\n", i + 1,
+                atomic_load_explicit(&worker_rates[i], memory_order_relaxed));
+        else{
+            snprintf(name, sizeof(name), "worker_%d_execs_per_sec", i + 1);
+            len += snprintf(buf + len, size - len, "%-22s: %.15g\n", name,
+                atomic_load_explicit(&worker_rates[i], memory_order_relaxed));
+        }
+    }
+
+    return MIN(len, size - 1);
+}
+
+// Work out the rates since the last call and rewrite the stats file in dir. Main thread only
+void metrics_sample(char * dir){
+    char path[PATH_MAX], tmp[PATH_MAX], buf[METRICS_MAX];
+    unsigned long sent;
+    struct timespec now;
+    double elapsed;
+    FILE * fp;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - last_sample.tv_sec) + (now.tv_nsec - last_sample.tv_nsec) / 1e9;
+    if(elapsed < METRICS_INTERVAL)
+        return;
+
+    sent = stat_total(STAT_SENT);
+    atomic_store_explicit(&exec_rate, ROUND2((sent - last_total) / elapsed), memory_order_relaxed);
+    last_total = sent;
+    for(i = 0; i < worker_n; i++){
+        sent = stat_worker(i, STAT_SENT);
+        atomic_store_explicit(&worker_rates[i], ROUND2((sent - last_sent[i]) / elapsed), memory_order_relaxed);
+        last_sent[i] = sent;
+    }
+    last_sample = now;
+
+    // written aside and renamed over, so a reader never sees half a file
+    snprintf(path, PATH_MAX, "%s/%s", dir, METRICS_FILE);
+    snprintf(tmp, PATH_MAX, "%s/.%s", dir, METRICS_FILE);
+    if((fp = fopen(tmp, "w")) == NULL)
+        return;
+    fwrite(buf, 1, render(buf, sizeof(buf), 0), fp);
+    fclose(fp);
+    rename(tmp, path);
+}
+
+static void * serve(void * arg __attribute__((unused))){
+    static const char header[] = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+        "Connection: close\r\nContent-Length: %zu\r\n\r\n";
+    char buf[METRICS_MAX], head[256], req[1024];
+    struct pollfd pfd;
+    size_t len;
+    int fd, n;
+
+    while(!atomic_load(&server_stop)){
+        pfd.fd = server_fd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, 250) <= 0)
+            continue;
+        if((fd = accept(server_fd, NULL, NULL)) < 0)
+            continue;
+
+        // whatever was asked for, the answer is the metrics
+        pfd.fd = fd;
+        if(poll(&pfd, 1, METRICS_TIMEOUT_MS) > 0)
+            recv(fd, req, sizeof(req), 0);
+        len = render(buf, sizeof(buf), 1);
+        n = snprintf(head, sizeof(head), header, len);
+        if(send(fd, head, n, MSG_NOSIGNAL) == n)
+            send(fd, buf, len, MSG_NOSIGNAL);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+// Serve the metrics to Prometheus on 127.0.0.1:port
+void metrics_serve(int port){
+    struct sockaddr_in addr;
+    int one = 1;
+
+    if((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0){
+        fatal("[!] Error: Could not create socket: %s\n", strerror(errno));
+    }
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server_fd, 8) < 0){
+        fatal("[!] Could not listen on 127.0.0.1:%d for --metrics-port: %s\n", port, strerror(errno));
+    }
+
+    if(pthread_create(&server_thread, NULL, serve, NULL) > 0)
+        fatal("Creating pthread failed: %s\n", strerror(errno));
+    printf("[+] Serving metrics on http://127.0.0.1:%d/metrics\n", port);
+}
+
+void metrics_stop(){
+    if(server_fd >= 0){
+        atomic_store(&server_stop, 1);
+        pthread_join(server_thread, NULL);
+        close(server_fd);
+        server_fd = -1;
+    }
+    free(worker_rates);
+    free(last_sent);
+}
@@ -0,0 +1,19 @@
+/*
+ * File:   metrics.h
+ * Author: DoI
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#define METRICS_FILE "fuzzer_stats" // in the output directory, rewritten every METRICS_INTERVAL
+#define METRICS_INTERVAL 1 // seconds between samples of the execution rates
+#define METRICS_MAX 65536 // largest rendering of the metrics
+#define METRICS_TIMEOUT_MS 1000 // time a scraper gets to send its request
+
+void metrics_init(int workers);
+void metrics_sample(char * dir);
+void metrics_serve(int port);
+void metrics_stop();
+
+#endif
@@ -2,7 +2,12 @@
  * File:   monitor.c
  * Author: DoI
  *
- * Monitors a log file and looks for a specific string
+ * Monitors one or more log files and looks for a pattern in each. The files
+ * are followed with inotify, across truncation and rotation (the file being
+ * moved or deleted and created again). Matches stop fuzzing and are logged
+ * with a timestamp and the number of cases sent to <output dir>/matches, so
+ * they can be lined up with what was being sent at the time. With --sanitizer,
+ * ASan/UBSan reports in the logs are also picked out, see san.c.
  *
  */
 
@@ -10,62 +15,222 @@
 #include <stdlib.h>
 #include <pcre.h>
 #include <string.h>
+#include <libgen.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/inotify.h>
 #include <errno.h>
 #include <unistd.h>
 
 #include "monitor.h"
+#include "state.h"
 #include "util.h"
 #include "fuzzotron.h"
 
-// Currently does not implement file re-open when the file being monitored is overwritten...
+#define WATCH_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
 
-int monitor(char * file, char * regex){
-    char * buff = NULL;
-    pcre *re;
-    size_t len = 0;
-    int check;
+static int inotify_fd = -1;
+
+// Record a match and stop fuzzing
+static void report_match(struct log_watch * w, char * line){
+    struct timespec ts;
+    char path[PATH_MAX];
+    FILE * fp;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if(!stop_fuzzing())
+        return; // already stopping, most likely more of the same crash
+
+    printf("\n[!] REGEX matched in %s: %s", w->file, line);
+
+    if(output_dir == NULL)
+        return;
+    snprintf(path, PATH_MAX, "%s/%s", output_dir, MATCH_FILE);
+    if((fp = fopen(path, "a")) != NULL){
+        fprintf(fp, "%ld.%09ld %lu %s: %s", (long)ts.tv_sec, ts.tv_nsec, stat_total(STAT_SENT), w->file, line);
+        if(line[0] == '\0' || line[strlen(line) - 1] != '\n')
+            fputc('\n', fp);
+        fclose(fp);
+    }
+}
+
+// Open the log, from the end if at_end is set (existing contents predate fuzzing)
+static int open_log(struct log_watch * w, int at_end){
+    struct stat s;
+
+    if((w->fd = open(w->file, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+
+    w->wd = inotify_add_watch(inotify_fd, w->file, WATCH_EVENTS);
+    w->pos = 0;
+    w->line_len = 0;
+    if(at_end && fstat(w->fd, &s) == 0)
+        w->pos = s.st_size;
+
+    return 0;
+}
+
+// Read and match everything appended since the last call
+static void read_log(struct log_watch * w){
+    char buf[4096];
+    struct stat s;
+    ssize_t r, i, start;
+
+    if(w->fd < 0)
+        return;
+
+    // truncated, start again from the top
+    if(fstat(w->fd, &s) == 0 && s.st_size < w->pos){
+        w->pos = 0;
+        w->line_len = 0;
+    }
+
+    while((r = pread(w->fd, buf, sizeof(buf), w->pos)) > 0){
+        w->pos += r;
+        for(i = 0, start = 0; i < r; i++){
+            if(buf[i] != '\n')
+                continue;
+
+            // complete line, prefixed with whatever was left over from the last read
+            w->line = realloc(w->line, w->line_len + (i - start) + 2);
+            if(w->line == NULL){
+                fatal("[!] realloc failed\n");
+            }
+            memcpy(w->line + w->line_len, buf + start, i - start + 1);
+            w->line[w->line_len + (i - start) + 1] = '\0';
+            w->line_len = 0;
+            start = i + 1;
+
+            if(san_enabled && san_line(&w->san, w->line))
+                report_match(w, w->line);
+            else if(w->re && parse_line(w->line, w->re, w->extra) == 0)
+                report_match(w, w->line);
+        }
+
+        if(start < r){
+            w->line = realloc(w->line, w->line_len + (r - start) + 1);
+            if(w->line == NULL){
+                fatal("[!] realloc failed\n");
+            }
+            memcpy(w->line + w->line_len, buf + start, r - start);
+            w->line_len += r - start;
+        }
+    }
+}
+
+// The file was moved or deleted: drain what's left and pick up its replacement if it's there yet
+static void rotate_log(struct log_watch * w){
+    read_log(w);
+    inotify_rm_watch(inotify_fd, w->wd);
+    close(w->fd);
+    w->fd = -1;
+    w->wd = -1;
+
+    if(open_log(w, 0) == 0)
+        printf("[.] %s was rotated, following the new file\n", w->file);
+}
+
+// Whether the path now names a different file from the one open, as after delete-and-create rotation
+static int log_replaced(struct log_watch * w){
+    struct stat open_s, path_s;
+
+    if(fstat(w->fd, &open_s) < 0 || stat(w->file, &path_s) < 0)
+        return 0;
+
+    return open_s.st_ino != path_s.st_ino || open_s.st_dev != path_s.st_dev;
+}
 
-    re = compile_regex(regex);
+int monitor(char ** files, char ** regexes, int count){
+    static struct log_watch watches[MAX_LOGS];
+    char events[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char dir[PATH_MAX];
+    int i, active = 0;
+    ssize_t r;
 
-    FILE *fh = fopen(file, "r");
-    if(fh == NULL){
-        printf("[!] Error opening file %s: %s!\n", file, strerror(errno));
+    if((inotify_fd = inotify_init1(IN_CLOEXEC)) < 0){
+        printf("[!] inotify_init1 failed: %s!\n", strerror(errno));
+        printf("[!] Falling back to crash-detection only\n");
+        return -1;
+    }
+
+    memset(watches, 0x00, sizeof(watches));
+    for(i = 0; i < count && i < MAX_LOGS; i++){
+        struct log_watch * w = &watches[i];
+
+        w->file = files[i];
+        w->regex = regexes[i];
+        if(w->regex)
+            w->re = compile_regex(w->regex, &w->extra); // optional when reading sanitizer reports
+        w->fd = w->wd = -1;
+
+        strncpy(dir, w->file, PATH_MAX - 1);
+        dir[PATH_MAX - 1] = '\0';
+        if((w->dir_wd = inotify_add_watch(inotify_fd, dirname(dir), DIR_EVENTS)) < 0){
+            printf("[!] Error watching directory of %s: %s!\n", w->file, strerror(errno));
+            continue;
+        }
+
+        if(open_log(w, 1) < 0)
+            printf("[!] Error opening file %s: %s, waiting for it to appear\n", w->file, strerror(errno));
+        active++;
+    }
+
+    if(active == 0){
         printf("[!] Falling back to crash-detection only\n");
         return -1;
     }
-    fseek(fh, 0, SEEK_END);
 
     for(;;){
-        ssize_t w;
-        while((w = getline(&buff, &len, fh)) > 0){
-            check = parse_line(buff, re);
-            if(check == 0){
-                printf("[!] REGEX matched! Exiting.\n");
-                stop = 1;
-                goto end;
-            }
+        if((r = read(inotify_fd, events, sizeof(events))) <= 0){
+            if(r < 0 && errno == EINTR)
+                continue;
+            fatal("[!] inotify read failed: %s\n", strerror(errno));
         }
 
-        // Once EOF is set, getline will constantly return EOF.
-        // Call clearerr() to remove the feof flag and read more
-        // data as it's appended.
-        clearerr(fh);
-        usleep(10000);
+        char * p;
+        for(p = events; p < events + r; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len){
+            struct inotify_event * ev = (struct inotify_event *)p;
+
+            for(i = 0; i < count && i < MAX_LOGS; i++){
+                struct log_watch * w = &watches[i];
+
+                if(ev->wd == w->wd && w->fd >= 0){
+                    if(ev->mask & IN_MODIFY)
+                        read_log(w);
+                    if(ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+                        rotate_log(w);
+                }
+                else if(ev->wd == w->dir_wd && ev->len){
+                    // (re)created, read it from the start
+                    strncpy(dir, w->file, PATH_MAX - 1);
+                    dir[PATH_MAX - 1] = '\0';
+                    if(strcmp(ev->name, basename(dir)) != 0)
+                        continue;
+
+                    // the old file still being open holds off its IN_DELETE_SELF, so this may be
+                    // the only sign of a rotation
+                    if(w->fd >= 0 && log_replaced(w))
+                        rotate_log(w);
+                    else if(w->fd < 0)
+                        open_log(w, 0);
+                    read_log(w);
+                }
+            }
+        }
     }
 
-end:
-    free(buff);
-    fclose(fh);
     return 0;
 }
 
-int parse_line(char* line, pcre *regex){
+int parse_line(char* line, pcre *regex, pcre_extra * extra){
     int ovector[30];
     int match = pcre_exec(
         regex,
-        NULL,
+        extra,
         line,
         (int)strlen(line),
         0,
@@ -81,7 +246,7 @@ int parse_line(char* line, pcre *regex){
     return 0;
 }
 
-pcre * compile_regex(char* regex){
+pcre * compile_regex(char* regex, pcre_extra ** extra){
     pcre *re;
     int erroroffset;
     const char *error;
@@ -98,5 +263,13 @@ pcre * compile_regex(char* regex){
         // Compilation failed!
         fatal("[!] PCRE compile failed at offset %d error: %s\n", erroroffset, error);
     }
+
+    // JIT compile where libpcre supports it, pcre_exec() falls back to the interpreter otherwise
+    *extra = pcre_study(re, PCRE_STUDY_JIT_COMPILE, &error);
+    if(error != NULL){
+        printf("[!] PCRE study failed for %s: %s\n", regex, error);
+        *extra = NULL;
+    }
+
     return re;
 }
@@ -8,9 +8,38 @@
 #define MONITOR_H
 
 #include <pcre.h>
+#include <sys/types.h>
 
-int monitor(char * file, char * regex);
-int parse_line(char* line, pcre *regex);
-pcre * compile_regex(char* regex);
+#include "san.h"
+
+#define MAX_LOGS 16 // most log files that can be monitored at once
+#define MATCH_FILE "matches" // log of regex matches in the output directory
+
+// A monitored log file and the pattern looked for in it
+struct log_watch {
+    char * file;
+    char * regex;
+    pcre * re;
+    pcre_extra * extra; // pcre_study() data, JIT compiled where supported
+    int fd;
+    int wd; // inotify watch on the file itself
+    int dir_wd; // inotify watch on its directory, to see it come back after rotation
+    off_t pos; // bytes of the file consumed so far
+    char * line; // partial line carried over between reads
+    size_t line_len;
+    struct san_parser san; // sanitizer report being read from this log
+};
+
+// Log files and patterns given on the command line, -m and -r pair up in order
+struct monitor_args {
+    char * files[MAX_LOGS];
+    char * regexes[MAX_LOGS];
+    int file_count;
+    int regex_count;
+};
+
+int monitor(char ** files, char ** regexes, int count);
+int parse_line(char* line, pcre *regex, pcre_extra * extra);
+pcre * compile_regex(char* regex, pcre_extra ** extra);
 
 #endif
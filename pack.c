@@ -0,0 +1,158 @@
+/*
+ * File:   pack.c
+ * Author: DoI
+ *
+ * fuzzotron-pack - move corpora between plain directories and archives (see
+ * archive.c), and list what an archive holds.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "archive.h"
+#include "generator.h"
+#include "state.h"
+#include "util.h"
+
+void help(){
+    // Print the help and exit
+    printf("fuzzotron-pack - Pack a corpus directory into an archive, or unpack one\n\n");
+    printf("Usage: ./fuzzotron-pack -c corpus/ -o corpus.fza\n");
+    printf("       ./fuzzotron-pack -x corpus.fza -o corpus/\n");
+    printf("       ./fuzzotron-pack -l corpus.fza\n\n");
+    printf("\t-c\t\tDirectory to add to the archive given with -o, created if it does not exist\n");
+    printf("\t-x\t\tArchive to extract to the directory given with -o\n");
+    printf("\t-l\t\tList the entries of an archive\n");
+    printf("\t-o\t\tOutput archive or directory\n");
+    printf("\t--compress\tCompress entries added with -c\n");
+    exit(0);
+}
+
+// Add every regular file in dir to the archive at path
+static int pack(char * dir, char * path, int compress){
+    struct archive ar;
+    struct archive_entry meta;
+    struct dirent * ents;
+    char file_path[PATH_MAX], * data;
+    struct stat s;
+    DIR * d;
+    int fd, n = 0;
+
+    if((d = opendir(dir)) == NULL){
+        fatal("[!] Error: Could not open directory %s: %s\n", dir, strerror(errno));
+    }
+    if(archive_open(&ar, path, compress) < 0){
+        fatal("[!] Could not open %s for writing\n", path);
+    }
+
+    while((ents = readdir(d)) != NULL){
+        snprintf(file_path, PATH_MAX, "%s/%s", dir, ents->d_name);
+        if(stat(file_path, &s) < 0 || !S_ISREG(s.st_mode))
+            continue;
+
+        ft_malloc(s.st_size + 1, data);
+        if((fd = open(file_path, O_RDONLY)) < 0){
+            fatal("[!] Error: Could not open file %s: %s\n", file_path, strerror(errno));
+        }
+        if(read(fd, data, s.st_size) != s.st_size){
+            fatal("[!] Error: short read on %s\n", file_path);
+        }
+        close(fd);
+
+        memset(&meta, 0x00, sizeof(meta));
+        meta.hash = case_hash(data, s.st_size);
+        if(archive_add(&ar, ents->d_name, data, s.st_size, &meta) < 0){
+            fatal("[!] Could not add %s to %s\n", file_path, path);
+        }
+        free(data);
+        n++;
+    }
+    closedir(d);
+    archive_close(&ar);
+
+    return n;
+}
+
+static void list(char * path){
+    struct archive_map m;
+    const struct archive_entry * e;
+    unsigned long i;
+
+    if(archive_map(&m, path) < 0){
+        fatal("[!] Error: %s is not an archive\n", path);
+    }
+
+    printf("%-10s %-10s %-10s %10s %10s %10s  %s\n", "hash", "parent", "exec_hash", "size", "stored", "exec_us", "name");
+    for(i = 0; i < m.count; i++){
+        e = m.index[i].entry;
+        printf("%08x   %08x   %08x   %10lu %10lu %10lu  %.*s\n", e->hash, e->parent, e->exec_hash,
+            (unsigned long)e->len, (unsigned long)e->stored, (unsigned long)e->exec_us, (int)e->name_len, m.index[i].name);
+    }
+    printf("[.] %lu entries\n", m.count);
+
+    archive_unmap(&m);
+}
+
+int main(int argc, char ** argv){
+    int c, n;
+    static int compress = 0;
+    char * in_dir = NULL, * extract = NULL, * out = NULL, * show = NULL;
+
+    static struct option arg_options[] = {
+        {"compress", no_argument, &compress, 1},
+        {0, 0, 0, 0}
+    };
+
+    int arg_index;
+    while((c = getopt_long(argc, argv, "c:x:l:o:", arg_options, &arg_index)) != -1){
+        switch(c){
+            case 'c':
+                in_dir = optarg;
+                break;
+
+            case 'x':
+                extract = optarg;
+                break;
+
+            case 'l':
+                show = optarg;
+                break;
+
+            case 'o':
+                out = optarg;
+                break;
+        }
+    }
+
+    if(show){
+        list(show);
+        return 0;
+    }
+
+    if((in_dir == NULL && extract == NULL) || out == NULL)
+        help();
+
+    if(in_dir){
+        n = pack(in_dir, out, compress);
+        printf("[.] Added %d files from %s to %s\n", n, in_dir, out);
+    }
+    else{
+        if(mkdir(out, 0755) < 0 && errno != EEXIST){
+            fatal("[!] Could not mkdir %s: %s\n", out, strerror(errno));
+        }
+        if((n = archive_export(extract, out)) < 0){
+            fatal("[!] Error: %s is not an archive\n", extract);
+        }
+        printf("[.] Extracted %d cases from %s to %s\n", n, extract, out);
+    }
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * File:   rate.c
+ * Author: DoI
+ *
+ * Send rate control. --max-rate paces sends to a fixed number of cases per
+ * second across all workers. --rate-auto adds a closed loop in the style of
+ * TCP congestion control: both the send rate and the window, the number of
+ * workers allowed to be sending at once, grow while the target keeps up and
+ * are halved when it doesn't. The rate doubles each period until the first
+ * sign of overload (slow start), after which it grows additively.
+ *
+ * Overload is a refused or timed out connect (SEND_BUSY from the senders),
+ * or a mean send latency over a period above --rate-latency. The latency is
+ * the time fuzz.send() takes, mostly the connect for TCP, and with
+ * --rate-response also the wait for the target to start answering. Refused
+ * cases are retried with a growing delay rather than stopping the campaign;
+ * only a target that keeps refusing is reported as down.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fuzzotron.h"
+#include "rate.h"
+#include "sender.h"
+#include "timing.h"
+#include "util.h"
+
+struct rate_args rate;
+
+// In shared memory, so --fork-workers processes are paced together
+static struct rate_state {
+    pthread_mutex_t lock;
+    pthread_cond_t window_cond;
+    double allowed; // cases per second, 0 for unpaced
+    double ssthresh; // rate at the last decrease, 0 while in slow start
+    double next_slot; // when the next case may go out
+    unsigned int window, max_window, inflight;
+    unsigned long refused;
+
+    // the current period
+    double period_start;
+    unsigned long period_sent, period_busy;
+    uint64_t period_latency_us;
+} * rs = NULL;
+
+static double now_secs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void rate_init(int workers){
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+
+    if(rate.latency_ms == 0)
+        rate.latency_ms = RATE_LATENCY_MS;
+
+    ft_shared(sizeof(struct rate_state), rs);
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&rs->lock, &mattr);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&rs->window_cond, &cattr);
+
+    rs->max_window = rs->window = workers;
+    rs->allowed = rate.max;
+    if(rate.adaptive){
+        rs->allowed = rate.max ? MIN(rate.max, RATE_START) : RATE_START;
+        rs->window = 1;
+        fuzz.retry_busy = 1;
+        if(rate.response)
+            fuzz.response_ms = rate.latency_ms * 2; // long enough to tell slow from very slow
+        printf("[+] Adapting the send rate to the target, overloaded above %lums latency%s\n", rate.latency_ms,
+            rate.response ? " to the first response byte" : "");
+    }
+    if(rate.max)
+        printf("[+] Send rate capped at %.0f cases/s\n", rate.max);
+    rs->period_start = now_secs();
+}
+
+// Called with rs->lock held at the end of a period
+static void adjust(double now){
+    double achieved = rs->period_sent / (now - rs->period_start);
+
+    if(rs->period_busy || (rs->period_sent && rs->period_latency_us / rs->period_sent > rate.latency_ms * 1000)){
+        // multiplicative decrease
+        rs->ssthresh = MAX(rs->allowed / 2, RATE_MIN);
+        rs->allowed = rs->ssthresh;
+        rs->window = MAX(rs->window / 2, 1);
+    }
+    else if(rs->period_sent){
+        // no higher while the workers, not the pacing, are what's holding the rate down
+        if(rs->allowed < MAX(achieved * 2, RATE_START)){
+            if(rs->ssthresh == 0)
+                rs->allowed *= 2;
+            else
+                rs->allowed += MAX(rs->ssthresh / RATE_AI_STEPS, 1);
+        }
+        if(rs->window < rs->max_window)
+            rs->window++;
+    }
+    if(rate.max)
+        rs->allowed = MIN(rs->allowed, rate.max);
+
+    rs->period_start = now;
+    rs->period_sent = rs->period_busy = 0;
+    rs->period_latency_us = 0;
+}
+
+// Wait for room in the window and for this case's slot in the pacing
+static void acquire(){
+    double now, wait = 0;
+    struct timespec ts;
+    uint64_t paced = timing_start();
+
+    pthread_mutex_lock(&rs->lock);
+    while(rs->inflight >= rs->window && !atomic_load_explicit(&shared->stop, memory_order_relaxed)){
+        // timed so a stop isn't missed
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += RATE_INTERVAL_MS * 1000000L;
+        if(ts.tv_nsec >= 1000000000L){
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&rs->window_cond, &rs->lock, &ts);
+    }
+    rs->inflight++;
+    if(rs->allowed > 0){
+        now = now_secs();
+        if(rs->next_slot < now)
+            rs->next_slot = now;
+        wait = rs->next_slot - now;
+        rs->next_slot += 1 / rs->allowed;
+    }
+    pthread_mutex_unlock(&rs->lock);
+
+    if(wait > 0)
+        usleep(wait * 1e6);
+    timing_end(STAGE_PACE, paced);
+}
+
+static void release(int ret, uint64_t latency_us){
+    double now;
+
+    pthread_mutex_lock(&rs->lock);
+    rs->inflight--;
+    pthread_cond_signal(&rs->window_cond);
+    if(ret == SEND_BUSY)
+        rs->refused++;
+    if(rate.adaptive){
+        rs->period_sent++;
+        rs->period_latency_us += latency_us;
+        if(ret == SEND_BUSY)
+            rs->period_busy++;
+        if((now = now_secs()) - rs->period_start >= RATE_INTERVAL_MS / 1000.0)
+            adjust(now);
+    }
+    pthread_mutex_unlock(&rs->lock);
+}
+
+/*
+ * fuzz.send(), paced and windowed. With --rate-auto a case the target refused is retried, backing
+ * off, up to RATE_RETRIES times. Returns the result of the last send.
+ */
+int rate_send(testcase_t * testcase){
+    struct timespec start, end;
+    unsigned long backoff = RATE_BACKOFF_MS;
+    int ret, tries = 0;
+
+    if(!rate.adaptive && rate.max == 0)
+        return fuzz.send(fuzz.host, fuzz.port, testcase);
+
+    for(;;){
+        acquire();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ret = fuzz.send(fuzz.host, fuzz.port, testcase);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        release(ret, (end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000);
+
+        if(ret != SEND_BUSY || !rate.adaptive || atomic_load_explicit(&shared->stop, memory_order_acquire))
+            return ret;
+        if(++tries > RATE_RETRIES){
+            printf("[!] Target still refusing connections after backing off\n");
+            return ret;
+        }
+        usleep(backoff * 1000);
+        backoff = MIN(backoff * 2, RATE_BACKOFF_MAX_MS);
+    }
+}
+
+// Overload seen outside a send, a refused health probe. Counts against the current period like SEND_BUSY
+void rate_busy(){
+    pthread_mutex_lock(&rs->lock);
+    rs->refused++;
+    if(rate.adaptive)
+        rs->period_busy++;
+    pthread_mutex_unlock(&rs->lock);
+}
+
+// Cases per second currently allowed, 0 if unpaced
+double rate_current(){
+    return rs->allowed;
+}
+
+unsigned int rate_window(){
+    return rs->window;
+}
+
+// Connects refused or timed out so far
+unsigned long rate_refused(){
+    return rs->refused;
+}
@@ -0,0 +1,36 @@
+/*
+ * File:   rate.h
+ * Author: DoI
+ */
+
+#ifndef RATE_H
+#define RATE_H
+
+#include "generator.h"
+
+#define RATE_INTERVAL_MS 100 // control period, the rate and window change at most once per period
+#define RATE_START 100 // cases per second the adaptive controller starts from
+#define RATE_MIN 1 // never paced slower than this
+#define RATE_AI_STEPS 20 // additive increase is the rate at the last decrease over this many periods
+#define RATE_LATENCY_MS 100 // default --rate-latency
+#define RATE_RETRIES 8 // times a refused case is retried before the target is taken as down
+#define RATE_BACKOFF_MS 10 // delay before the first retry, doubling each time
+#define RATE_BACKOFF_MAX_MS 1000
+
+struct rate_args {
+    int adaptive; // --rate-auto, AIMD on the send rate and the number of workers sending at once
+    double max; // --max-rate, cases per second, 0 for no cap
+    unsigned long latency_ms; // --rate-latency, mean send latency over a period taken as overload
+    int response; // --rate-response, include the time to the first response byte in the latency
+};
+
+extern struct rate_args rate;
+
+void rate_init(int workers);
+int rate_send(testcase_t * testcase);
+double rate_current();
+unsigned int rate_window();
+unsigned long rate_refused();
+void rate_busy();
+
+#endif
@@ -3,29 +3,67 @@
 #include <stdint.h>
 #include <string.h>
 #include <getopt.h>
+#include <linux/limits.h>
 
 #include "util.h"
 #include "sender.h"
 #include "fuzzotron.h"
+#include "archive.h"
+#include "ring.h"
 
 struct fuzzer_args fuzz;
 
 void help(){
     // Print the help and exit
     printf("Replay - Send a testcase, the same way Fuzzotron does\n\n");
-    printf("Usage: ./replay -h 127.0.0.1 -p 80 -P tcp some_file\n\n");
+    printf("Usage: ./replay -h 127.0.0.1 -p 80 -P tcp some_file\n");
+    printf("Crash ring files (<tid>.ring) and corpus archives are replayed case by case, in order\n\n");
     printf("\t-h\t\tIP of host to connect to\n");
     printf("\t-p\t\tPort to connect to\n");
-    printf("\t-P\t\tProtocol to use (tcp,udp)\n");
+    printf("\t-P\t\tProtocol to use (tcp,udp,unix,shm)\n");
+    printf("\t-n\t\tOnly send the archive entry with this name or hash\n");
     printf("\t--ssl\t\tUse SSL for the connection\n");
     printf("\t--destroy\tUse TCP_REPAIR mode to immediately destroy the connection, do not send FIN/RST.\n");
     exit(0);
 }
 
+// Send the cases in a corpus archive, or just the one whose name or hex hash is only
+static void replay_archive(char * file, char * only){
+    struct archive_map m;
+    const struct archive_entry * e;
+    testcase_t testcase = {0, NULL, 0x00};
+    char name[NAME_MAX + 1];
+    unsigned long i, sent = 0;
+
+    if(archive_map(&m, file) < 0){
+        fatal("[!] Error: %s is not an archive\n", file);
+    }
+
+    for(i = 0; i < m.count; i++){
+        e = m.index[i].entry;
+        snprintf(name, sizeof(name), "%.*s", (int)MIN(e->name_len, NAME_MAX), m.index[i].name);
+        if(only && strcmp(only, name) != 0 && strtoul(only, NULL, 16) != e->hash)
+            continue;
+        if(e->len == 0 || (testcase.data = archive_data(&m, i)) == NULL)
+            continue;
+
+        testcase.len = e->len;
+        printf("Sending: %s:%s (%08x) bytes: %lu\n", file, name, e->hash, testcase.len);
+        if(fuzz.send(fuzz.host, fuzz.port, &testcase) < 0)
+            printf("[!] Send failed at entry %lu\n", i + 1);
+        archive_release(&m, i, testcase.data);
+        sent++;
+    }
+    archive_unmap(&m);
+
+    if(sent == 0)
+        printf("[!] Nothing in %s to send\n", file);
+}
+
 int main(int argc, char ** argv){
     int c;
     FILE * fp;
-    char * data; 
+    char * data = NULL, * only = NULL;
     unsigned long data_len = 0;
     
     memset(&fuzz, 0x00, sizeof(fuzz));
@@ -39,7 +77,7 @@ int main(int argc, char ** argv){
     };
 
     int arg_index;
-    while((c = getopt_long(argc, argv, "h:l:p:P:", arg_options, &arg_index)) != -1){
+    while((c = getopt_long(argc, argv, "h:l:n:p:P:", arg_options, &arg_index)) != -1){
         switch(c){
             case 'h':
                 // define host
@@ -51,6 +89,11 @@ int main(int argc, char ** argv){
                 fuzz.alpn = optarg;
                 break;
 
+            case 'n':
+                // single archive entry
+                only = optarg;
+                break;
+
             case 'p':
                 // define port
                 fuzz.port = atoi(optarg);
@@ -58,8 +101,9 @@ int main(int argc, char ** argv){
 
             case 'P':
                 // define protocol
-                if((strcmp(optarg,"udp") != 0) && (strcmp(optarg,"tcp") != 0) && (strcmp(optarg,"unix") != 0)){
-                        fatal("Please specify either 'tcp', 'udp' or 'unix' for -P\n");
+                if((strcmp(optarg,"udp") != 0) && (strcmp(optarg,"tcp") != 0) && (strcmp(optarg,"unix") != 0) &&
+                        (strcmp(optarg,"shm") != 0)){
+                        fatal("Please specify either 'tcp', 'udp', 'unix' or 'shm' for -P\n");
                 }
                 if(strcmp(optarg,"tcp") == 0){
                             fuzz.protocol = 1;
@@ -73,18 +117,27 @@ int main(int argc, char ** argv){
                     fuzz.protocol = 3;
                     fuzz.send = send_unix;
                 }
+                else if(strcmp(optarg,"shm") == 0){
+                    fuzz.protocol = 4;
+                    fuzz.send = send_shm;
+                }
 
                 break;
            }
     }
 
-    if((fuzz.host == NULL) || (fuzz.port == 0 && fuzz.protocol != 3) ||
+    if((fuzz.host == NULL) || (fuzz.port == 0 && fuzz.protocol != 3 && fuzz.protocol != 4) ||
             (fuzz.protocol == 0)){
         help();
         return 0;
     }
 
     char * file = argv[optind];
+    if(archive_is(file)){
+        replay_archive(file, only);
+        return 1;
+    }
+
     if((fp = fopen(file, "r"))== NULL){
             fatal("[!] Error: Could not open file %s\n", strerror(errno));
     }
@@ -116,7 +169,20 @@ int main(int argc, char ** argv){
     }
     fclose(fp);
 
-    if(data_len > 0){
+    testcase_t * cases;
+    int n, i;
+    if((n = ring_parse(data, data_len, &cases, NULL)) >= 0){
+        // crash ring, send the cases in the order they went out
+        printf("Sending: %s cases: %d\n", file, n);
+        for(i = 0; i < n; i++){
+            if(cases[i].len > 0 && fuzz.send(fuzz.host, fuzz.port, &cases[i]) < 0)
+                printf("[!] Send failed at case %d\n", i + 1);
+            free(cases[i].data);
+        }
+        free(cases);
+        free(data);
+    }
+    else if(data_len > 0){
         testcase_t testcase = {data_len, data, 0x00};
         printf("Sending: %s bytes: %lu\n", file, testcase.len);
         fuzz.send(fuzz.host, fuzz.port, &testcase);
@@ -0,0 +1,201 @@
+/*
+ * File:   ring.c
+ * Author: DoI
+ *
+ * Per worker crash ring. Every case is copied into a preallocated ring of
+ * recently sent payloads before it goes out, dropping the oldest once the ring
+ * is over its byte or case limit. Nothing touches the disk until a crash, when
+ * the ring is written to <output dir>/<tid>.ring in one write(), oldest case
+ * first. For stateful targets this keeps the batches leading up to the crash,
+ * not just the one in flight. replay and --bisect read ring files directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ring.h"
+#include "util.h"
+
+#define RING_ALIGN(_l) (((_l) + 7) & ~(size_t)7)
+#define RECORD_SIZE(_l) (sizeof(struct ring_record) + RING_ALIGN(_l))
+
+// File layout: magic, case count, then the records as they are held in memory
+struct ring_file_header {
+    char magic[8];
+    uint32_t count;
+    uint32_t pad;
+};
+
+void ring_init(struct crash_ring * ring, size_t bytes, unsigned long cases){
+    memset(ring, 0x00, sizeof(*ring));
+    if(bytes == 0 || cases == 0)
+        return;
+
+    ring->size = RING_ALIGN(bytes);
+    ring->max_count = cases;
+    ft_malloc(ring->size, ring->buf);
+}
+
+void ring_free(struct crash_ring * ring){
+    free(ring->buf);
+    memset(ring, 0x00, sizeof(*ring));
+}
+
+// Offset of the record at off, following a wrap back to the start if there is one there
+static size_t record_at(struct crash_ring * ring, size_t off){
+    if(ring->size - off < sizeof(struct ring_record) ||
+            ((struct ring_record *)(ring->buf + off))->len == RING_WRAP)
+        return 0;
+    return off;
+}
+
+// Drop the oldest record
+static void ring_pop(struct crash_ring * ring){
+    struct ring_record * rec;
+
+    ring->tail = record_at(ring, ring->tail);
+    rec = (struct ring_record *)(ring->buf + ring->tail);
+    ring->tail += RECORD_SIZE(rec->len);
+    ring->count--;
+
+    if(ring->count == 0)
+        ring->head = ring->tail = 0;
+}
+
+void ring_push(struct crash_ring * ring, const char * data, uint32_t len){
+    size_t need = RECORD_SIZE(len);
+    struct ring_record * rec;
+    struct timespec ts;
+
+    // disabled, or too big to keep without flushing most of the history
+    if(ring->buf == NULL || need > ring->size / 2)
+        return;
+
+    while(ring->count >= ring->max_count)
+        ring_pop(ring);
+
+    for(;;){
+        if(ring->count == 0)
+            ring->head = ring->tail = 0;
+
+        if(ring->head > ring->tail || ring->count == 0){
+            // live records are [tail, head), free space runs to the end of the buffer
+            if(ring->size - ring->head >= need)
+                break;
+            if(ring->size - ring->head >= sizeof(struct ring_record))
+                ((struct ring_record *)(ring->buf + ring->head))->len = RING_WRAP;
+            ring->head = 0;
+        }
+        else{
+            // wrapped, free space is [head, tail)
+            if(ring->tail - ring->head >= need)
+                break;
+            ring_pop(ring);
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec = (struct ring_record *)(ring->buf + ring->head);
+    rec->ts = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->len = len;
+    rec->pad = 0;
+    memcpy(rec + 1, data, len);
+
+    ring->head += need;
+    ring->count++;
+}
+
+/*
+ * Write the ring to path, oldest case first, with a single write(). Returns the number of cases
+ * written, or -1 on error.
+ */
+int ring_flush(struct crash_ring * ring, char * path){
+    struct ring_file_header hdr;
+    struct ring_record * rec;
+    size_t total = sizeof(hdr), off, out;
+    unsigned long i;
+    char * buf;
+    int fd;
+
+    if(ring->buf == NULL || ring->count == 0)
+        return 0;
+
+    for(i = 0, off = ring->tail; i < ring->count; i++){
+        off = record_at(ring, off);
+        rec = (struct ring_record *)(ring->buf + off);
+        total += RECORD_SIZE(rec->len);
+        off += RECORD_SIZE(rec->len);
+    }
+
+    ft_malloc(total, buf);
+    memset(&hdr, 0x00, sizeof(hdr));
+    memcpy(hdr.magic, RING_MAGIC, sizeof(hdr.magic));
+    hdr.count = ring->count;
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    for(i = 0, off = ring->tail, out = sizeof(hdr); i < ring->count; i++){
+        off = record_at(ring, off);
+        rec = (struct ring_record *)(ring->buf + off);
+        memcpy(buf + out, rec, RECORD_SIZE(rec->len));
+        out += RECORD_SIZE(rec->len);
+        off += RECORD_SIZE(rec->len);
+    }
+
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0){
+        printf("[!] Could not open %s: %s\n", path, strerror(errno));
+        free(buf);
+        return -1;
+    }
+    if(write(fd, buf, total) != (ssize_t)total){
+        printf("[!] Short write to %s: %s\n", path, strerror(errno));
+        close(fd);
+        free(buf);
+        return -1;
+    }
+    close(fd);
+    free(buf);
+
+    return ring->count;
+}
+
+/*
+ * Split a flushed ring file into an array of testcases, oldest first, along with the time each was
+ * sent if ts is not NULL. Returns the number of cases, or -1 if data is not a ring file.
+ */
+int ring_parse(const char * data, size_t len, testcase_t ** cases, uint64_t ** ts){
+    const struct ring_file_header * hdr = (const struct ring_file_header *)data;
+    const struct ring_record * rec;
+    size_t off = sizeof(*hdr);
+    uint32_t i;
+
+    if(len < sizeof(*hdr) || memcmp(hdr->magic, RING_MAGIC, sizeof(hdr->magic)) != 0)
+        return -1;
+
+    ft_malloc((hdr->count + 1) * sizeof(testcase_t), *cases);
+    if(ts)
+        ft_malloc((hdr->count + 1) * sizeof(uint64_t), *ts);
+
+    for(i = 0; i < hdr->count; i++){
+        rec = (const struct ring_record *)(data + off);
+        if(len - off < sizeof(*rec) || len - off - sizeof(*rec) < rec->len)
+            break; // truncated, keep what's there
+
+        (*cases)[i].len = rec->len;
+        (*cases)[i].next = NULL;
+        ft_malloc(rec->len + 1, (*cases)[i].data);
+        memcpy((*cases)[i].data, rec + 1, rec->len);
+        if(ts)
+            (*ts)[i] = rec->ts;
+
+        off += RECORD_SIZE(rec->len);
+        if(off > len)
+            off = len;
+    }
+
+    return i;
+}
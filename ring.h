@@ -0,0 +1,42 @@
+/*
+ * File:   ring.h
+ * Author: DoI
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "generator.h"
+
+#define RING_MAGIC "FZRING01"
+#define RING_BYTES (4 << 20) // default payload memory per worker
+#define RING_CASES 1000 // default most recent cases kept per worker
+#define RING_WRAP 0xffffffff // record length marking the unused tail of the buffer before a wrap
+
+// Record header in memory and in a flushed ring file, followed by the payload padded to 8 bytes
+struct ring_record {
+    uint64_t ts; // CLOCK_REALTIME nanoseconds the case was sent at
+    uint32_t len;
+    uint32_t pad;
+};
+
+// Recently sent cases of one worker, oldest at tail
+struct crash_ring {
+    char * buf;
+    size_t size;
+    size_t head; // offset the next record goes at
+    size_t tail; // offset of the oldest record
+    unsigned long count;
+    unsigned long max_count;
+};
+
+void ring_init(struct crash_ring * ring, size_t bytes, unsigned long cases);
+void ring_free(struct crash_ring * ring);
+void ring_push(struct crash_ring * ring, const char * data, uint32_t len);
+int ring_flush(struct crash_ring * ring, char * path);
+int ring_parse(const char * data, size_t len, testcase_t ** cases, uint64_t ** ts);
+
+#endif
@@ -0,0 +1,294 @@
+/*
+ * File:   san.c
+ * Author: DoI
+ *
+ * AddressSanitizer / UndefinedBehaviorSanitizer report parsing for crash
+ * deduplication. Reports are picked out of the monitored logs, and the error
+ * type plus the top SAN_FRAMES frames (sanitizer runtime frames skipped) are
+ * hashed into a signature. Cases spooled for a crash are filed under
+ * <output dir>/<signature>/ along with the report, and crashes with a
+ * signature that already has a directory are thrown away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "san.h"
+#include "state.h"
+#include "util.h"
+
+int san_enabled = 0;
+
+static pthread_mutex_t san_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t san_cond = PTHREAD_COND_INITIALIZER;
+static struct san_parser * pending = NULL; // parser with an unfinished report
+static struct san_report last; // most recently completed report
+static unsigned long report_count = 0;
+
+// Copy the run of src up to any of the stop characters, dropping words that are numbers or addresses
+static void copy_words(char * dst, size_t size, const char * src, const char * stop){
+    const char * start = src;
+    size_t n = 0;
+
+    while(*src && !strchr(stop, *src) && n + 1 < size){
+        if((src == start || isspace((unsigned char)src[-1])) && isdigit((unsigned char)*src)){
+            // 0x1234, 42 and so on vary between runs
+            while(*src && !isspace((unsigned char)*src) && !strchr(stop, *src))
+                src++;
+            continue;
+        }
+        dst[n++] = *src++;
+    }
+    while(n && isspace((unsigned char)dst[n - 1]))
+        n--;
+    dst[n] = '\0';
+}
+
+static void finish_report(struct san_parser * p){
+    struct san_report * r = &p->report;
+    char key[sizeof(r->type) + sizeof(r->frames)];
+    int i;
+
+    snprintf(key, sizeof(key), "%s", r->type);
+    for(i = 0; i < r->frame_count; i++){
+        strncat(key, "|", sizeof(key) - strlen(key) - 1);
+        strncat(key, r->frames[i], sizeof(key) - strlen(key) - 1);
+    }
+    snprintf(r->sig, sizeof(r->sig), "%08x", case_hash(key, strlen(key)));
+
+    memcpy(&last, r, sizeof(last));
+    report_count++;
+    pthread_cond_broadcast(&san_cond);
+
+    p->active = 0;
+    p->in_stack = 0;
+    if(pending == p)
+        pending = NULL;
+}
+
+// Pull the function (or module+offset for unsymbolized frames) out of a "#N 0x... in func file:line" line
+static void add_frame(struct san_report * r, const char * line){
+    const char * f;
+
+    if(r->frame_count == SAN_FRAMES)
+        return;
+
+    if((f = strstr(line, " in ")) != NULL)
+        f += 4;
+    else if((f = strchr(line, '(')) != NULL)
+        f++;
+    else
+        return;
+
+    // the sanitizer's own interceptors and reporting code say nothing about the bug
+    if(!strncmp(f, "__asan", 6) || !strncmp(f, "__ubsan", 7) || !strncmp(f, "__sanitizer", 11) ||
+            !strncmp(f, "__interceptor", 13) || !strncmp(f, "__lsan", 6))
+        return;
+
+    copy_words(r->frames[r->frame_count++], sizeof(r->frames[0]), f, " )\n");
+}
+
+static void start_report(struct san_parser * p){
+    if(p->active)
+        finish_report(p); // a new report before the last one finished
+    memset(&p->report, 0x00, sizeof(p->report));
+    p->active = 1;
+    p->in_stack = 0;
+    pending = p;
+}
+
+/*
+ * Feed one log line to the parser. Returns 1 if the line starts a sanitizer report, so the caller
+ * can treat it like a regex match, 0 otherwise.
+ */
+int san_line(struct san_parser * p, const char * line){
+    const char * s, * frame;
+    int started = 0;
+    size_t len;
+
+    pthread_mutex_lock(&san_lock);
+
+    if((s = strstr(line, "ERROR: ")) != NULL && strstr(line, "Sanitizer")){
+        // ==1234==ERROR: AddressSanitizer: heap-buffer-overflow on address ...
+        start_report(p);
+        copy_words(p->report.type, sizeof(p->report.type), s + 7, "\n");
+        if((s = strstr(p->report.type, " on ")) != NULL)
+            *(char *)s = '\0';
+        started = 1;
+    }
+    else if((s = strstr(line, ": runtime error: ")) != NULL){
+        // file.c:12:3: runtime error: signed integer overflow: ...
+        start_report(p);
+        strcpy(p->report.type, "UndefinedBehaviorSanitizer: ");
+        len = strlen(p->report.type);
+        copy_words(p->report.type + len, sizeof(p->report.type) - len, s + 17, ":\n");
+        // without print_stacktrace=1 the source location is all there is
+        copy_words(p->report.frames[0], sizeof(p->report.frames[0]), line, " \n");
+        if((s = strstr(p->report.frames[0], ": runtime error")) != NULL)
+            *(char *)s = '\0';
+        p->report.frame_count = 1;
+        started = 1;
+    }
+    else if(p->active){
+        for(frame = line; *frame == ' ' || *frame == '\t'; frame++);
+
+        if(frame[0] == '#' && isdigit((unsigned char)frame[1])){
+            if(p->in_stack == 0){
+                // with print_stacktrace=1, UBSan's stack replaces the source location
+                if(!strncmp(p->report.type, "UndefinedBehaviorSanitizer", 26))
+                    p->report.frame_count = 0;
+                p->in_stack = 1;
+            }
+            if(p->in_stack == 1)
+                add_frame(&p->report, frame);
+        }
+        else if(p->in_stack == 1){
+            // ASan follows the crashing stack with allocation/free stacks, they don't go in the signature
+            p->in_stack = 2;
+        }
+    }
+
+    if(p->active){
+        len = strlen(line);
+        if(p->report.text_len + len < SAN_REPORT_MAX){
+            memcpy(p->report.text + p->report.text_len, line, len);
+            p->report.text_len += len;
+        }
+        if(!strncmp(line, "SUMMARY: ", 9))
+            finish_report(p);
+    }
+
+    pthread_mutex_unlock(&san_lock);
+    return started;
+}
+
+// Number of reports completed so far, to pass to san_wait()
+unsigned long san_reports(){
+    unsigned long ret;
+
+    pthread_mutex_lock(&san_lock);
+    ret = report_count;
+    pthread_mutex_unlock(&san_lock);
+
+    return ret;
+}
+
+/*
+ * Wait up to ms for a report after the first seen. A report still being assembled when the wait
+ * runs out is finished as it is (UBSan without a stack trace has no closing line). Returns 1 and
+ * copies the report to out if there is one, 0 otherwise.
+ */
+int san_wait(unsigned long seen, int ms, struct san_report * out){
+    struct timespec deadline;
+    int ret = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&san_lock);
+    while(report_count == seen){
+        if(pthread_cond_timedwait(&san_cond, &san_lock, &deadline) != 0){
+            if(pending)
+                finish_report(pending);
+            break;
+        }
+    }
+    if(report_count != seen){
+        memcpy(out, &last, sizeof(*out));
+        ret = 1;
+    }
+    pthread_mutex_unlock(&san_lock);
+
+    return ret;
+}
+
+// Returns 1 if crashes with this signature have been filed before
+int san_known(char * dir, struct san_report * report){
+    char path[PATH_MAX];
+    struct stat s;
+
+    snprintf(path, PATH_MAX, "%s/%s", dir, report->sig);
+    return stat(path, &s) == 0 && S_ISDIR(s.st_mode);
+}
+
+// Does name belong to one of the threads, either spooled (<tid>-<n>, <tid>.ring) or bisected (crash-<tid>-...)
+static int owned_by(char * name, int * tids, int count){
+    char prefix[32];
+    int i;
+
+    for(i = 0; i < count; i++){
+        snprintf(prefix, sizeof(prefix), "%d-", tids[i]);
+        if(!strncmp(name, prefix, strlen(prefix)))
+            return 1;
+        snprintf(prefix, sizeof(prefix), "%d.ring", tids[i]);
+        if(!strcmp(name, prefix))
+            return 1;
+        snprintf(prefix, sizeof(prefix), "crash-%d-", tids[i]);
+        if(!strncmp(name, prefix, strlen(prefix)))
+            return 2;
+    }
+
+    return 0;
+}
+
+// Move the cases spooled by the given threads, and anything bisected from them, to <dir>/<signature>/
+void san_file(char * dir, struct san_report * report, int * tids, int count){
+    char sig_dir[PATH_MAX], from[PATH_MAX], to[PATH_MAX];
+    struct dirent * ent;
+    DIR * d;
+    FILE * fp;
+
+    snprintf(sig_dir, PATH_MAX, "%s/%s", dir, report->sig);
+    if(mkdir(sig_dir, 0755) < 0 && errno != EEXIST){
+        fatal("[!] Could not mkdir %s: %s\n", sig_dir, strerror(errno));
+    }
+
+    snprintf(to, PATH_MAX, "%s/%s/report.txt", dir, report->sig);
+    if((fp = fopen(to, "w")) != NULL){
+        fwrite(report->text, 1, report->text_len, fp);
+        fclose(fp);
+    }
+
+    if((d = opendir(dir)) == NULL)
+        return;
+    while((ent = readdir(d)) != NULL){
+        if(!owned_by(ent->d_name, tids, count))
+            continue;
+        snprintf(from, PATH_MAX, "%s/%s", dir, ent->d_name);
+        snprintf(to, PATH_MAX, "%s/%s/%s", dir, report->sig, ent->d_name);
+        if(rename(from, to) < 0)
+            printf("[!] Could not move %s to %s: %s\n", from, to, strerror(errno));
+    }
+    closedir(d);
+}
+
+// Remove the cases spooled by the given threads, used for crashes already filed
+void san_discard(char * dir, int * tids, int count){
+    char path[PATH_MAX];
+    struct dirent * ent;
+    DIR * d;
+
+    if((d = opendir(dir)) == NULL)
+        return;
+    while((ent = readdir(d)) != NULL){
+        if(owned_by(ent->d_name, tids, count) != 1)
+            continue;
+        snprintf(path, PATH_MAX, "%s/%s", dir, ent->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
@@ -0,0 +1,41 @@
+/*
+ * File:   san.h
+ * Author: DoI
+ */
+
+#ifndef SAN_H
+#define SAN_H
+
+#include <stdint.h>
+
+#define SAN_FRAMES 3 // top stack frames that make up a crash signature
+#define SAN_REPORT_MAX 16384 // most of a report kept for report.txt
+#define SAN_WAIT_MS 1000 // time given to the log monitor to finish a report after a crash
+
+// A sanitizer report, as assembled from the target's log
+struct san_report {
+    char sig[9]; // hex signature, also the directory the cases are filed under
+    char type[128]; // eg "AddressSanitizer: heap-buffer-overflow"
+    char frames[SAN_FRAMES][128];
+    int frame_count;
+    char text[SAN_REPORT_MAX];
+    unsigned long text_len;
+};
+
+// Per log parser state
+struct san_parser {
+    int active; // inside a report
+    int in_stack; // frame lines seen, the first non-frame line ends the stack
+    struct san_report report;
+};
+
+extern int san_enabled;
+
+int san_line(struct san_parser * p, const char * line);
+unsigned long san_reports();
+int san_wait(unsigned long seen, int ms, struct san_report * out);
+int san_known(char * dir, struct san_report * report);
+void san_file(char * dir, struct san_report * report, int * tids, int count);
+void san_discard(char * dir, int * tids, int count);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * File:   sched.c
+ * Author: DoI
+ *
+ * Work stealing for the deterministic stages. A case's deterministic stage is
+ * split into units of SCHED_UNIT_BITS bit offsets, queued on one worker's
+ * deque. A worker takes units from the head of its own deque, and once that is
+ * empty steals from the tail of the others', so a large seed no longer holds
+ * up the deterministic stages of everything queued behind it. Radamsa batches
+ * are generated on demand by whichever worker has no units to run.
+ *
+ * Each deque has its own lock, held only long enough to move a unit in or
+ * out; units are thousands of cases long, so the locks are rarely contended.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sched.h"
+#include "state.h"
+#include "util.h"
+
+static struct sched_deque * deques = NULL;
+static int deque_count = 0;
+static atomic_int initial_left = 0; // seeds queued at start that still have units to go
+
+void sched_init(int workers){
+    int i;
+
+    deque_count = workers;
+    if((deques = aligned_alloc(64, workers * sizeof(struct sched_deque))) == NULL){
+        fatal("[!] Could not allocate work queues\n");
+    }
+    memset(deques, 0x00, workers * sizeof(struct sched_deque));
+    for(i = 0; i < workers; i++){
+        pthread_mutex_init(&deques[i].lock, NULL);
+        deques[i].size = SCHED_DEQUE_MIN;
+        ft_malloc(SCHED_DEQUE_MIN * sizeof(struct sched_unit), deques[i].units);
+    }
+}
+
+// Called with the deque locked
+static void grow(struct sched_deque * d){
+    struct sched_unit * units;
+    unsigned long i;
+
+    ft_malloc(d->size * 2 * sizeof(struct sched_unit), units);
+    for(i = 0; i < d->count; i++)
+        units[i] = d->units[(d->head + i) % d->size];
+    free(d->units);
+    d->units = units;
+    d->head = 0;
+    d->size *= 2;
+}
+
+/*
+ * Queue the deterministic stage of a case on a worker, from bit offset from. Seeds queued at start
+ * (SCHED_INITIAL) go on the tail in the order given, anything else goes on the head so the worker
+ * that found it gets to it next.
+ */
+void sched_add(int worker, const char * data, unsigned long len, uint32_t hash, unsigned long from, int flags){
+    struct sched_deque * d = &deques[worker % deque_count];
+    struct sched_seed * seed;
+    struct sched_unit unit;
+    unsigned long bits = len << 3, i;
+    char * copy;
+
+    if(from >= bits)
+        return;
+
+    ft_malloc(sizeof(struct sched_seed), seed);
+    memset(seed, 0x00, sizeof(struct sched_seed));
+    if(flags & SCHED_COPY){
+        ft_malloc(len, copy);
+        memcpy(copy, data, len);
+        data = copy;
+    }
+    seed->data = data;
+    seed->len = len;
+    seed->hash = hash;
+    seed->flags = flags;
+    seed->from = from;
+    seed->units = (bits - from + SCHED_UNIT_BITS - 1) / SCHED_UNIT_BITS;
+    ft_malloc(seed->units, seed->done);
+    memset(seed->done, 0x00, seed->units);
+    atomic_init(&seed->left, seed->units);
+    if(flags & SCHED_INITIAL)
+        atomic_fetch_add(&initial_left, 1);
+
+    pthread_mutex_lock(&d->lock);
+    while(d->count + seed->units > d->size)
+        grow(d);
+    for(i = 0; i < seed->units; i++){
+        // in reverse onto the head, so the first unit ends up first
+        unit.seed = seed;
+        unit.start = from + ((flags & SCHED_INITIAL) ? i : seed->units - 1 - i) * SCHED_UNIT_BITS;
+        unit.end = MIN(unit.start + SCHED_UNIT_BITS, bits);
+        if(flags & SCHED_INITIAL){
+            d->units[(d->head + d->count) % d->size] = unit;
+        }
+        else{
+            d->head = (d->head + d->size - 1) % d->size;
+            d->units[d->head] = unit;
+        }
+        d->count++;
+    }
+    pthread_mutex_unlock(&d->lock);
+}
+
+// Next unit for a worker: its own head, or else another worker's tail. Returns 1 if there was one
+int sched_next(int worker, struct sched_unit * unit){
+    struct sched_deque * d;
+    int i;
+
+    d = &deques[worker % deque_count];
+    pthread_mutex_lock(&d->lock);
+    if(d->count){
+        *unit = d->units[d->head];
+        d->head = (d->head + 1) % d->size;
+        d->count--;
+        pthread_mutex_unlock(&d->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    // steal, starting with the next worker along so thieves spread out
+    for(i = 1; i < deque_count; i++){
+        d = &deques[(worker + i) % deque_count];
+        pthread_mutex_lock(&d->lock);
+        if(d->count){
+            d->count--;
+            *unit = d->units[(d->head + d->count) % d->size];
+            pthread_mutex_unlock(&d->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    return 0;
+}
+
+/*
+ * Record a unit as finished, every case in it sent. The campaign state gets the offset below which
+ * the seed's units are all done, for --resume. Returns 1 if this finished the last of the initial
+ * seeds.
+ */
+int sched_done(struct sched_unit * unit){
+    struct sched_seed * seed = unit->seed;
+    unsigned long idx = (unit->start - seed->from) / SCHED_UNIT_BITS;
+    int last_initial = 0;
+
+    pthread_mutex_lock(&campaign_lock);
+    seed->done[idx] = 1;
+    while(seed->contig < seed->units && seed->done[seed->contig])
+        seed->contig++;
+    determ_set_offset(seed->hash, MIN(seed->from + seed->contig * SCHED_UNIT_BITS, seed->len << 3));
+
+    if(atomic_fetch_sub(&seed->left, 1) == 1){
+        determ_mark_done(seed->hash);
+        if(seed->flags & SCHED_INITIAL)
+            last_initial = atomic_fetch_sub(&initial_left, 1) == 1;
+        if(seed->flags & SCHED_COPY)
+            free((char *)seed->data);
+        free(seed->done);
+        free(seed);
+    }
+    pthread_mutex_unlock(&campaign_lock);
+
+    return last_initial;
+}
+
+// Put back a unit that was cut short, from unit->start on, at the head of a worker's deque to be rerun
+void sched_retry(int worker, struct sched_unit * unit){
+    struct sched_deque * d = &deques[worker % deque_count];
+
+    pthread_mutex_lock(&d->lock);
+    if(d->count == d->size)
+        grow(d);
+    d->head = (d->head + d->size - 1) % d->size;
+    d->units[d->head] = *unit;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+// determ_is_done(), safe against sched_done() adding to the list at the same time
+int sched_is_done(uint32_t hash){
+    int r;
+
+    pthread_mutex_lock(&campaign_lock);
+    r = determ_is_done(hash);
+    pthread_mutex_unlock(&campaign_lock);
+
+    return r;
+}
+
+// Only once the workers are gone. Seeds with units still queued are leaked, as several units share one
+void sched_free(){
+    int i;
+
+    for(i = 0; i < deque_count; i++){
+        pthread_mutex_destroy(&deques[i].lock);
+        free(deques[i].units);
+    }
+    free(deques);
+    deques = NULL;
+    deque_count = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * File:   sched.h
+ * Author: DoI
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define SCHED_UNIT_BITS 1024 // bit offsets of a seed's deterministic stage per work unit
+#define SCHED_DEQUE_MIN 64 // initial size of a worker's deque
+
+// sched_add() flags
+#define SCHED_INITIAL 0x01 // one of the seeds queued at start, goes on the tail
+#define SCHED_COPY 0x02 // data doesn't outlive the call, keep a copy
+
+// A case whose deterministic stage has been split into units
+struct sched_seed {
+    const char * data;
+    unsigned long len;
+    uint32_t hash;
+    int flags; // SCHED_*
+    unsigned long from; // offset the units start at, non-zero when resuming
+    unsigned long units;
+    unsigned long contig; // units completed without a gap, from the first
+    uint8_t * done; // per unit, completed out of order
+    atomic_ulong left; // units not completed
+};
+
+// Bits [start, end) of a seed
+struct sched_unit {
+    struct sched_seed * seed;
+    unsigned long start;
+    unsigned long end;
+};
+
+// One worker's units. The owner takes from the head, thieves from the tail
+struct sched_deque {
+    pthread_mutex_t lock;
+    struct sched_unit * units;
+    unsigned long size;
+    unsigned long head;
+    unsigned long count;
+} __attribute__((aligned(64)));
+
+void sched_init(int workers);
+void sched_add(int worker, const char * data, unsigned long len, uint32_t hash, unsigned long from, int flags);
+int sched_is_done(uint32_t hash);
+int sched_next(int worker, struct sched_unit * unit);
+int sched_done(struct sched_unit * unit);
+void sched_retry(int worker, struct sched_unit * unit);
+void sched_free();
+
+#endif
@@ -22,20 +22,43 @@
 #include <netdb.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
 #include "callback.h"
+#include "desock.h"
 #include "fuzzotron.h"
 #include "generator.h"
 #include "sender.h"
+#include "timing.h"
 #include "util.h"
 
 extern int errno;
 
 #define RECV_TIMEOUT 1 // Timeout for SSL connections - default 1 second
 
+// Wait up to fuzz.response_ms for the target to start answering, so the time taken counts towards
+// the latency the rate controller sees. The response is left for the callbacks
+static void wait_response(int sock){
+    struct pollfd pfd = {sock, POLLIN, 0};
+    uint64_t start;
+
+    if(fuzz.response_ms){
+        start = timing_start();
+        poll(&pfd, 1, fuzz.response_ms);
+        timing_end(STAGE_RESPONSE, start);
+    }
+}
+
+// Refusals and timeouts a busy target gives, rather than one that has gone away
+static int busy_errno(int err){
+    return err == ECONNREFUSED || err == ETIMEDOUT || err == EAGAIN;
+}
+
 /*
  * send a testcase down a
  * udp socket
@@ -44,6 +67,7 @@ int send_udp(char * host, int port, testcase_t * testcase){
     int sock = 0;
     ssize_t r;
     struct sockaddr_in serv_addr;
+    uint64_t start;
 
     if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0){
         fatal("[!] Error: Could not create socket: %s\n", strerror(errno));
@@ -60,6 +84,7 @@ int send_udp(char * host, int port, testcase_t * testcase){
         int ret;
         struct timeval timeout;
 
+        start = timing_start();
         ctx = SSL_CTX_new(DTLS_client_method());
         if(ctx == NULL){
             printf("[!] Error spawning DTLS context\n");
@@ -80,6 +105,7 @@ int send_udp(char * host, int port, testcase_t * testcase){
         SSL_set_bio(ssl, bio, bio);
 
         ret = SSL_connect(ssl);
+        timing_end(STAGE_TLS, start);
         if (ret < 1){
             printf("[!] Error initiating DTLS session. Error no: %d\n", SSL_get_error(ssl, ret));
             SSL_free(ssl);
@@ -88,12 +114,14 @@ int send_udp(char * host, int port, testcase_t * testcase){
             return -1;
         }
 
+        start = timing_start();
         callback_ssl_pre_send(ssl, testcase);
        
         ret = SSL_write(ssl, testcase->data, testcase->len);
         if (ret < 0){
             printf("[!] Error: SSL_write() error code no: %d\n", SSL_get_error(ssl, ret));
         }
+        timing_end(STAGE_WRITE, start);
 
         callback_ssl_post_send(ssl);
 
@@ -104,6 +132,7 @@ int send_udp(char * host, int port, testcase_t * testcase){
         return 0;
     } 
     else {
+        start = timing_start();
         callback_pre_send(sock, testcase); // user defined callback
 
         // payload is larger than maximum datagram, send as multiple datagrams
@@ -139,6 +168,7 @@ int send_udp(char * host, int port, testcase_t * testcase){
             }
         }
 
+        timing_end(STAGE_WRITE, start);
         callback_post_send(sock); // user defined callback
         close(sock);
     }
@@ -161,17 +191,18 @@ int send_tcp(char * host, int port, testcase_t * testcase){
     serv_addr.sin_port = htons(port);
     inet_pton(AF_INET, host, &serv_addr.sin_addr);
 
+    uint64_t start = timing_start();
     int c = connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+    timing_end(STAGE_CONNECT, start);
     if(c < 0){
-        printf("[!] Error: Could not connect: %s errno: %d\n", strerror(errno), errno);
-        if(errno == ECONNRESET){
-            close(sock);
+        int err = errno;
+        if(!fuzz.retry_busy || !busy_errno(err))
+            printf("[!] Error: Could not connect: %s errno: %d\n", strerror(err), err);
+        close(sock);
+        if(err == ECONNRESET){
             return 0; // just skip this testcase
         }
-        else{
-            close(sock);
-            return -1;
-        }
+        return busy_errno(err) ? SEND_BUSY : -1;
     }
 
     if(fuzz.is_tls){
@@ -182,6 +213,7 @@ int send_tcp(char * host, int port, testcase_t * testcase){
         size_t alpn_len;
         unsigned char * alpn;
 
+        start = timing_start();
         ctx = SSL_CTX_new(SSLv23_client_method());
         if(ctx == NULL){
             printf("[!] Error spawning TLS context\n");
@@ -206,6 +238,7 @@ int send_tcp(char * host, int port, testcase_t * testcase){
         ssl = SSL_new(ctx);
         SSL_set_fd(ssl,sock);
         ret = SSL_connect(ssl);
+        timing_end(STAGE_TLS, start);
         if (ret < 1){
             printf("[!] Error initiating TLS session. Error no: %d\n", SSL_get_error(ssl, ret));
             SSL_free(ssl);
@@ -214,11 +247,14 @@ int send_tcp(char * host, int port, testcase_t * testcase){
             return -1;
         }
 
+        start = timing_start();
         callback_ssl_pre_send(ssl, testcase); // user defined callback
         ret = SSL_write(ssl, testcase->data, testcase->len);
         if (ret < 0){
             printf("[!] Error: SSL_write() error no: %d\n", SSL_get_error(ssl, ret));
         }
+        timing_end(STAGE_WRITE, start);
+        wait_response(sock);
         callback_ssl_post_send(ssl); // user defined callback
 
         SSL_free(ssl);
@@ -227,11 +263,14 @@ int send_tcp(char * host, int port, testcase_t * testcase){
         return 0;
     }
     else{
+        start = timing_start();
         callback_pre_send(sock, testcase); // user defined callback
         fcntl(sock, F_SETFL, O_RDONLY|O_NONBLOCK);
         if(write(sock, testcase->data, testcase->len) < 0){
             printf("[!] Error: write() error: %s errno: %d\n", strerror(errno), errno);
         }
+        timing_end(STAGE_WRITE, start);
+        wait_response(sock);
         callback_post_send(sock); // user defined callback
     }
 
@@ -310,18 +349,99 @@ int send_unix(char * path, int port __attribute__((unused)), testcase_t * testca
         fatal("[!] Error: Could not create socket: %s\n", strerror(errno));
     }
 
-    if(connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0){
-        printf("[!] Error: Could not connect to socket: %s\n", strerror(errno));
-        return -1;
+    uint64_t start = timing_start();
+    int c = connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+    timing_end(STAGE_CONNECT, start);
+    if(c < 0){
+        // a full listen backlog is EAGAIN, a refusal here means nothing is listening
+        int err = errno;
+        if(!fuzz.retry_busy || err != EAGAIN)
+            printf("[!] Error: Could not connect to socket: %s\n", strerror(err));
+        close(sock);
+        return err == EAGAIN ? SEND_BUSY : -1;
     }
 
+    start = timing_start();
     callback_pre_send(sock, testcase); // user defined callback
     if(write(sock, testcase->data, testcase->len)<0){
         printf("[!] Error: write() error: %s errno: %d\n", strerror(errno), errno);
     }
+    timing_end(STAGE_WRITE, start);
+    wait_response(sock);
     callback_post_send(sock); // user defined callback
 
     close(sock);
 
     return 0;
 }
+
+/*
+ * Append a testcase to the shared memory ring read by a target running under the
+ * libdesock.so preload shim (see desock.c). No socket is involved, so the connection
+ * callbacks are not called. Apart from waking a sleeping target, or sleeping while the
+ * ring is full, no syscalls are made.
+ * Returns -1 if the target has not drained the ring within RECV_TIMEOUT seconds.
+ */
+int send_shm(char * name, int port __attribute__((unused)), testcase_t * testcase){
+    static struct desock_ring * ring = NULL;
+    static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+    uint64_t need, head, off, pad;
+    uint32_t len = testcase->len, seq;
+    unsigned long spins = 0;
+    struct timespec start, now;
+
+    if(ring == NULL){
+        pthread_mutex_lock(&ring_lock);
+        if(ring == NULL && (ring = desock_open(name)) == NULL){
+            fatal("[!] Error: Could not map desock ring %s: %s\n", name, strerror(errno));
+        }
+        pthread_mutex_unlock(&ring_lock);
+    }
+
+    need = desock_record_size(testcase->len);
+    if(need > ring->size / 2){
+        printf("[!] Error: testcase of %lu bytes does not fit the desock ring, skipping\n", testcase->len);
+        return 0;
+    }
+
+    while(__atomic_exchange_n(&ring->lock, 1, __ATOMIC_ACQUIRE))
+        desock_pause();
+
+    head = ring->head;
+    off = head % ring->size;
+    pad = (off + need > ring->size) ? ring->size - off : 0; // records never straddle the end
+
+    // spin briefly for the target to make room, then sleep until it consumes a record
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(1){
+        seq = __atomic_load_n(&ring->tail_seq, __ATOMIC_ACQUIRE);
+        if(ring->size - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) >= pad + need)
+            break;
+
+        if(++spins < DESOCK_FULL_SPIN)
+            desock_pause();
+        else
+            desock_wait(&ring->tail_seq, &ring->full_waiting, seq);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(now.tv_sec - start.tv_sec > RECV_TIMEOUT){
+            __atomic_store_n(&ring->lock, 0, __ATOMIC_RELEASE);
+            printf("[!] Error: target stopped reading the desock ring\n");
+            return -1;
+        }
+    }
+
+    if(pad){
+        uint32_t marker = DESOCK_PAD;
+        memcpy(ring->data + off, &marker, sizeof(marker));
+        off = 0;
+    }
+    memcpy(ring->data + off, &len, sizeof(len));
+    memcpy(ring->data + off + sizeof(len), testcase->data, testcase->len);
+
+    __atomic_store_n(&ring->head, head + pad + need, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ring->lock, 0, __ATOMIC_RELEASE);
+
+    desock_post(&ring->head_seq, &ring->waiting);
+    return 0;
+}
@@ -9,11 +9,14 @@
 
 #include "generator.h"
 
+#define SEND_BUSY -2 // connection refused or timed out, the target may only be overloaded, see rate.c
+
 void setup_tcp(int sock);
 int send_udp(char * host, int port, testcase_t * testcase);
 int send_tcp(char * host, int port, testcase_t * testcase);
 void destroy_socket(int sock);
 unsigned char * next_protos_parse(size_t * outlen, const char * in);
 int send_unix(char * path, int port /* not used for UNIX sockets */, testcase_t * testcase);
+int send_shm(char * name, int port /* not used for shared memory */, testcase_t * testcase);
 
 #endif
\ No newline at end of file
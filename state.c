@@ -0,0 +1,306 @@
+/*
+ * File:   state.c
+ * Author: DoI
+ *
+ * Checkpoint and resume of campaign state. The virgin map, variable byte map,
+ * global counters and deterministic stage progress are written to a single
+ * file in the output directory, so a restarted fuzzer can pick up where the
+ * previous one stopped instead of re-calibrating and re-flipping everything.
+ * The file is synced before it replaces the previous checkpoint, and the
+ * directory after, so a power cut leaves one checkpoint or the other.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+
+#include "fuzzotron.h"
+#include "state.h"
+#include "trace.h"
+#include "util.h"
+
+struct campaign_state campaign;
+pthread_mutex_t campaign_lock = PTHREAD_MUTEX_INITIALIZER; // deterministic progress, here and in sched.c
+
+// On-disk header, followed by virgin_bits, var_bytes, the determ_done hashes and the determ_partial offsets
+struct state_header {
+    char magic[8];
+    uint32_t map_size;
+    uint32_t var_byte_count;
+    uint64_t cases_sent;
+    uint64_t paths;
+    uint64_t cases_jettisoned;
+    uint32_t mode; // STATE_MODE_*
+    uint32_t determ_done_count;
+    uint32_t determ_partial_count;
+    uint32_t pad;
+};
+
+// FNV-1a, used to identify seeds across restarts independently of file names
+uint32_t case_hash(const char * data, unsigned long len){
+    uint32_t hash = 2166136261u;
+    unsigned long i;
+
+    for(i = 0; i < len; i++){
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+int determ_is_done(uint32_t hash){
+    uint32_t i;
+
+    for(i = 0; i < campaign.determ_done_count; i++){
+        if(campaign.determ_done[i] == hash)
+            return 1;
+    }
+
+    return 0;
+}
+
+void determ_mark_done(uint32_t hash){
+    if(determ_is_done(hash))
+        return;
+
+    if(campaign.determ_done_count == campaign.determ_done_size){
+        campaign.determ_done_size = campaign.determ_done_size ? campaign.determ_done_size * 2 : 64;
+        campaign.determ_done = realloc(campaign.determ_done, campaign.determ_done_size * sizeof(uint32_t));
+        if(campaign.determ_done == NULL){
+            fatal("[!] realloc failed\n");
+        }
+    }
+
+    campaign.determ_done[campaign.determ_done_count++] = hash;
+    determ_set_offset(hash, 0);
+}
+
+static struct determ_partial * find_partial(uint32_t hash){
+    uint32_t i;
+
+    for(i = 0; i < campaign.determ_partial_count; i++){
+        if(campaign.determ_partial[i].hash == hash)
+            return &campaign.determ_partial[i];
+    }
+
+    return NULL;
+}
+
+// Bit offset a seed's deterministic stage has got to, 0 if it hasn't started or has finished
+unsigned long determ_get_offset(uint32_t hash){
+    struct determ_partial * p = find_partial(hash);
+    return p ? p->offset : 0;
+}
+
+// Record how far a seed's deterministic stage has got, 0 to forget it
+void determ_set_offset(uint32_t hash, unsigned long offset){
+    struct determ_partial * p = find_partial(hash);
+
+    if(offset == 0){
+        if(p)
+            *p = campaign.determ_partial[--campaign.determ_partial_count];
+        return;
+    }
+
+    if(p == NULL){
+        if(campaign.determ_partial_count == campaign.determ_partial_size){
+            campaign.determ_partial_size = campaign.determ_partial_size ? campaign.determ_partial_size * 2 : 16;
+            campaign.determ_partial = realloc(campaign.determ_partial,
+                campaign.determ_partial_size * sizeof(struct determ_partial));
+            if(campaign.determ_partial == NULL){
+                fatal("[!] realloc failed\n");
+            }
+        }
+        p = &campaign.determ_partial[campaign.determ_partial_count++];
+        memset(p, 0x00, sizeof(*p));
+        p->hash = hash;
+    }
+    p->offset = offset;
+}
+
+static uint32_t state_mode(struct fuzzer_args * args){
+    return (args->shm_id ? STATE_MODE_SHM : 0) | (args->bp_cov ? STATE_MODE_BPCOV : 0);
+}
+
+static int write_all(int fd, const void * buf, size_t len){
+    const char * p = buf;
+    ssize_t w;
+
+    while(len > 0){
+        w = write(fd, p, len);
+        if(w < 0){
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        len -= w;
+    }
+
+    return 0;
+}
+
+static int read_all(int fd, void * buf, size_t len){
+    char * p = buf;
+    ssize_t r;
+
+    while(len > 0){
+        r = read(fd, p, len);
+        if(r < 0 && errno == EINTR)
+            continue;
+        if(r <= 0)
+            return -1;
+        p += r;
+        len -= r;
+    }
+
+    return 0;
+}
+
+// fsync() the directory at path, so a rename in it is on disk
+static int sync_dir(char * path){
+    int fd, ret;
+
+    if((fd = open(path, O_RDONLY | O_DIRECTORY)) < 0)
+        return -1;
+    ret = fsync(fd);
+    close(fd);
+
+    return ret;
+}
+
+/*
+ * Write the checkpoint to <directory>/STATE_FILE. The file is written to a temporary
+ * name, synced and renamed into place so a crash mid-write never leaves a torn checkpoint.
+ * Returns 0 on success or -1 on failure.
+ */
+int state_save(char * directory, struct fuzzer_args * args){
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    struct state_header hdr;
+    uint32_t * done = NULL;
+    struct determ_partial * partial = NULL;
+    int fd, ret = 0;
+
+    snprintf(path, PATH_MAX, "%s/%s", directory, STATE_FILE);
+    snprintf(tmp_path, PATH_MAX, "%s/.%s.tmp", directory, STATE_FILE);
+
+    memset(&hdr, 0x00, sizeof(hdr));
+    memcpy(hdr.magic, STATE_MAGIC, sizeof(hdr.magic));
+    hdr.map_size = MAP_SIZE;
+    hdr.var_byte_count = args->var_byte_count;
+    hdr.cases_sent = campaign.cases_sent;
+    hdr.paths = campaign.paths;
+    hdr.cases_jettisoned = campaign.cases_jettisoned;
+    hdr.mode = state_mode(args);
+
+    // the workers move the deterministic progress on while this runs, write from a copy
+    pthread_mutex_lock(&campaign_lock);
+    hdr.determ_done_count = campaign.determ_done_count;
+    if(hdr.determ_done_count){
+        ft_malloc(hdr.determ_done_count * sizeof(uint32_t), done);
+        memcpy(done, campaign.determ_done, hdr.determ_done_count * sizeof(uint32_t));
+    }
+    hdr.determ_partial_count = campaign.determ_partial_count;
+    if(hdr.determ_partial_count){
+        ft_malloc(hdr.determ_partial_count * sizeof(struct determ_partial), partial);
+        memcpy(partial, campaign.determ_partial, hdr.determ_partial_count * sizeof(struct determ_partial));
+    }
+    pthread_mutex_unlock(&campaign_lock);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0){
+        printf("[!] Could not open %s: %s\n", tmp_path, strerror(errno));
+        free(done);
+        free(partial);
+        return -1;
+    }
+
+    if(write_all(fd, &hdr, sizeof(hdr)) < 0 ||
+            write_all(fd, args->virgin_bits, MAP_SIZE) < 0 ||
+            write_all(fd, args->var_bytes, MAP_SIZE) < 0 ||
+            write_all(fd, done, hdr.determ_done_count * sizeof(uint32_t)) < 0 ||
+            write_all(fd, partial, hdr.determ_partial_count * sizeof(struct determ_partial)) < 0 ||
+            fsync(fd) < 0){
+        printf("[!] Could not write %s: %s\n", tmp_path, strerror(errno));
+        ret = -1;
+    }
+    close(fd);
+    free(done);
+    free(partial);
+    if(ret < 0){
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if(rename(tmp_path, path) < 0){
+        printf("[!] Could not rename %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    if(sync_dir(directory) < 0)
+        printf("[!] Could not sync %s: %s\n", directory, strerror(errno));
+
+    return 0;
+}
+
+/*
+ * Load a checkpoint previously written by state_save(). Returns 0 on success, -1 if
+ * there is no usable checkpoint in the directory.
+ */
+int state_load(char * directory, struct fuzzer_args * args){
+    char path[PATH_MAX];
+    struct state_header hdr;
+    int fd;
+
+    snprintf(path, PATH_MAX, "%s/%s", directory, STATE_FILE);
+    fd = open(path, O_RDONLY);
+    if(fd < 0){
+        printf("[!] Could not open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if(read_all(fd, &hdr, sizeof(hdr)) < 0 || memcmp(hdr.magic, STATE_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.map_size != MAP_SIZE){
+        printf("[!] %s is not a valid checkpoint\n", path);
+        close(fd);
+        return -1;
+    }
+
+    free(campaign.determ_done);
+    free(campaign.determ_partial);
+    memset(&campaign, 0x00, sizeof(campaign));
+    campaign.determ_done_count = campaign.determ_done_size = hdr.determ_done_count;
+    if(hdr.determ_done_count)
+        ft_malloc(hdr.determ_done_count * sizeof(uint32_t), campaign.determ_done);
+    campaign.determ_partial_count = campaign.determ_partial_size = hdr.determ_partial_count;
+    if(hdr.determ_partial_count)
+        ft_malloc(hdr.determ_partial_count * sizeof(struct determ_partial), campaign.determ_partial);
+
+    if(read_all(fd, args->virgin_bits, MAP_SIZE) < 0 ||
+            read_all(fd, args->var_bytes, MAP_SIZE) < 0 ||
+            read_all(fd, campaign.determ_done, hdr.determ_done_count * sizeof(uint32_t)) < 0 ||
+            read_all(fd, campaign.determ_partial, hdr.determ_partial_count * sizeof(struct determ_partial)) < 0){
+        fatal("[!] Truncated checkpoint %s\n", path);
+    }
+    close(fd);
+
+    args->var_byte_count = hdr.var_byte_count;
+    campaign.cases_sent = hdr.cases_sent;
+    campaign.paths = hdr.paths;
+    campaign.cases_jettisoned = hdr.cases_jettisoned;
+
+    // coverage from another kind of tracing, or none, would make every path look seen or new
+    if(hdr.mode != state_mode(args)){
+        printf("[!] %s was written with different coverage options, starting the coverage map afresh\n", path);
+        memset(args->virgin_bits, 255, MAP_SIZE);
+        memset(args->var_bytes, 0x00, MAP_SIZE);
+        args->var_byte_count = 0;
+    }
+
+    return 0;
+}
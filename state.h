@@ -0,0 +1,54 @@
+/*
+ * File:   state.h
+ * Author: DoI
+ */
+
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "fuzzotron.h"
+
+#define STATE_FILE "fuzzotron.state" // checkpoint file name, kept in the output directory
+#define STATE_MAGIC "FZSTATE2"
+#define STATE_INTERVAL 60 // seconds between periodic checkpoints
+
+// Coverage the map in a checkpoint was built with, a map from one means nothing to the other
+#define STATE_MODE_SHM 0x01 // --trace
+#define STATE_MODE_BPCOV 0x02 // --bp-cov
+
+// A seed part way through its deterministic stage
+struct determ_partial {
+    uint32_t hash;
+    uint32_t pad;
+    uint64_t offset; // bit offset below which every case has been sent
+};
+
+// Campaign progress that survives a restart with --resume
+struct campaign_state {
+    unsigned long cases_sent;
+    unsigned long paths;
+    unsigned long cases_jettisoned;
+
+    struct determ_partial * determ_partial; // seeds whose deterministic stage is under way
+    uint32_t determ_partial_count;
+    uint32_t determ_partial_size;
+
+    uint32_t * determ_done; // hashes of seeds whose deterministic stage has completed
+    uint32_t determ_done_count;
+    uint32_t determ_done_size;
+};
+
+extern struct campaign_state campaign;
+extern pthread_mutex_t campaign_lock;
+
+uint32_t case_hash(const char * data, unsigned long len);
+int determ_is_done(uint32_t hash);
+void determ_mark_done(uint32_t hash);
+unsigned long determ_get_offset(uint32_t hash);
+void determ_set_offset(uint32_t hash, unsigned long offset);
+int state_save(char * directory, struct fuzzer_args * args);
+int state_load(char * directory, struct fuzzer_args * args);
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * File:   supervisor.c
+ * Author: DoI
+ *
+ * Target supervisor. With --target, fuzzotron starts the target command itself
+ * in its own process group and waits for it to pass a health check before the
+ * workers start. After a crash the old process group is killed off, the target
+ * is started again and the campaign carries on, so a long run is no longer
+ * ended by the first bug.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "affinity.h"
+#include "fuzzotron.h"
+#include "health.h"
+#include "supervisor.h"
+#include "util.h"
+
+struct supervisor_stats supervisor;
+
+static char * target_cmd = NULL;
+static pid_t target_pid = 0;
+
+static unsigned long now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
+}
+
+static pid_t spawn_target(){
+    pid_t pid;
+
+    if((pid = fork()) == 0){
+        // own process group, so the whole target (forking servers included) can be killed
+        setpgid(0, 0);
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGINT, SIG_IGN);
+        affinity_pin_self_target();
+        execl("/bin/sh", "sh", "-c", target_cmd, (char *)NULL);
+        exit(127);
+    }
+    else if(pid < 0){
+        fatal("[!] FORK FAILED!\n");
+    }
+    setpgid(pid, pid);
+
+    return pid;
+}
+
+// Wait for the target to answer health checks, returns 0 once it does
+static int wait_ready(pid_t pid){
+    unsigned long start = now_ms();
+    int status, ret = -1;
+
+    if(!health.probe && !health.coproc && !fuzz.check_script){
+        usleep(SUPERVISOR_SETTLE_MS * 1000);
+        return waitpid(pid, &status, WNOHANG) == 0 ? 0 : -1;
+    }
+
+    // probes fail until the target is listening, the health checker mustn't take that for a crash
+    atomic_store(&shared->booting, 1);
+    while(now_ms() - start < SUPERVISOR_BOOT_MS){
+        if(waitpid(pid, &status, WNOHANG) == pid){
+            printf("[!] Target exited during start-up\n");
+            break;
+        }
+        if(health_check() == 1){
+            ret = 0;
+            break;
+        }
+        usleep(50000);
+    }
+    atomic_store(&shared->booting, 0);
+
+    if(ret < 0 && now_ms() - start >= SUPERVISOR_BOOT_MS)
+        printf("[!] Target was not ready within %dms\n", SUPERVISOR_BOOT_MS);
+    return ret;
+}
+
+// Kill the target's process group and reap it, reporting how it went down
+static void kill_target(){
+    unsigned long start;
+    int status;
+    pid_t r;
+
+    if(target_pid <= 0)
+        return;
+
+    if((r = waitpid(target_pid, &status, WNOHANG)) == target_pid){
+        if(WIFSIGNALED(status))
+            printf("[!!] Target was killed by signal %d (%s)\n", WTERMSIG(status), strsignal(WTERMSIG(status)));
+        else if(WIFEXITED(status))
+            printf("[!!] Target exited with status %d\n", WEXITSTATUS(status));
+    }
+
+    // anything left in the group, eg worker processes of a pre-forking server
+    kill(-target_pid, SIGTERM);
+    if(r != target_pid){
+        start = now_ms();
+        while(waitpid(target_pid, &status, WNOHANG) == 0){
+            if(now_ms() - start > SUPERVISOR_KILL_MS){
+                kill(-target_pid, SIGKILL);
+                waitpid(target_pid, &status, 0);
+                break;
+            }
+            usleep(10000);
+        }
+    }
+    kill(-target_pid, SIGKILL);
+
+    target_pid = 0;
+}
+
+/*
+ * Start cmd and wait for it to be ready. Returns the PID of the target, which is
+ * the shell running cmd, so commands should exec the target.
+ */
+pid_t supervisor_start(char * cmd){
+    target_cmd = cmd;
+    memset(&supervisor, 0x00, sizeof(supervisor));
+
+    printf("[+] Starting target: %s\n", target_cmd);
+    target_pid = spawn_target();
+    if(wait_ready(target_pid) < 0){
+        fatal("[!] Target failed to start\n");
+    }
+    printf("[+] Target up, PID %d\n", target_pid);
+
+    return target_pid;
+}
+
+/*
+ * Kill the running target, if any, and start a fresh one without counting it in the restart stats.
+ * Returns 0 once it is ready and -1 if it could not be brought up. The restart callback for crash
+ * bisection, which restarts the target for every replay.
+ */
+int supervisor_replay(){
+    kill_target();
+    target_pid = spawn_target();
+    if(wait_ready(target_pid) < 0)
+        return -1;
+    check_pid = target_pid;
+
+    return 0;
+}
+
+// supervisor_replay() after a crash, counted and timed for the status line
+int supervisor_restart(){
+    unsigned long start = now_ms();
+
+    if(supervisor_replay() < 0)
+        return -1;
+
+    supervisor.restarts++;
+    supervisor.last_restart_ms = now_ms() - start;
+    supervisor.total_restart_ms += supervisor.last_restart_ms;
+
+    return 0;
+}
+
+void supervisor_stop(){
+    kill_target();
+}
@@ -0,0 +1,29 @@
+/*
+ * File:   supervisor.h
+ * Author: DoI
+ */
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <sys/types.h>
+
+#define SUPERVISOR_BOOT_MS 30000 // give up on a target that isn't ready after this long
+#define SUPERVISOR_SETTLE_MS 500 // readiness delay when there is no health check to wait on
+#define SUPERVISOR_KILL_MS 2000 // SIGKILL a target still running this long after SIGTERM
+
+struct supervisor_stats {
+    unsigned long crashes;
+    unsigned long restarts;
+    unsigned long last_restart_ms; // time from killing the old target to the new one being ready
+    unsigned long total_restart_ms;
+};
+
+extern struct supervisor_stats supervisor;
+
+pid_t supervisor_start(char * cmd);
+int supervisor_replay();
+int supervisor_restart();
+void supervisor_stop();
+
+#endif
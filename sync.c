@@ -0,0 +1,254 @@
+/*
+ * File:   sync.c
+ * Author: DoI
+ *
+ * Corpus synchronisation between fuzzotron instances, along the lines of
+ * AFL's -M/-S. Every instance publishes the paths it finds to
+ * <sync dir>/<name>/queue/<seq>-<hash>, and every SYNC_INTERVAL seconds runs
+ * the cases the other instances have published since it last looked, keeping
+ * those that find something new here. The last case imported from each
+ * instance is recorded in <sync dir>/<name>/synced/<other>, so an instance
+ * that is restarted carries on where it left off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "sync.h"
+#include "util.h"
+
+struct sync_args sync_opts;
+
+static unsigned long next_seq = 1; // sequence number of the next case published
+static time_t last_sync = 0;
+
+// A case waiting to be imported
+struct sync_case {
+    unsigned long seq;
+    char name[NAME_MAX + 1];
+};
+
+static void make_dir(char * path){
+    if(mkdir(path, 0755) < 0 && errno != EEXIST){
+        fatal("[!] Could not mkdir %s: %s\n", path, strerror(errno));
+    }
+}
+
+void sync_init(){
+    char path[PATH_MAX];
+    struct dirent * ents;
+    unsigned long seq;
+    DIR * d;
+
+    if(strchr(sync_opts.name, '/') != NULL || sync_opts.name[0] == '.'){
+        fatal("[!] Bad instance name %s\n", sync_opts.name);
+    }
+
+    make_dir(sync_opts.dir);
+    snprintf(path, PATH_MAX, "%s/%s", sync_opts.dir, sync_opts.name);
+    make_dir(path);
+    snprintf(path, PATH_MAX, "%s/%s/%s", sync_opts.dir, sync_opts.name, SYNC_STATE);
+    make_dir(path);
+    snprintf(path, PATH_MAX, "%s/%s/%s", sync_opts.dir, sync_opts.name, SYNC_QUEUE);
+    make_dir(path);
+
+    // carry on numbering after whatever a previous run published
+    if((d = opendir(path)) != NULL){
+        while((ents = readdir(d)) != NULL){
+            if(ents->d_name[0] == '.')
+                continue;
+            seq = strtoul(ents->d_name, NULL, 10);
+            if(seq >= next_seq)
+                next_seq = seq + 1;
+        }
+        closedir(d);
+    }
+}
+
+int sync_due(){
+    return time(NULL) - last_sync >= SYNC_INTERVAL;
+}
+
+// Make a new path available to the other instances
+void sync_publish(char * data, unsigned long len, uint32_t exec_hash){
+    char tmp[PATH_MAX], path[PATH_MAX];
+    int fd;
+
+    // written under a dot name and renamed, so importers never see half a case
+    snprintf(tmp, PATH_MAX, "%s/%s/%s/.%lu", sync_opts.dir, sync_opts.name, SYNC_QUEUE, next_seq);
+    snprintf(path, PATH_MAX, "%s/%s/%s/%06lu-%u", sync_opts.dir, sync_opts.name, SYNC_QUEUE, next_seq, exec_hash);
+
+    if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0){
+        printf("[!] Could not open %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+    if(write(fd, data, len) != (ssize_t)len){
+        printf("[!] Short write to %s: %s\n", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    close(fd);
+
+    if(rename(tmp, path) < 0){
+        printf("[!] Could not rename %s to %s: %s\n", tmp, path, strerror(errno));
+        unlink(tmp);
+        return;
+    }
+    next_seq++;
+}
+
+static unsigned long load_synced(char * other){
+    char path[PATH_MAX];
+    unsigned long seq = 0;
+    FILE * fp;
+
+    snprintf(path, PATH_MAX, "%s/%s/%s/%s", sync_opts.dir, sync_opts.name, SYNC_STATE, other);
+    if((fp = fopen(path, "r")) != NULL){
+        if(fscanf(fp, "%lu", &seq) != 1)
+            seq = 0;
+        fclose(fp);
+    }
+
+    return seq;
+}
+
+static void save_synced(char * other, unsigned long seq){
+    char path[PATH_MAX];
+    FILE * fp;
+
+    snprintf(path, PATH_MAX, "%s/%s/%s/%s", sync_opts.dir, sync_opts.name, SYNC_STATE, other);
+    if((fp = fopen(path, "w")) == NULL){
+        printf("[!] Could not write %s: %s\n", path, strerror(errno));
+        return;
+    }
+    fprintf(fp, "%lu\n", seq);
+    fclose(fp);
+}
+
+static int cmp_seq(const void * a, const void * b){
+    unsigned long sa = ((const struct sync_case *)a)->seq, sb = ((const struct sync_case *)b)->seq;
+    return (sa > sb) - (sa < sb);
+}
+
+// Load one case from another instance's queue. Returns 0 on success
+static int read_case(char * path, testcase_t * testcase){
+    struct stat s;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if(fstat(fd, &s) < 0 || s.st_size == 0){
+        close(fd);
+        return -1;
+    }
+
+    testcase->len = s.st_size;
+    testcase->next = NULL;
+    ft_malloc(testcase->len + 1, testcase->data);
+    if(read(fd, testcase->data, testcase->len) != (ssize_t)testcase->len){
+        free(testcase->data);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    return 0;
+}
+
+// Import the cases published by one other instance since the last sync
+static int sync_instance(char * other, int (*import)(testcase_t * testcase), unsigned long * kept){
+    char queue[PATH_MAX], path[PATH_MAX + NAME_MAX + 2];
+    struct sync_case * cases = NULL;
+    unsigned long synced, count = 0, size = 0, i;
+    struct dirent * ents;
+    testcase_t testcase;
+    int r, ret = 0;
+    DIR * d;
+
+    snprintf(queue, PATH_MAX, "%s/%s/%s", sync_opts.dir, other, SYNC_QUEUE);
+    if((d = opendir(queue)) == NULL)
+        return 0;
+
+    synced = load_synced(other);
+    while((ents = readdir(d)) != NULL){
+        unsigned long seq;
+
+        if(ents->d_name[0] == '.' || (seq = strtoul(ents->d_name, NULL, 10)) <= synced)
+            continue;
+
+        if(count == size){
+            size = size ? size * 2 : 64;
+            if((cases = realloc(cases, size * sizeof(struct sync_case))) == NULL){
+                fatal("[!] realloc failed\n");
+            }
+        }
+        cases[count].seq = seq;
+        strncpy(cases[count].name, ents->d_name, NAME_MAX);
+        cases[count].name[NAME_MAX] = '\0';
+        count++;
+    }
+    closedir(d);
+
+    // in the order they were found, so later cases are judged against the paths of earlier ones
+    qsort(cases, count, sizeof(struct sync_case), cmp_seq);
+    for(i = 0; i < count; i++){
+        // marked done before it runs, a case that takes the target down isn't imported again
+        synced = cases[i].seq;
+        snprintf(path, sizeof(path), "%s/%s", queue, cases[i].name);
+        if(read_case(path, &testcase) == 0){
+            r = import(&testcase);
+            free(testcase.data);
+            if(r < 0){
+                ret = -1;
+                break;
+            }
+            if(r > 0)
+                (*kept)++;
+        }
+    }
+
+    if(count)
+        save_synced(other, synced);
+    free(cases);
+
+    return ret;
+}
+
+/*
+ * Run everything the other instances have published since the last sync through import, which
+ * returns 1 if it kept the case, 0 if not and -1 if the target went down. Returns the number of
+ * cases kept, or -1 if an import failed.
+ */
+int sync_import(int (*import)(testcase_t * testcase)){
+    struct dirent * ents;
+    unsigned long kept = 0;
+    int ret = 0;
+    DIR * d;
+
+    last_sync = time(NULL);
+    if((d = opendir(sync_opts.dir)) == NULL){
+        printf("[!] Could not open sync directory %s: %s\n", sync_opts.dir, strerror(errno));
+        return 0;
+    }
+
+    while(ret == 0 && (ents = readdir(d)) != NULL){
+        if(ents->d_name[0] == '.' || strcmp(ents->d_name, sync_opts.name) == 0)
+            continue;
+        ret = sync_instance(ents->d_name, import, &kept);
+    }
+    closedir(d);
+
+    if(kept)
+        printf("\n[+] Imported %lu new paths from other instances\n", kept);
+
+    return ret < 0 ? -1 : (int)kept;
+}
@@ -0,0 +1,30 @@
+/*
+ * File:   sync.h
+ * Author: DoI
+ */
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+
+#include "generator.h"
+
+#define SYNC_INTERVAL 15 // seconds between imports from the other instances
+#define SYNC_QUEUE "queue" // <sync dir>/<name>/queue holds the paths an instance found
+#define SYNC_STATE "synced" // <sync dir>/<name>/synced/<other> holds the last case imported from other
+
+struct sync_args {
+    char * dir; // shared sync directory
+    char * name; // this instance's name, its directory under dir
+    int primary; // -M, runs the deterministic stages. -S instances leave them to the primary
+};
+
+extern struct sync_args sync_opts;
+
+void sync_init();
+int sync_due();
+void sync_publish(char * data, unsigned long len, uint32_t exec_hash);
+int sync_import(int (*import)(testcase_t * testcase));
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * File:   timing.c
+ * Author: DoI
+ *
+ * Where the workers' time goes. Each phase of the worker loop is bracketed
+ * with timing_start()/timing_end(), which adds the time taken to a log2
+ * histogram of the calling worker's. The histograms are summed over all the
+ * workers for the status line, which names the stages taking the most time,
+ * and for the table printed on exit.
+ *
+ * Timing a stage costs two vDSO clock reads and a few stores to the worker's
+ * own cache lines, small next to the syscalls being timed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "timing.h"
+#include "util.h"
+
+static const char * stage_names[STAGE_COUNT] = {
+    "generate", "load", "pace", "connect", "tls", "write", "response", "trace", "check", "free"
+};
+
+static struct stage_timing orphan_timing; // anything timed outside a worker, never reported
+static __thread struct stage_timing * timing = &orphan_timing;
+
+// Record the calling thread's stages in timing from now on
+void timing_bind(struct stage_timing * t){
+    timing = t;
+}
+
+// Single writer, a relaxed load and store is enough
+#define BUMP(var, n) atomic_store_explicit(&(var), atomic_load_explicit(&(var), memory_order_relaxed) + (n), \
+    memory_order_relaxed)
+
+void timing_end(int stage, uint64_t start){
+    struct stage_hist * h = &timing->stage[stage];
+    uint64_t ns = timing_start() - start;
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+
+    BUMP(h->count, 1);
+    BUMP(h->ns, ns);
+    BUMP(h->buckets[MIN(b, TIMING_BUCKETS - 1)], 1);
+}
+
+// Sum one stage over every worker
+static void sum_stage(struct stage_timing * all, int workers, int stage, struct stage_hist * out){
+    int i, b;
+
+    memset(out, 0x00, sizeof(struct stage_hist));
+    for(i = 0; i < workers; i++){
+        out->count += atomic_load_explicit(&all[i].stage[stage].count, memory_order_relaxed);
+        out->ns += atomic_load_explicit(&all[i].stage[stage].ns, memory_order_relaxed);
+        for(b = 0; b < TIMING_BUCKETS; b++)
+            out->buckets[b] += atomic_load_explicit(&all[i].stage[stage].buckets[b], memory_order_relaxed);
+    }
+}
+
+// Upper bound of the bucket the given fraction of the samples falls in, in ns
+static uint64_t percentile(struct stage_hist * h, double fraction){
+    unsigned long seen = 0, want = h->count * fraction;
+    int b;
+
+    for(b = 0; b < TIMING_BUCKETS; b++){
+        seen += h->buckets[b];
+        if(seen > want)
+            break;
+    }
+
+    return 1ULL << MIN(b, TIMING_BUCKETS - 1);
+}
+
+static char * fmt_ns(uint64_t ns, char * buf, size_t size){
+    if(ns < 1000)
+        snprintf(buf, size, "%luns", (unsigned long)ns);
+    else if(ns < 1000000)
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    else if(ns < 1000000000)
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    else
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+
+    return buf;
+}
+
+// The stages taking the most time between them, as "connect 41% generate 30% write 12%"
+void timing_status(struct stage_timing * all, int workers, char * buf, size_t size){
+    struct stage_hist sums[STAGE_COUNT];
+    unsigned long total = 0;
+    int i, j, best, used[STAGE_COUNT] = {0};
+    size_t len = 0;
+
+    buf[0] = '\0';
+    for(i = 0; i < STAGE_COUNT; i++){
+        sum_stage(all, workers, i, &sums[i]);
+        total += sums[i].ns;
+    }
+    if(total == 0)
+        return;
+
+    for(j = 0; j < TIMING_STATUS_TOP && len < size; j++){
+        for(i = 0, best = -1; i < STAGE_COUNT; i++)
+            if(!used[i] && sums[i].ns && (best < 0 || sums[i].ns > sums[best].ns))
+                best = i;
+        if(best < 0)
+            break;
+        used[best] = 1;
+        len += snprintf(buf + len, size - len, "%s%s %.0f%%", j ? " " : "", stage_names[best],
+            100.0 * sums[best].ns / total);
+    }
+}
+
+// Print every stage's count, mean, median, 99th percentile and share of the time timed
+void timing_report(struct stage_timing * all, int workers){
+    struct stage_hist sums[STAGE_COUNT];
+    char mean[16], p50[16], p99[16];
+    unsigned long total = 0;
+    int i;
+
+    for(i = 0; i < STAGE_COUNT; i++){
+        sum_stage(all, workers, i, &sums[i]);
+        total += sums[i].ns;
+    }
+    if(total == 0)
+        return;
+
+    printf("[.] Time per stage over %d worker%s:\n", workers, workers == 1 ? "" : "s");
+    printf("    %-10s %10s %9s %9s %9s %7s\n", "stage", "count", "mean", "p50", "p99", "share");
+    for(i = 0; i < STAGE_COUNT; i++){
+        if(sums[i].count == 0)
+            continue;
+        printf("    %-10s %10lu %9s %9s %9s %6.1f%%\n", stage_names[i], sums[i].count,
+            fmt_ns(sums[i].ns / sums[i].count, mean, sizeof(mean)), fmt_ns(percentile(&sums[i], 0.5), p50, sizeof(p50)),
+            fmt_ns(percentile(&sums[i], 0.99), p99, sizeof(p99)), 100.0 * sums[i].ns / total);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * File:   timing.h
+ * Author: DoI
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define TIMING_BUCKETS 32 // log2 buckets of nanoseconds, the last holds anything over ~2s
+#define TIMING_STATUS_TOP 3 // stages named in the status line
+
+// The phases of a worker's loop that are timed
+enum {
+    STAGE_GENERATE, // radamsa or blab fork/exec/wait, or the deterministic stage's bit flips
+    STAGE_LOAD, // load_testcases() reading the generated cases back
+    STAGE_PACE, // waiting on --max-rate or --rate-auto
+    STAGE_CONNECT,
+    STAGE_TLS, // context and handshake
+    STAGE_WRITE, // the case itself, with the send callbacks
+    STAGE_RESPONSE, // waiting for the first response byte, --rate-response
+    STAGE_TRACE, // waiting for the trace bitmap to settle
+    STAGE_CHECK, // check_stop(), the PID check and health probes
+    STAGE_FREE, // free_testcases()
+    STAGE_COUNT
+};
+
+struct stage_hist {
+    atomic_ulong count;
+    atomic_ulong ns;
+    atomic_ulong buckets[TIMING_BUCKETS]; // bucket b holds times in [2^(b-1), 2^b) ns
+};
+
+// One worker's histograms. Only the worker writes them, so there are no locked adds
+struct stage_timing {
+    struct stage_hist stage[STAGE_COUNT];
+} __attribute__((aligned(64)));
+
+// Monotonic nanoseconds, from the vDSO without a syscall
+static inline uint64_t timing_start(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void timing_bind(struct stage_timing * timing);
+void timing_end(int stage, uint64_t start);
+void timing_status(struct stage_timing * all, int workers, char * buf, size_t size);
+void timing_report(struct stage_timing * all, int workers);
+
+#endif
@@ -59,6 +59,62 @@ uint32_t wait_for_bitmap(const void* trace_bits){
     return checksum;
 }
 
+/* Zero out the bytes flagged as variable in var_bytes and return the hash of the remaining,
+   stable part of the bitmap. Noisy edges (timestamps, PRNG driven paths) are masked this way so
+   they do not influence the execution hash or new path detection. */
+uint32_t mask_bitmap(uint8_t * trace_bits, const uint8_t * var_bytes){
+
+#ifdef __x86_64__
+
+  uint64_t * current = (uint64_t *)trace_bits;
+  const uint64_t * var = (const uint64_t *)var_bytes;
+
+  uint32_t  i = (MAP_SIZE >> 3);
+
+#else
+
+  uint32_t * current = (uint32_t *)trace_bits;
+  const uint32_t * var = (const uint32_t *)var_bytes;
+
+  uint32_t i = (MAP_SIZE >> 2);
+
+#endif /* ^__x86_64__ */
+
+  while (i--) {
+    /* var_bytes holds 0/1 flags, not bit masks, so test them on their own: an even hit count
+       ANDed with a flag of 1 would come out zero and the byte would escape the mask. */
+    if (unlikely(*var) && *current) {
+      uint8_t * cur = (uint8_t *)current;
+      const uint8_t * v = (const uint8_t *)var;
+      uint32_t j;
+
+      for (j = 0; j < sizeof(*current); j++)
+        if (v[j]) cur[j] = 0;
+    }
+
+    current++;
+    var++;
+  }
+
+  return hash32(trace_bits, MAP_SIZE, HASH_CONST);
+}
+
+/* Read-only variant of has_new_bits(), returns 2 if trace_bits contains tuples not yet seen in
+   virgin_map, 1 if only hit-counts differ and 0 otherwise. The virgin map is not updated. */
+uint8_t check_new_bits(const uint8_t * virgin_map, const uint8_t * trace_bits){
+  uint32_t i;
+  uint8_t ret = 0;
+
+  for (i = 0; i < MAP_SIZE; i++) {
+    if (unlikely(trace_bits[i]) && unlikely(trace_bits[i] & virgin_map[i])) {
+      if (virgin_map[i] == 0xff) return 2;
+      ret = 1;
+    }
+  }
+
+  return ret;
+}
+
 /* Shamelessly liberated from AFL (http://lcamtuf.coredump.cx/afl/)
 
    Check if the current execution path brings anything new to the table.
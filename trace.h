@@ -16,5 +16,7 @@
 uint32_t wait_for_bitmap(const void * trace_bits);
 uint8_t * setup_shm(int shm_id);
 uint8_t has_new_bits(uint8_t * virgin_map, uint8_t * trace_bits);
+uint8_t check_new_bits(const uint8_t * virgin_map, const uint8_t * trace_bits);
+uint32_t mask_bitmap(uint8_t * trace_bits, const uint8_t * var_bytes);
 
 #endif
\ No newline at end of file
@@ -8,6 +8,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 #define RED   "\x1B[31m"
 #define GRN   "\x1B[32m"
@@ -27,6 +28,16 @@
         exit(0);\
     } while(0)
 
+#define MIN(_a,_b) ((_a) > (_b) ? (_b) : (_a))
+#define MAX(_a,_b) ((_a) > (_b) ? (_a) : (_b))
+
+// Round up to the next power of two, re-used from AFL
+static inline unsigned long next_p2(unsigned long val){
+    unsigned long ret = 1;
+    while(val > ret) ret <<= 1;
+    return ret;
+}
+
 #define ft_malloc(len,ptr) \
     do { \
         if(NULL == (ptr = malloc(len))){\
@@ -34,4 +45,12 @@
         }\
     } while(0)
 
+// Zeroed memory that stays shared with processes forked after it's mapped
+#define ft_shared(len,ptr) \
+    do { \
+        if(MAP_FAILED == (ptr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0))){\
+            fatal("[!] mmap failed\n"); \
+        }\
+    } while(0)
+
 #endif
\ No newline at end of file